@@ -0,0 +1,870 @@
+#include "ais_decoder/strutils.h"
+#include "ais_decoder/decoder.h"
+#include "ais_decoder/generator.h"
+#include "ais_decoder/heatmap.h"
+#include "ais_decoder/mem_pool.h"
+#include "ais_decoder/pipeline.h"
+#include "ais_decoder/processing.h"
+#include "ais_decoder/queue.h"
+#include "ais_decoder/scheduler.h"
+#include "ais_decoder/source.h"
+#include "ais_decoder/vessels.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+/*
+    Micro-benchmarks for the decoder kernels, queues and chunk pool, and end-to-end pipeline runs.
+    All benchmarks run on a fixed, built-in corpus (see makeCorpus()) or a seeded generated feed (see
+    makeGeneratedText()), so results are comparable between builds and machines; every benchmark repeats its loop
+    over the corpus until the minimum run time is reached.
+    Results can be compared against a baseline file (see loadBaseline()), which is how the ctest regression test
+    runs, and written as a JSON report for tracking over time.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+const size_t BENCH_QUEUE_ITEMS = 1000000;
+const size_t BENCH_POOL_OBJECTS = 256;
+
+/* Metrics compared against the baseline: time per operation (kernels, queues, pool), messages per second (pipelines) */
+const char * const METRIC_NS_PER_OP = "ns/op";
+const char * const METRIC_MSGS_PER_S = "msg/s";
+
+/* Tolerances written to baselines for threaded benchmarks, which depend on scheduling (others use --tolerance) */
+const double TOLERANCE_QUEUE_THREADS = 1.0;
+const double TOLERANCE_PIPELINE = 0.5;
+
+
+/* Sentences of the corpus (armoured payload, fill bits and fragment count of the message they belong to). */
+struct SampleSentence
+{
+    const char  *m_pszPayload;
+    int         m_iFillBits;
+    int         m_iFragments;
+};
+
+const std::array<SampleSentence, 8> SAMPLE_SENTENCES = {{
+    {"15RTgt0PAso;90TKcjM8h6g208CQ", 0, 1},                                     // type 1
+    {"177KQJ5000G?tO`K>RA1wUbN0TKH", 0, 1},                                     // type 1
+    {"13u?etPv2;0n:dDPwUM1U1Cb069D", 0, 1},                                     // type 1
+    {"55P5TL01VIaAL@7WKO@mBplU@<PDhh000000001S;AJ::4A80?4i@E53", 0, 2},         // type 5 (first fragment)
+    {"1@0000000000000", 2, 2},                                                  // type 5 (second fragment)
+    {"B52K>;h00Fc>jpUlNV@ikwpUoP06", 0, 1},                                     // type 18
+    {"38Id705000rRVJhE7cl9n;160000", 0, 1},                                     // type 3
+    {"H42O55i18tMET00000000000000", 2, 1},                                      // type 24
+}};
+
+
+/* Part of the corpus text */
+struct TextRef
+{
+    const char  *m_pData;
+    size_t      m_uSize;
+};
+
+
+/* Benchmark input: corpus text, line boundaries and the fragments, messages and payloads decoded from it. */
+struct Corpus
+{
+    std::string                 m_strText;
+    std::vector<TextRef>        m_lines;            // one per line (without line end)
+    std::vector<TextRef>        m_sentences;        // one per line (after header and '!')
+    std::vector<NmeaFrg>        m_fragments;
+    std::vector<NmeaMsg>        m_messages;
+    std::vector<MsgPayload>     m_payloads;
+    size_t                      m_uHeaderBytes;
+    size_t                      m_uSentenceBytes;
+    size_t                      m_uPayloadBytes;
+};
+
+
+/* NMEA checksum of _str (formatted as "*XX") */
+std::string checksum(const std::string &_str)
+{
+    uint8_t crc = 0;
+    for (char c : _str) {
+        crc ^= (uint8_t)c;
+    }
+
+    char buffer[8];
+    snprintf(buffer, sizeof(buffer), "*%02X", crc);
+    return buffer;
+}
+
+
+/* Build _uLines lines of tagged sentences (rotating through the samples and 4 receiving stations). */
+Corpus makeCorpus(size_t _uLines)
+{
+    Corpus corpus;
+    corpus.m_uHeaderBytes = 0;
+    corpus.m_uSentenceBytes = 0;
+    corpus.m_uPayloadBytes = 0;
+
+    uint64_t uTimestamp = 1600000000;
+    int iMsgId = 0;
+    for (size_t i = 0; i < _uLines; i++) {
+        size_t uSample = i % SAMPLE_SENTENCES.size();
+        const SampleSentence &sample = SAMPLE_SENTENCES[uSample];
+
+        std::string strTag = "s:bench" + std::to_string(i % 4) + ",c:" + std::to_string(uTimestamp + i / 16);
+        std::string strHeader = "\\" + strTag + checksum(strTag) + "\\";
+
+        // multi-sentence sets use a rotating id (same id for all fragments of a set)
+        int iFragment = 1;
+        std::string strId;
+        if (sample.m_iFragments > 1) {
+            iFragment = (uSample > 0) && (SAMPLE_SENTENCES[uSample - 1].m_iFragments > 1) ? 2 : 1;
+            iMsgId += (iFragment == 1) ? 1 : 0;
+            strId = std::to_string(iMsgId % 10);
+        }
+
+        std::string strSentence = "AIVDM," + std::to_string(sample.m_iFragments) + "," + std::to_string(iFragment) + "," +
+                                  strId + ",A," + sample.m_pszPayload + "," + std::to_string(sample.m_iFillBits);
+        strSentence += checksum(strSentence);
+
+        corpus.m_strText += strHeader + "!" + strSentence + "\r\n";
+        corpus.m_uHeaderBytes += strHeader.size();
+        corpus.m_uSentenceBytes += strSentence.size();
+    }
+
+    // line boundaries
+    const char *pData = corpus.m_strText.data();
+    const char *pEnd = pData + corpus.m_strText.size();
+    while (pData < pEnd) {
+        const char *pLineEnd = (const char*)memchr(pData, '\n', pEnd - pData);
+        corpus.m_lines.push_back(TextRef{pData, (size_t)(pLineEnd - pData)});
+        pData = pLineEnd + 1;
+    }
+
+    // decode once (input for the later kernels)
+    MultiLineState state;
+    for (const TextRef &line : corpus.m_lines) {
+        NmeaFrg frg;
+        size_t n = readHeader(frg, line.m_pData, line.m_uSize) + 1;
+        corpus.m_sentences.push_back(TextRef{line.m_pData + n, line.m_uSize - n});
+        
+        frg.m_sentence.setSize(0);
+        readSentence(frg, line.m_pData + n, line.m_uSize - n);
+        corpus.m_fragments.push_back(frg);
+
+        NmeaMsg msg;
+        if (processSentence(msg, corpus.m_fragments.back(), state) == true) {
+            corpus.m_messages.push_back(msg);
+            corpus.m_uPayloadBytes += msg.m_payload.size();
+
+            MsgPayload payload;
+            decodeAscii(payload, msg);
+            corpus.m_payloads.push_back(payload);
+        }
+    }
+
+    return corpus;
+}
+
+
+/* Generated feed of _uMessages messages (fixed seed, default generator settings: multi-sentence and interleaved). */
+std::string makeGeneratedText(size_t _uMessages)
+{
+    GeneratorConfig config;
+    config.m_uSeed = 42;
+
+    NmeaGenerator generator(config);
+    std::string strText;
+    std::vector<char> buffer(GEN_MAX_STEP);
+    while (generator.stats().m_uMessages < _uMessages) {
+        strText.append(buffer.data(), generator.step(buffer.data()));
+    }
+
+    strText.append(buffer.data(), generator.flush(buffer.data()));
+    return strText;
+}
+
+
+/* Run times and counts of one benchmark */
+struct BenchResult
+{
+    double      m_dSeconds;
+    size_t      m_uOps;
+    size_t      m_uBytes;
+    size_t      m_uMsgs;
+};
+
+
+/* Result of one benchmark with the metric it is compared by */
+struct BenchRecord
+{
+    std::string     m_strName;
+    const char      *m_pszMetric;
+    BenchResult     m_result;
+    double          m_dTolerance;       // written to baselines (0: none, the comparison uses --tolerance)
+};
+
+
+/* Value of a metric (METRIC_NS_PER_OP or METRIC_MSGS_PER_S) */
+double metricValue(const char *_pszMetric, const BenchResult &_result)
+{
+    if (strcmp(_pszMetric, METRIC_MSGS_PER_S) == 0) {
+        return _result.m_uMsgs / _result.m_dSeconds;
+    }
+    else {
+        return _result.m_dSeconds * 1e9 / std::max(_result.m_uOps, (size_t)1);
+    }
+}
+
+
+/* Print result line (bytes and messages per second are left out if the benchmark does not count them). */
+void printResult(const char *_pszName, const BenchResult &_result)
+{
+    char bytes[32] = "-";
+    char msgs[32] = "-";
+    if (_result.m_uBytes > 0) {
+        snprintf(bytes, sizeof(bytes), "%.1f", _result.m_uBytes / _result.m_dSeconds / 1e6);
+    }
+
+    if (_result.m_uMsgs > 0) {
+        snprintf(msgs, sizeof(msgs), "%.2f", _result.m_uMsgs / _result.m_dSeconds / 1e6);
+    }
+
+    printf("%-28s %12.2f %12s %12s\n", _pszName, _result.m_dSeconds * 1e9 / _result.m_uOps, bytes, msgs);
+    fflush(stdout);
+}
+
+
+/*
+    Benchmark runner.
+    A benchmark is a function running one pass (e.g. over the whole corpus); it adds the operations, bytes and
+    messages of the pass to the result. Passes are repeated (after one warm-up pass) until _minTime has passed.
+    With _uRepeat > 1 the whole measurement is repeated and the fastest one is kept (less noise for comparisons).
+ */
+class Bench
+{
+ public:
+    using Pass = std::function<void(BenchResult &_result)>;
+
+    Bench(const std::chrono::milliseconds &_minTime, size_t _uRepeat, const std::vector<std::string> &_filters)
+        :m_minTime(_minTime),
+         m_uRepeat(std::max(_uRepeat, (size_t)1)),
+         m_filters(_filters)
+    {}
+
+    void run(const char *_pszName, const Pass &_pass, const char *_pszMetric = METRIC_NS_PER_OP, double _dTolerance = 0) {
+        if (selected(_pszName) == false) {
+            return;
+        }
+
+        BenchResult warmup = {0, 0, 0, 0};
+        _pass(warmup);
+
+        BenchResult best = {0, 0, 0, 0};
+        for (size_t r = 0; r < m_uRepeat; r++) {
+            BenchResult result = {0, 0, 0, 0};
+            auto tsStart = Clock::now();
+            auto elapsed = Clock::duration(0);
+            do {
+                _pass(result);
+                elapsed = Clock::now() - tsStart;
+            } while (elapsed < m_minTime);
+
+            result.m_dSeconds = std::chrono::duration<double>(elapsed).count();
+            if ( (best.m_uOps == 0) ||
+                 (result.m_dSeconds / result.m_uOps < best.m_dSeconds / best.m_uOps) )
+            {
+                best = result;
+            }
+        }
+
+        printResult(_pszName, best);
+        m_records.push_back(BenchRecord{_pszName, _pszMetric, best, _dTolerance});
+    }
+
+    const std::vector<BenchRecord> &records() const {
+        return m_records;
+    }
+
+ private:
+    bool selected(const char *_pszName) const {
+        if (m_filters.empty() == true) {
+            return true;
+        }
+
+        for (const auto &strFilter : m_filters) {
+            if (strstr(_pszName, strFilter.c_str()) != nullptr) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::chrono::milliseconds       m_minTime;
+    size_t                          m_uRepeat;
+    std::vector<std::string>        m_filters;
+    std::vector<BenchRecord>        m_records;
+};
+
+
+/* Expected value of a benchmark metric, with the allowed slowdown (0.25: up to 25% slower) */
+struct BaselineEntry
+{
+    std::string     m_strName;
+    std::string     m_strMetric;
+    double          m_dValue;
+    double          m_dTolerance;
+};
+
+
+/*
+    Read baseline file: one benchmark per line, "name<TAB>metric<TAB>value[<TAB>tolerance]"; empty lines and
+    lines starting with '#' are skipped. Entries without their own tolerance get _dTolerance.
+ */
+bool loadBaseline(const std::string &_strPath, double _dTolerance, std::vector<BaselineEntry> &_entries)
+{
+    FILE *pFile = fopen(_strPath.c_str(), "r");
+    if (pFile == nullptr) {
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), pFile) != nullptr) {
+        line[strcspn(line, "\r\n")] = 0;
+        if ( (line[0] == 0) || (line[0] == '#') ) {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        for (char *pField = line; pField != nullptr; ) {
+            char *pTab = strchr(pField, '\t');
+            if (pTab != nullptr) {
+                *pTab = 0;
+            }
+
+            fields.push_back(pField);
+            pField = (pTab != nullptr) ? pTab + 1 : nullptr;
+        }
+
+        if (fields.size() < 3) {
+            fprintf(stderr, "baseline '%s': invalid line '%s'\n", _strPath.c_str(), line);
+            fclose(pFile);
+            return false;
+        }
+
+        double dTolerance = (fields.size() > 3) ? atof(fields[3].c_str()) : _dTolerance;
+        _entries.push_back(BaselineEntry{fields[0], fields[1], atof(fields[2].c_str()), dTolerance});
+    }
+
+    fclose(pFile);
+    return true;
+}
+
+
+/* Write the results as a baseline file (see loadBaseline()) */
+bool writeBaseline(const std::string &_strPath, const std::vector<BenchRecord> &_records)
+{
+    FILE *pFile = fopen(_strPath.c_str(), "w");
+    if (pFile == nullptr) {
+        return false;
+    }
+
+    fprintf(pFile, "# ais_bench baseline: name<TAB>metric<TAB>value[<TAB>tolerance]\n");
+    for (const BenchRecord &record : _records) {
+        fprintf(pFile, "%s\t%s\t%.4g", record.m_strName.c_str(), record.m_pszMetric, metricValue(record.m_pszMetric, record.m_result));
+        if (record.m_dTolerance > 0) {
+            fprintf(pFile, "\t%.2g", record.m_dTolerance);
+        }
+
+        fprintf(pFile, "\n");
+    }
+
+    fclose(pFile);
+    return true;
+}
+
+
+/* Result of a benchmark compared to its baseline */
+struct Comparison
+{
+    const BaselineEntry     *m_pBaseline;       // nullptr if the benchmark has no baseline
+    double                  m_dSlowdown;        // 1.10: 10% slower than the baseline (time per op or inverse throughput)
+    bool                    m_bRegression;
+};
+
+
+/* Compare a result to the baseline entry of the same name and metric */
+Comparison compare(const BenchRecord &_record, const std::vector<BaselineEntry> &_baseline)
+{
+    Comparison comparison = {nullptr, 1.0, false};
+    for (const BaselineEntry &entry : _baseline) {
+        if ( (entry.m_strName == _record.m_strName) &&
+             (entry.m_strMetric == _record.m_pszMetric) )
+        {
+            double dValue = metricValue(_record.m_pszMetric, _record.m_result);
+            comparison.m_pBaseline = &entry;
+            comparison.m_dSlowdown = (entry.m_strMetric == METRIC_MSGS_PER_S) ? entry.m_dValue / std::max(dValue, 1e-9) :
+                                                                                 dValue / std::max(entry.m_dValue, 1e-9);
+            comparison.m_bRegression = comparison.m_dSlowdown > 1.0 + entry.m_dTolerance;
+            break;
+        }
+    }
+
+    return comparison;
+}
+
+
+/* string as JSON string literal */
+std::string jsonString(const std::string &_str)
+{
+    std::string strJson = "\"";
+    for (char c : _str) {
+        if ( (c == '"') || (c == '\\') ) {
+            strJson += '\\';
+        }
+
+        strJson += c;
+    }
+
+    return strJson + "\"";
+}
+
+
+/* JSON number (null for values that are not finite) */
+std::string jsonNumber(double _dValue)
+{
+    if (std::isfinite(_dValue) == false) {
+        return "null";
+    }
+
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.6g", _dValue);
+    return buffer;
+}
+
+
+/*
+    Write JSON report: run information and one object per benchmark with ns/op, MB/s and messages/s, and (if a
+    baseline was given) the baseline value, slowdown and status ("ok", "regression" or "new").
+ */
+bool writeReport(const std::string &_strPath, const std::string &_strLabel, size_t _uLines,
+                 const std::vector<BenchRecord> &_records, const std::vector<BaselineEntry> &_baseline)
+{
+    FILE *pFile = fopen(_strPath.c_str(), "w");
+    if (pFile == nullptr) {
+        return false;
+    }
+
+#ifdef NDEBUG
+    const char *pszBuild = "release";
+#else
+    const char *pszBuild = "debug";
+#endif
+
+    size_t uRegressions = 0;
+    fprintf(pFile, "{\n  \"label\": %s,\n  \"time\": %lld,\n  \"build\": \"%s\",\n  \"lines\": %zu,\n  \"results\": [",
+            jsonString(_strLabel).c_str(), (long long)time(nullptr), pszBuild, _uLines);
+    for (size_t i = 0; i < _records.size(); i++) {
+        const BenchRecord &record = _records[i];
+        const BenchResult &result = record.m_result;
+        Comparison comparison = compare(record, _baseline);
+        uRegressions += comparison.m_bRegression ? 1 : 0;
+
+        fprintf(pFile, "%s\n    {\"name\": %s, \"ns_per_op\": %s, \"mb_per_s\": %s, \"msgs_per_s\": %s, \"metric\": \"%s\", \"value\": %s",
+                (i > 0) ? "," : "", jsonString(record.m_strName).c_str(),
+                jsonNumber(metricValue(METRIC_NS_PER_OP, result)).c_str(),
+                jsonNumber(result.m_uBytes / result.m_dSeconds / 1e6).c_str(),
+                jsonNumber(result.m_uMsgs / result.m_dSeconds).c_str(),
+                record.m_pszMetric, jsonNumber(metricValue(record.m_pszMetric, result)).c_str());
+
+        if (comparison.m_pBaseline != nullptr) {
+            fprintf(pFile, ", \"baseline\": %s, \"tolerance\": %s, \"slowdown\": %s, \"status\": \"%s\"}",
+                    jsonNumber(comparison.m_pBaseline->m_dValue).c_str(), jsonNumber(comparison.m_pBaseline->m_dTolerance).c_str(),
+                    jsonNumber(comparison.m_dSlowdown).c_str(), comparison.m_bRegression ? "regression" : "ok");
+        }
+        else {
+            fprintf(pFile, ", \"status\": \"%s\"}", _baseline.empty() ? "unchecked" : "new");
+        }
+    }
+
+    fprintf(pFile, "\n  ],\n  \"regressions\": %zu\n}\n", uRegressions);
+    fclose(pFile);
+    return true;
+}
+
+
+/* keeps results alive (so the compiler cannot drop the benchmarked code) */
+volatile uint64_t g_uSink = 0;
+
+
+void benchKernels(Bench &_bench, const Corpus &_corpus)
+{
+    _bench.run("readHeader", [&](BenchResult &_result) {
+        NmeaFrg frg;
+        uint64_t uSum = 0;
+        for (const TextRef &line : _corpus.m_lines) {
+            uSum += readHeader(frg, line.m_pData, line.m_uSize);
+        }
+
+        g_uSink += uSum + frg.m_uTimestamp;
+        _result.m_uOps += _corpus.m_lines.size();
+        _result.m_uBytes += _corpus.m_uHeaderBytes;
+        _result.m_uMsgs += _corpus.m_lines.size();
+    });
+
+    _bench.run("readSentence", [&](BenchResult &_result) {
+        NmeaFrg frg;
+        uint64_t uSum = 0;
+        for (const TextRef &sentence : _corpus.m_sentences) {
+            frg.m_sentence.setSize(0);
+            uSum += readSentence(frg, sentence.m_pData, sentence.m_uSize);
+        }
+
+        g_uSink += uSum;
+        _result.m_uOps += _corpus.m_lines.size();
+        _result.m_uBytes += _corpus.m_uSentenceBytes;
+        _result.m_uMsgs += _corpus.m_lines.size();
+    });
+
+    _bench.run("calcCrc", [&](BenchResult &_result) {
+        uint64_t uSum = 0;
+        for (const NmeaFrg &frg : _corpus.m_fragments) {
+            uSum += calcCrc(frg.m_sentence);
+        }
+
+        g_uSink += uSum;
+        _result.m_uOps += _corpus.m_fragments.size();
+        _result.m_uBytes += _corpus.m_uSentenceBytes;
+        _result.m_uMsgs += _corpus.m_fragments.size();
+    });
+
+    _bench.run("decodeAscii", [&](BenchResult &_result) {
+        MsgPayload payload;
+        uint64_t uSum = 0;
+        for (const NmeaMsg &msg : _corpus.m_messages) {
+            uSum += decodeAscii(payload, msg);
+        }
+
+        g_uSink += uSum;
+        _result.m_uOps += _corpus.m_messages.size();
+        _result.m_uBytes += _corpus.m_uPayloadBytes;
+        _result.m_uMsgs += _corpus.m_messages.size();
+    });
+
+    // position report fields (as decoded by ais_reader; other message types use the same field widths)
+    _bench.run("getUnsignedValue", [&](BenchResult &_result) {
+        uint64_t uSum = 0;
+        for (const MsgPayload &payload : _corpus.m_payloads) {
+            size_t uBitIndex = 0;
+            uSum += getUnsignedValue(payload, uBitIndex, 6);    // type
+            uSum += getUnsignedValue(payload, uBitIndex, 2);    // repeat indicator
+            uSum += getUnsignedValue(payload, uBitIndex, 30);   // mmsi
+            uSum += getUnsignedValue(payload, uBitIndex, 4);    // navigation status
+            uSum += getUnsignedValue(payload, uBitIndex, 8);    // rate of turn
+            uSum += getUnsignedValue(payload, uBitIndex, 10);   // speed over ground
+            uSum += getUnsignedValue(payload, uBitIndex, 1);    // position accuracy
+            uSum += getUnsignedValue(payload, uBitIndex, 28);   // longitude
+            uSum += getUnsignedValue(payload, uBitIndex, 27);   // latitude
+            uSum += getUnsignedValue(payload, uBitIndex, 12);   // course over ground
+        }
+
+        g_uSink += uSum;
+        _result.m_uOps += _corpus.m_payloads.size() * 10;
+        _result.m_uMsgs += _corpus.m_payloads.size();
+    });
+
+    // 20 character vessel name of the type 5 payloads (only payloads long enough to hold it)
+    std::vector<const MsgPayload*> names;
+    for (const MsgPayload &payload : _corpus.m_payloads) {
+        if (payload.m_bitsUsed >= 112 + 120) {
+            names.push_back(&payload);
+        }
+    }
+
+    if (names.empty() == false) {
+        _bench.run("getString", [&](BenchResult &_result) {
+            uint64_t uSum = 0;
+            for (const MsgPayload *pPayload : names) {
+                size_t uBitIndex = 112;
+                uSum += getString(*pPayload, uBitIndex, 120).size();
+            }
+
+            g_uSink += uSum;
+            _result.m_uOps += names.size();
+            _result.m_uMsgs += names.size();
+        });
+    }
+
+    // heatmap stage on payload chunks (one accumulator, whole world at 4096x4096)
+    std::vector<std::unique_ptr<Payloads>> chunks;
+    for (size_t i = 0; i < _corpus.m_payloads.size(); i++) {
+        if ( (chunks.empty() == true) ||
+             (chunks.back()->size() >= chunks.back()->maxSize()) )
+        {
+            chunks.push_back(std::make_unique<Payloads>());
+        }
+
+        chunks.back()->push_back() = _corpus.m_payloads[i];
+    }
+
+    HeatmapConfig heatmapConfig;
+    heatmapConfig.m_uWorkers = 1;
+    HeatmapStage heatmap(heatmapConfig);
+    _bench.run("HeatmapStage add", [&](BenchResult &_result) {
+        for (const auto &pChunk : chunks) {
+            heatmap.add(*pChunk);
+        }
+
+        _result.m_uOps += _corpus.m_payloads.size();
+        _result.m_uMsgs += _corpus.m_payloads.size();
+    });
+
+    VesselTable vessels;
+    _bench.run("VesselTable update", [&](BenchResult &_result) {
+        for (const auto &pChunk : chunks) {
+            vessels.update(*pChunk);
+        }
+
+        _result.m_uOps += _corpus.m_payloads.size();
+        _result.m_uMsgs += _corpus.m_payloads.size();
+    });
+}
+
+
+/* push/pop pairs on one thread (uncontended) and one producer/one consumer passing BENCH_QUEUE_ITEMS items */
+template <typename Queue>
+void benchQueue(Bench &_bench, const std::string &_strName)
+{
+    _bench.run((_strName + " push/pop").c_str(), [&](BenchResult &_result) {
+        Queue queue;
+        uint64_t uValue = 0;
+        for (size_t i = 0; i < BENCH_QUEUE_ITEMS; i++) {
+            queue.push(i);
+            queue.pop(uValue);
+        }
+
+        g_uSink += uValue;
+        _result.m_uOps += BENCH_QUEUE_ITEMS;
+    });
+
+    _bench.run((_strName + " spsc").c_str(), [&](BenchResult &_result) {
+        Queue queue;
+        std::thread consumer([&queue]{
+            uint64_t uValue = 0;
+            uint64_t uSum = 0;
+            while (queue.pop(uValue) == true) {
+                uSum += uValue;
+            }
+
+            g_uSink += uSum;
+        });
+
+        for (size_t i = 0; i < BENCH_QUEUE_ITEMS; i++) {
+            queue.push(i);
+        }
+
+        queue.close();
+        consumer.join();
+        _result.m_uOps += BENCH_QUEUE_ITEMS;
+    }, METRIC_NS_PER_OP, TOLERANCE_QUEUE_THREADS);
+}
+
+
+/* get/release of chunks (pool) compared to plain operator new/delete of the same size */
+void benchPool(Bench &_bench)
+{
+    _bench.run("MemoryPool get/release", [&](BenchResult &_result) {
+        std::array<void*, BENCH_POOL_OBJECTS> objects;
+        for (size_t n = 0; n < 1000; n++) {
+            for (auto &p : objects) {
+                p = MemoryPool<Fragments>::getObjectPtr();
+            }
+
+            for (auto p : objects) {
+                MemoryPool<Fragments>::releaseObjectPtr(p);
+            }
+        }
+
+        _result.m_uOps += 1000 * objects.size();
+    });
+
+    _bench.run("malloc/free", [&](BenchResult &_result) {
+        std::array<void*, BENCH_POOL_OBJECTS> objects;
+        for (size_t n = 0; n < 1000; n++) {
+            for (auto &p : objects) {
+                p = malloc(sizeof(Fragments));
+                g_uSink += (uintptr_t)p;
+            }
+
+            for (auto p : objects) {
+                free(p);
+            }
+        }
+
+        _result.m_uOps += 1000 * objects.size();
+    });
+}
+
+
+/* whole pipeline over the corpus (from memory), with stage threads or on a task scheduler */
+void benchPipeline(Bench &_bench, const std::string &_strText, const std::string &_strCorpus, int _iFragmentThreads, int _iMessageThreads, bool _bTasks)
+{
+    std::string strName = _bTasks ? "pipeline tasks" : "pipeline " + std::to_string(_iFragmentThreads) + "x" + std::to_string(_iMessageThreads);
+    strName += _strCorpus.empty() ? "" : " " + _strCorpus;
+    std::unique_ptr<TaskScheduler> pScheduler;
+
+    _bench.run(strName.c_str(), [&](BenchResult &_result) {
+        std::atomic<size_t> uMsgs(0);
+
+        PipelineBuilder<> builder;
+        builder.fragmentThreads(_iFragmentThreads).messageThreads(_iMessageThreads);
+        if (_bTasks == true) {
+            if (pScheduler == nullptr) {
+                pScheduler = std::make_unique<TaskScheduler>();
+            }
+
+            builder.scheduler(*pScheduler);
+        }
+
+        auto pPipeline = builder.source(makeBufferSource(_strText))
+                                .sink([&uMsgs](const Payloads &_payloads){uMsgs += _payloads.size();})
+                                .build();
+        pPipeline->start();
+        pPipeline->drain();
+
+        _result.m_uOps += uMsgs;
+        _result.m_uBytes += _strText.size();
+        _result.m_uMsgs += uMsgs;
+    }, METRIC_MSGS_PER_S, TOLERANCE_PIPELINE);
+}
+
+
+/*
+    Usage: ais_bench [--lines N] [--min-time MS] [--repeat N] [--baseline PATH] [--tolerance T]
+                     [--write-baseline PATH] [--report PATH] [--label TEXT] [name filter ...]
+    Only benchmarks containing one of the filters in their name are run (all if no filter is given).
+    With --baseline every benchmark listed there is compared by its metric; the exit code is 1 if any of them is
+    more than the tolerance (default 0.25, i.e. 25%) slower. --write-baseline saves the results as a new baseline
+    (threaded benchmarks with a wider tolerance of their own), --report writes them (and the comparison) as JSON,
+    e.g. labelled with the commit id.
+ */
+int main(int argc, char* argv[])
+{
+    size_t uLines = 200000;
+    size_t uRepeat = 1;
+    double dTolerance = 0.25;
+    std::chrono::milliseconds minTime(1000);
+    std::string strBaselinePath;
+    std::string strWriteBaselinePath;
+    std::string strReportPath;
+    std::string strLabel;
+    std::vector<std::string> filters;
+    for (int i = 1; i < argc; i++) {
+        if ( (strcmp(argv[i], "--lines") == 0) && (i + 1 < argc) ) {
+            uLines = std::max(atoi(argv[++i]), 1);
+        }
+        else if ( (strcmp(argv[i], "--min-time") == 0) && (i + 1 < argc) ) {
+            minTime = std::chrono::milliseconds(std::max(atoi(argv[++i]), 1));
+        }
+        else if ( (strcmp(argv[i], "--repeat") == 0) && (i + 1 < argc) ) {
+            uRepeat = std::max(atoi(argv[++i]), 1);
+        }
+        else if ( (strcmp(argv[i], "--baseline") == 0) && (i + 1 < argc) ) {
+            strBaselinePath = argv[++i];
+        }
+        else if ( (strcmp(argv[i], "--tolerance") == 0) && (i + 1 < argc) ) {
+            dTolerance = atof(argv[++i]);
+        }
+        else if ( (strcmp(argv[i], "--write-baseline") == 0) && (i + 1 < argc) ) {
+            strWriteBaselinePath = argv[++i];
+        }
+        else if ( (strcmp(argv[i], "--report") == 0) && (i + 1 < argc) ) {
+            strReportPath = argv[++i];
+        }
+        else if ( (strcmp(argv[i], "--label") == 0) && (i + 1 < argc) ) {
+            strLabel = argv[++i];
+        }
+        else {
+            filters.push_back(argv[i]);
+        }
+    }
+
+    std::vector<BaselineEntry> baseline;
+    if ( (strBaselinePath.empty() == false) &&
+         (loadBaseline(strBaselinePath, dTolerance, baseline) == false) )
+    {
+        fprintf(stderr, "failed to read baseline '%s'\n", strBaselinePath.c_str());
+        return -1;
+    }
+
+    Corpus corpus = makeCorpus(uLines);
+    std::string strGenerated = makeGeneratedText(uLines);
+    printf("corpus: %zu lines, %zu messages, %zu bytes (generated: %zu bytes)\n\n",
+           corpus.m_lines.size(), corpus.m_messages.size(), corpus.m_strText.size(), strGenerated.size());
+    printf("%-28s %12s %12s %12s\n", "benchmark", "ns/op", "MB/s", "Mmsg/s");
+
+    Bench bench(minTime, uRepeat, filters);
+    benchKernels(bench, corpus);
+
+    benchQueue<BlockingQueue<uint64_t, 1024>>(bench, "BlockingQueue");
+    benchQueue<SpscQueue<uint64_t, 1024>>(bench, "SpscQueue");
+    benchQueue<MpmcQueue<uint64_t, 1024>>(bench, "MpmcQueue");
+    benchPool(bench);
+
+    benchPipeline(bench, corpus.m_strText, "", 1, 1, false);
+    benchPipeline(bench, corpus.m_strText, "", 2, 2, false);
+    benchPipeline(bench, corpus.m_strText, "", 1, 1, true);
+    benchPipeline(bench, strGenerated, "generated", 1, 1, false);
+
+    // baseline comparison
+    int iResult = 0;
+    if (baseline.empty() == false) {
+        size_t uCompared = 0;
+        size_t uRegressions = 0;
+        printf("\n");
+        for (const BenchRecord &record : bench.records()) {
+            Comparison comparison = compare(record, baseline);
+            if (comparison.m_pBaseline == nullptr) {
+                continue;
+            }
+
+            uCompared++;
+            if (comparison.m_bRegression == true) {
+                uRegressions++;
+                printf("REGRESSION %s: %.4g %s, baseline %.4g (%+.1f%%, tolerance %.0f%%)\n", record.m_strName.c_str(),
+                       metricValue(record.m_pszMetric, record.m_result), record.m_pszMetric, comparison.m_pBaseline->m_dValue,
+                       (comparison.m_dSlowdown - 1.0) * 100, comparison.m_pBaseline->m_dTolerance * 100);
+            }
+        }
+
+        printf("baseline: %zu compared, %zu regressions\n", uCompared, uRegressions);
+        iResult = (uRegressions > 0) ? 1 : 0;
+    }
+
+    if ( (strWriteBaselinePath.empty() == false) &&
+         (writeBaseline(strWriteBaselinePath, bench.records()) == false) )
+    {
+        fprintf(stderr, "failed to write baseline '%s'\n", strWriteBaselinePath.c_str());
+        iResult = -1;
+    }
+
+    if ( (strReportPath.empty() == false) &&
+         (writeReport(strReportPath, strLabel, uLines, bench.records(), baseline) == false) )
+    {
+        fprintf(stderr, "failed to write report '%s'\n", strReportPath.c_str());
+        iResult = -1;
+    }
+
+    return iResult;
+}
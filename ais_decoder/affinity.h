@@ -0,0 +1,147 @@
+#ifndef AIS_AFFINITY_H
+#define AIS_AFFINITY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+
+const int MAX_NUMA_NODES = 8;
+
+
+/* Parse a Linux style cpu list, e.g. "0-3,8,10-11". */
+inline std::vector<int> parseCpuList(const std::string &_str)
+{
+    std::vector<int> cpus;
+    const char *p = _str.c_str();
+    while (*p != 0) {
+        char *pEnd = nullptr;
+        long first = strtol(p, &pEnd, 10);
+        if (pEnd == p) {
+            break;
+        }
+
+        long last = first;
+        p = pEnd;
+        if (*p == '-') {
+            last = strtol(p + 1, &pEnd, 10);
+            p = pEnd;
+        }
+
+        for (long cpu = first; (cpu <= last) && (cpu >= 0); cpu++) {
+            cpus.push_back((int)cpu);
+        }
+
+        while ( (*p == ',') || (*p == ' ') || (*p == '\n') ) {
+            p++;
+        }
+    }
+
+    return cpus;
+}
+
+
+/* cpus of a NUMA node (empty if the node does not exist or topology is unknown) */
+inline std::vector<int> numaNodeCpus(int _iNode)
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    std::string path = "/sys/devices/system/node/node" + std::to_string(_iNode) + "/cpulist";
+    FILE *pFile = fopen(path.c_str(), "r");
+    if (pFile != nullptr) {
+        char buffer[1024] = {};
+        if (fgets(buffer, sizeof(buffer), pFile) != nullptr) {
+            cpus = parseCpuList(buffer);
+        }
+
+        fclose(pFile);
+    }
+#endif
+
+    return cpus;
+}
+
+
+/* Number of NUMA nodes (at least 1, at most MAX_NUMA_NODES). */
+inline int numaNodeCount()
+{
+    static const int count = []{
+        int n = 1;
+        while ( (n < MAX_NUMA_NODES) &&
+                (numaNodeCpus(n).empty() == false) )
+        {
+            n++;
+        }
+
+        return n;
+    }();
+
+    return count;
+}
+
+
+/* NUMA node of the cpu the calling thread is running on (0 if unknown). */
+inline int currentNumaNode()
+{
+#ifdef __linux__
+    static const std::vector<int> cpuNodes = []{
+        std::vector<int> nodes;
+        for (int node = 0; node < numaNodeCount(); node++) {
+            for (int cpu : numaNodeCpus(node)) {
+                if (cpu >= (int)nodes.size()) {
+                    nodes.resize(cpu + 1, 0);
+                }
+
+                nodes[cpu] = node;
+            }
+        }
+
+        return nodes;
+    }();
+
+    int cpu = sched_getcpu();
+    if ( (cpu >= 0) &&
+         (cpu < (int)cpuNodes.size()) )
+    {
+        return cpuNodes[cpu];
+    }
+#endif
+
+    return 0;
+}
+
+
+/* Pin calling thread to the given cpus (an empty list leaves it unpinned). Returns false if pinning failed. */
+inline bool setThreadAffinity(const std::vector<int> &_cpus)
+{
+    if (_cpus.empty() == true) {
+        return true;
+    }
+
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : _cpus) {
+        if ( (cpu >= 0) &&
+             (cpu < CPU_SETSIZE) )
+        {
+            CPU_SET(cpu, &cpuSet);
+        }
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+    return false;
+#endif
+}
+
+
+
+#endif // #ifndef AIS_AFFINITY_H
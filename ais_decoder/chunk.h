@@ -2,17 +2,42 @@
 #define AIS_CHUNK_H
 
 #include "mem_pool.h"
- 
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+
+
+/*
+    Raw sentence retention (compile time): with AIS_RETAIN_RAW=1 the raw NMEA text of every message is kept once per
+    chunk (see RawText) and chunk items only refer to it; the text block is shared by reference with the chunks made
+    from a chunk downstream.
+ */
+#ifndef AIS_RETAIN_RAW
+#define AIS_RETAIN_RAW 0
+#endif
+
+#if AIS_RETAIN_RAW
+struct RawText;
+#endif
+
 
 /*
     Fixed size array of decoder structures. Interface allows sequential access to data.
     Overloaded new/delelete memory operators allows for better performance optimisation.
+    Sequence number is assigned by the input stage and passed on to the chunks produced downstream.
+    Fill target (runtime, up to N) sets when the chunk counts as full.
+    With raw sentence retention the chunk also refers to its raw text block, with latency tracing it carries the
+    stage timestamps of its input chunk.
  */
 template <typename payload_type, int N>
 struct Chunk
 {
     Chunk()
-        :m_size(0)
+        :m_size(0),
+         m_uTarget(N),
+         m_uSequence(0)
     {}
 
     payload_type &back() {
@@ -33,7 +58,7 @@ struct Chunk
     }
 
     bool full() const {
-        return m_size >= N;
+        return m_size >= m_uTarget;
     }
 
     bool empty() const {
@@ -48,6 +73,14 @@ struct Chunk
         return m_data.data() + m_size;
     }
 
+    const payload_type *begin() const {
+        return m_data.data();
+    }
+
+    const payload_type *end() const {
+        return m_data.data() + m_size;
+    }
+
     size_t size() const {
         return m_size;
     }
@@ -56,6 +89,14 @@ struct Chunk
         return (size_t)N;
     }
 
+    size_t target() const {
+        return m_uTarget;
+    }
+
+    void setTarget(size_t _uTarget) {
+        m_uTarget = std::min(std::max(_uTarget, (size_t)1), (size_t)N);
+    }
+
     void *operator new(size_t) {
         return MemoryPool<Chunk>::getObjectPtr();
     }
@@ -66,6 +107,14 @@ struct Chunk
     
     std::array<payload_type, N>   m_data;
     size_t                        m_size;
+    size_t                        m_uTarget;        // fill target
+    uint64_t                      m_uSequence;      // input order
+#if AIS_RETAIN_RAW
+    std::shared_ptr<RawText>      m_pRaw;           // raw sentences of the chunk items
+#endif
+#if AIS_TRACE_LATENCY
+    ChunkTrace                    m_trace;          // stage timestamps
+#endif
 };
 
 
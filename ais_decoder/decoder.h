@@ -1,6 +1,7 @@
 #ifndef AIS_DECODER_H
 #define AIS_DECODER_H
 
+#include "chunk.h"
 #include "strutils.h"
 #include "mem_pool.h"
 
@@ -8,22 +9,98 @@
 #include <cstring>
 #include <string>
 #include <charconv>
+#include <vector>
 
 
 const size_t MAX_FRAGMENTS              = 2;
 const size_t MAX_CHARS_PER_FRAGMENT     = 82;
 const size_t MAX_CHARS_PER_MESSAGE      = MAX_FRAGMENTS * MAX_CHARS_PER_FRAGMENT;
 const size_t MAX_PAYLOAD_SIZE           = MAX_CHARS_PER_MESSAGE * 6 / 8 + 1;
+const size_t MAX_CHARS_PER_STATION      = 16;
+const size_t MAX_SEQUENCE_IDS           = 10;       // multi-sentence set ids '0'..'9'
 
 using FrgStr = String<MAX_CHARS_PER_FRAGMENT>;
 using MsgStr = String<MAX_CHARS_PER_MESSAGE>;
+using StationStr = String<MAX_CHARS_PER_STATION>;
 using PayloadArray = std::array<unsigned char, MAX_PAYLOAD_SIZE>;
 
 
+/* Reasons for dropping input (index into DropCounts) */
+const size_t DROP_MALFORMED_HEADER      = 0;    // tag block without end, or fragment count/number/set id not a digit
+const size_t DROP_BAD_TALKER            = 1;    // not a VDM/VDO sentence
+const size_t DROP_MALFORMED_SENTENCE    = 2;    // missing fields or invalid fragment numbers
+const size_t DROP_CRC                   = 3;    // checksum mismatch
+const size_t DROP_ORPHANED_FRAGMENT     = 4;    // fragment without the preceding fragments of its message
+const size_t DROP_EXPIRED_FRAGMENT      = 5;    // fragment of a partial message replaced by a new message
+const size_t DROP_OVERSIZE_PAYLOAD      = 6;    // sentence longer than MAX_CHARS_PER_FRAGMENT
+const size_t DROP_EMPTY_PAYLOAD         = 7;    // no payload bits
+const size_t DROP_REASONS               = 8;
+
+using DropCounts = std::array<uint32_t, DROP_REASONS>;
+
+
+inline const char *dropReasonName(size_t _uReason)
+{
+    static const char *names[DROP_REASONS] = {
+        "malformed_header", "bad_talker", "malformed_sentence", "crc",
+        "orphaned_fragment", "expired_fragment", "oversize_payload", "empty_payload"
+    };
+    
+    return (_uReason < DROP_REASONS) ? names[_uReason] : "unknown";
+}
+
+
+/*
+    Drop counts per source station, collected while processing one chunk (e.g. merged into stage metrics
+    once per chunk, see DropMetrics). Only touched when something is dropped.
+ */
+struct DropLog
+{
+    struct Station
+    {
+        StationStr      m_station;
+        DropCounts      m_counts;
+    };
+    
+    void add(size_t _uReason, const StationStr &_station, uint32_t _uCount = 1) {
+        for (auto &station : m_stations) {
+            if ( (station.m_station.size() == _station.size()) &&
+                 (memcmp(station.m_station.data(), _station.data(), _station.size()) == 0) )
+            {
+                station.m_counts[_uReason] += _uCount;
+                return;
+            }
+        }
+        
+        m_stations.push_back(Station{_station, DropCounts{}});
+        m_stations.back().m_counts[_uReason] += _uCount;
+    }
+    
+    bool empty() const {
+        return m_stations.empty();
+    }
+    
+    void clear() {
+        m_stations.clear();
+    }
+    
+    std::vector<Station>    m_stations;
+};
+
+
+/* Location of raw sentence text in the chunk raw text block (only with AIS_RETAIN_RAW) */
+struct RawRef
+{
+    uint32_t    m_uOffset;
+    uint32_t    m_uSize;
+};
+
+
 struct NmeaFrg
 {
     FrgStr      m_sentence;             // whole sentence (starting '$' and '!' removed)
     StringRef   m_payload;              // words[5] -- armoured ASCII payload
+    StationStr  m_station;              // source station (header "s:" field)
     uint64_t    m_uTimestamp;           // unix timestamp
     uint8_t     m_uFragmentCount;       // words[1] -- single digit integer
     uint8_t     m_uFragmentNum;         // words[2] -- single digit integer
@@ -36,8 +113,11 @@ struct NmeaFrg
 
 struct NmeaMsg
 {
-    MsgStr      m_message;              // all sentences
+#if AIS_RETAIN_RAW
+    RawRef      m_raw;                  // all sentences (in chunk raw text)
+#endif
     MsgStr      m_payload;              // armoured ASCII payload
+    uint64_t    m_uTimestamp;           // unix timestamp (from first fragment)
     uint8_t     m_uChannelId;           // channel id character value
     uint8_t     m_uFillBits;            // single digit integer
 };
@@ -45,8 +125,11 @@ struct NmeaMsg
 
 struct MsgPayload
 {
-    MsgStr          m_message;         // all sentences
+#if AIS_RETAIN_RAW
+    RawRef          m_raw;             // all sentences (in chunk raw text)
+#endif
     PayloadArray    m_payload;
+    uint64_t        m_uTimestamp;      // unix timestamp
     uint32_t        m_bitsUsed;
 };
 
@@ -69,6 +152,10 @@ struct MultiLineFragments
 };
 
 
+/* Multi-sentence reassembly state (one slot per sequential message id) */
+using MultiLineState = std::array<MultiLineFragments, MAX_SEQUENCE_IDS>;
+
+
 /* calc message CRC */
 template <int N>
 uint8_t calcCrc(const String<N> &_str)
@@ -110,23 +197,34 @@ bool checkType(const char *_pId) {
 size_t readHeader(NmeaFrg &_frg, const char *_pData, size_t _uSize) {
     // fragment init
     _frg.m_uTimestamp = 0;
+    _frg.m_station.setSize(0);
     
     // header decoding (ORBCOMM-MSA)
     const char *pBegin = _pData;
-    if (*pBegin == '\\') {
-        const char *pEnd = (const char*)memchr(pBegin+1, '\\', _uSize);
+    if ( (_uSize > 1) &&
+         (*pBegin == '\\') )
+    {
+        const char *pEnd = (const char*)memchr(pBegin+1, '\\', _uSize - 1);
         if (pEnd != nullptr) {
-            // find timestamp
-            char *pCh = const_cast<char*>(pBegin+1);
-            while (pCh < pEnd) {
-                if (strncmp(pCh, "c:", 2) == 0) {
-                    char *pTsBegin = pCh + 2;
-                    char *pTsEnd = (char*)memchr(pTsBegin, ',', pEnd - pTsBegin);                    
-                    std::from_chars(pTsBegin, pTsEnd, _frg.m_uTimestamp);
-                    break;
+            // find timestamp and source station (comma separated fields, checksum after '*')
+            const char *pField = pBegin + 1;
+            while (pField < pEnd) {
+                const char *pFieldEnd = pField;
+                while ( (pFieldEnd < pEnd) &&
+                        (*pFieldEnd != ',') &&
+                        (*pFieldEnd != '*') )
+                {
+                    ++pFieldEnd;
                 }
-
-                ++pCh;
+                
+                if (strncmp(pField, "c:", 2) == 0) {
+                    std::from_chars(pField + 2, pFieldEnd, _frg.m_uTimestamp);
+                }
+                else if (strncmp(pField, "s:", 2) == 0) {
+                    _frg.m_station.append(pField + 2, pFieldEnd - pField - 2);
+                }
+                
+                pField = pFieldEnd + 1;
             }
             
             return pEnd - pBegin + 1;
@@ -142,14 +240,26 @@ size_t readHeader(NmeaFrg &_frg, const char *_pData, size_t _uSize) {
 }
 
 
-/* Read sentence from input. Returns the number of bytes read. */
+/* Read sentence from input (one line). Returns the number of bytes read. */
 size_t readSentence(NmeaFrg &_frg, const char *_pInput, size_t _uInputSize) {
     const char *pBegin = _pInput;
     const char *pEnd = _pInput + _uInputSize;
     char *pData = (char*)pBegin;
     
-    if (checkType(pData) == true) {
+    // shortest sentence: "AIVDM,1,1,,,,0*00"
+    if ( (_uInputSize >= 17) &&
+         (checkType(pData) == true) )
+    {
          pData += 6;
+        
+        // fragment count, number and set id are single digits (see sentenceDropReason())
+        if ( (ascii_isdigit(pData[0]) == false) ||
+             (ascii_isdigit(pData[2]) == false) ||
+             ( (pData[4] != ',') && (ascii_isdigit(pData[4]) == false) ) )
+        {
+            return 0;
+        }
+        
         _frg.m_uFragmentCount = single_digit_strtoi(pData); pData += 2;
         _frg.m_uFragmentNum = single_digit_strtoi(pData); pData += 2;
         
@@ -158,6 +268,7 @@ size_t readSentence(NmeaFrg &_frg, const char *_pInput, size_t _uInputSize) {
             pData += 2;
         }
         else {
+            _frg.m_uMsgId = 0;
             pData += 1;
         }
         
@@ -171,7 +282,7 @@ size_t readSentence(NmeaFrg &_frg, const char *_pInput, size_t _uInputSize) {
         
         // find payload
         _frg.m_payload.m_uOffset = pData - pBegin;
-        pData = (char*)memchr(pData, ',', _uInputSize);
+        pData = (pData < pEnd) ? (char*)memchr(pData, ',', pEnd - pData) : nullptr;
         if (pData == nullptr) {
             return 0;
         }
@@ -180,13 +291,19 @@ size_t readSentence(NmeaFrg &_frg, const char *_pInput, size_t _uInputSize) {
         pData += 2;
         
         // find CRC
-        if (pData + 4 >= pEnd) {
+        if (pData + 3 > pEnd) {
             return 0;
         }
         
+        _frg.m_uFillBits = single_digit_strtoi(pData - 1);
         _frg.m_uMsgCrc = double_digit_hex_strtoi(pData + 1);
         pData += 3;
         
+        // sentence has to fit (oversize sentences are dropped, see sentenceDropReason())
+        if ((size_t)(pData - pBegin) > _frg.m_sentence.maxSize()) {
+            return 0;
+        }
+        
         // copy sentence
         _frg.m_sentence.append(pBegin, pData - pBegin);
         _frg.m_payload.m_pData = _frg.m_sentence.data();
@@ -196,19 +313,66 @@ size_t readSentence(NmeaFrg &_frg, const char *_pInput, size_t _uInputSize) {
 }
 
 
-/* Process one sentence/fragment and possibly produce a message. Returns true if a full message was decoded. */
-bool processMultiLineSentence(NmeaMsg &_msg, const NmeaFrg &_frg)
-{
-    static thread_local std::array<MultiLineFragments, 10>  mm;
+/*
+    Reason a complete input line was not read (readHeader()/readSentence() failed).
+    _pLine is the start of the line (including the optional header), _pSentence the start of the sentence after
+    the header and the '!'/'$' and _uSize the line size up to the line end.
+ */
+size_t sentenceDropReason(const char *_pLine, const char *_pSentence, size_t _uSize) {
+    if ( (*_pLine == '\\') &&
+         (_pSentence == _pLine) )
+    {
+        return DROP_MALFORMED_HEADER;
+    }
+    
+    size_t uSentenceSize = _uSize - (_pSentence - _pLine);
+    if ( (uSentenceSize < 5) ||
+         (checkType(_pSentence) == false) )
+    {
+        return DROP_BAD_TALKER;
+    }
+    
+    // "AIVDM,2,1,3,": fragment count, number and set id (optional) have to be single digits
+    if ( (uSentenceSize > 10) &&
+         ( (ascii_isdigit(_pSentence[6]) == false) ||
+           (ascii_isdigit(_pSentence[8]) == false) ||
+           ( (_pSentence[10] != ',') && (ascii_isdigit(_pSentence[10]) == false) ) ) )
+    {
+        return DROP_MALFORMED_HEADER;
+    }
+    
+    while ( (uSentenceSize > 0) &&
+            ( (_pSentence[uSentenceSize-1] == '\r') || (_pSentence[uSentenceSize-1] == '\n') ) )
+    {
+        uSentenceSize--;
+    }
+    
+    return (uSentenceSize > MAX_CHARS_PER_FRAGMENT) ? DROP_OVERSIZE_PAYLOAD : DROP_MALFORMED_SENTENCE;
+}
+
 
+/*
+    Process one sentence/fragment and possibly produce a message. Returns true if a full message was decoded.
+    Fragments of one message have to be passed in order and with the same reassembly state.
+ */
+bool processMultiLineSentence(NmeaMsg &_msg, const NmeaFrg &_frg, MultiLineState &_state, DropLog *_pDrops = nullptr)
+{
     if ( (_frg.m_uFragmentCount > 1) &&
-         (_frg.m_uFragmentNum < MAX_FRAGMENTS) )
+         (_frg.m_uFragmentCount <= MAX_FRAGMENTS) &&
+         (_frg.m_uFragmentNum <= _frg.m_uFragmentCount) )
     {
         // lookup message state
-        auto &msg = mm[_frg.m_uMsgId];
+        auto &msg = _state[_frg.m_uMsgId];
         
         // reset message if fragment does not fit in existing message fragments
         if (_frg.m_uFragmentNum != msg.m_index+1) {
+            if ( (_pDrops != nullptr) &&
+                 (msg.m_index > 0) &&
+                 (msg.m_index < msg.m_count) )
+            {
+                _pDrops->add(DROP_EXPIRED_FRAGMENT, msg.m_fragments[0].m_station, msg.m_index);
+            }
+            
             msg.reset();
         }
         
@@ -224,60 +388,119 @@ bool processMultiLineSentence(NmeaMsg &_msg, const NmeaFrg &_frg)
                 msg.m_fragments[msg.m_index] = _frg;
             }
             
+            // payload has to refer to the copied sentence (input chunk may be released before the message completes)
+            msg.m_fragments[msg.m_index].m_payload.m_pData = msg.m_fragments[msg.m_index].m_sentence.data();
             msg.m_index++;
         }
+        else if (_pDrops != nullptr) {
+            _pDrops->add(DROP_ORPHANED_FRAGMENT, _frg.m_station);
+        }
         
         // check for full message
         if ( (msg.m_index > 0) &&
              (msg.m_index == msg.m_count) )
         {
-            _msg.m_message = msg.m_fragments[0].m_sentence;
             _msg.m_payload = msg.m_fragments[0].m_payload;
+            _msg.m_uTimestamp = msg.m_fragments[0].m_uTimestamp;
             _msg.m_uChannelId = msg.m_fragments[0].m_uChannelId;
-            _msg.m_uFillBits = msg.m_fragments[0].m_uFillBits;
+            _msg.m_uFillBits = msg.m_fragments[msg.m_count-1].m_uFillBits;
             
-            for (size_t i = 0; i < msg.m_count; i++) {
-                _msg.m_message.append("\n");
-                _msg.m_message.append(msg.m_fragments[i].m_sentence);
+            for (size_t i = 1; i < msg.m_count; i++) {
                 _msg.m_payload.append(msg.m_fragments[i].m_payload);
             }
             
+            if (_msg.m_payload.size() == 0) {
+                if (_pDrops != nullptr) {
+                    _pDrops->add(DROP_EMPTY_PAYLOAD, _frg.m_station);
+                }
+                
+                return false;
+            }
+            
             return true;
         }
     }
+    else if (_pDrops != nullptr) {
+        _pDrops->add(DROP_MALFORMED_SENTENCE, _frg.m_station);
+    }
 
     return false;
 }
 
 
+/* Produce a message from a single sentence (CRC already checked). */
+void processSingleLineSentence(NmeaMsg &_msg, const NmeaFrg &_frg)
+{
+    _msg.m_payload = _frg.m_payload;
+    _msg.m_uTimestamp = _frg.m_uTimestamp;
+    _msg.m_uChannelId = _frg.m_uChannelId;
+    _msg.m_uFillBits = _frg.m_uFillBits;
+}
+
+
+/*
+    Check a sentence before it is used (CRC, header digits and, for single sentence messages, a non-empty payload).
+    Returns false (and logs the reason if there is a drop log) if the sentence has to be dropped.
+ */
+bool checkSentence(const NmeaFrg &_frg, DropLog *_pDrops)
+{
+    size_t uReason = DROP_REASONS;
+    if (calcCrc(_frg.m_sentence) != _frg.m_uMsgCrc) {
+        uReason = DROP_CRC;
+    }
+    else if ( (_frg.m_uFragmentCount > 9) ||
+              (_frg.m_uFragmentNum > 9) ||
+              (_frg.m_uMsgId >= MAX_SEQUENCE_IDS) )
+    {
+        uReason = DROP_MALFORMED_HEADER;       // fragments not read by readSentence()
+    }
+    else if ( (_frg.m_uFragmentCount == 1) &&
+              (_frg.m_payload.m_uSize == 0) )
+    {
+        uReason = DROP_EMPTY_PAYLOAD;
+    }
+    
+    if ( (uReason != DROP_REASONS) &&
+         (_pDrops != nullptr) )
+    {
+        _pDrops->add(uReason, _frg.m_station);
+    }
+    
+    return uReason == DROP_REASONS;
+}
+
+
 /* Process one sentence/fragment and possibly produce a message. Returns true if a full message was decoded. */
-bool processSentence(NmeaMsg &_msg, const NmeaFrg &_frg)
+bool processSentence(NmeaMsg &_msg, const NmeaFrg &_frg, MultiLineState &_state, DropLog *_pDrops = nullptr)
 {
     // check sentence CRC
-    uint8_t crc = calcCrc(_frg.m_sentence);
-    if (crc != _frg.m_uMsgCrc) {
+    if (checkSentence(_frg, _pDrops) == false) {
         return false;
     }
 
     // single line message
     if (_frg.m_uFragmentCount == 1) {
-        _msg.m_message = _frg.m_sentence;
-        _msg.m_payload = _frg.m_payload;
-        _msg.m_uChannelId = _frg.m_uChannelId;
-        _msg.m_uFillBits = _frg.m_uFillBits;
-        
+        processSingleLineSentence(_msg, _frg);
         return true;
     }
 
     // multi-line message
     else {
-        return processMultiLineSentence(_msg, _frg);
+        return processMultiLineSentence(_msg, _frg, _state, _pDrops);
     }
 
     return false;
 }
 
 
+/* Process one sentence/fragment (using per thread reassembly state) and possibly produce a message. */
+bool processSentence(NmeaMsg &_msg, const NmeaFrg &_frg)
+{
+    static thread_local MultiLineState  mm;
+    return processSentence(_msg, _frg, mm);
+}
+
+
 /* Convert payload to decimal (de-armour) and concatenate 6bit decimal values. Returns the payload bits used. */
 int decodeAscii(MsgPayload &_payload, const NmeaMsg &_msg)
 {
@@ -359,7 +582,10 @@ int decodeAscii(MsgPayload &_payload, const NmeaMsg &_msg)
     }
     *((uint64_t*)out_ptr) = bswap64(accumulator);
         
-    _payload.m_message = _msg.m_message;
+#if AIS_RETAIN_RAW
+    _payload.m_raw = _msg.m_raw;
+#endif
+    _payload.m_uTimestamp = _msg.m_uTimestamp;
     _payload.m_bitsUsed = (uint16_t)(_msg.m_payload.size() * 6 -_msg.m_uFillBits);
     
     return _payload.m_bitsUsed;
@@ -387,6 +613,14 @@ unsigned int getUnsignedValue(const MsgPayload &_payload, size_t &_uBitIndex, in
 }
 
 
+/* unpack MMSI (bits 8 to 37 for all message types) */
+unsigned int getMmsi(const MsgPayload &_payload)
+{
+    size_t uBitIndex = 8;
+    return getUnsignedValue(_payload, uBitIndex, 30);
+}
+
+
 /* unpack boolean (using 1 bit) */
 bool getBoolValue(const MsgPayload &_payload, size_t &_uBitIndex)
 {
@@ -0,0 +1,780 @@
+#ifndef AIS_GENERATOR_H
+#define AIS_GENERATOR_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+
+
+const size_t GEN_CHARS_PER_FRAGMENT     = 60;                       // armoured payload chars per sentence
+const size_t GEN_MAX_PAYLOAD_CHARS      = 2 * GEN_CHARS_PER_FRAGMENT;   // two sentence messages at most
+const size_t GEN_MAX_LINE               = 160;                      // longest generated line (tag block, sentence, line end)
+const size_t GEN_MAX_STEP               = 16 * GEN_MAX_LINE;        // most output of one generator step
+const size_t GEN_MAX_PENDING            = 9;                        // fragments held back (fewer than sequence ids)
+const size_t GEN_SEQUENCE_IDS           = 10;
+const size_t GEN_MAX_BINARY_BYTES       = 70;                       // type 8 data (still fits into two sentences)
+
+const size_t GEN_CORRUPT_CRC            = 0;                        // one payload character changed
+const size_t GEN_CORRUPT_TRUNCATED      = 1;                        // line cut off
+const size_t GEN_CORRUPT_MISSING        = 2;                        // fragment left out (multi-sentence messages only)
+
+
+/* Deterministic random numbers (xoshiro256**, seeded through splitmix64); the same sequence on every platform. */
+class GenRandom
+{
+ public:
+    explicit GenRandom(uint64_t _uSeed) {
+        for (auto &s : m_state) {
+            _uSeed += 0x9e3779b97f4a7c15ull;
+            uint64_t z = _uSeed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            s = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(m_state[1] * 5, 7) * 9;
+        uint64_t t = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = rotl(m_state[3], 45);
+        return result;
+    }
+
+    // uniform in [0, _uRange)
+    uint64_t below(uint64_t _uRange) {
+        return (uint64_t)(((unsigned __int128)next() * _uRange) >> 64);
+    }
+
+    // uniform in [_iMin, _iMax]
+    int range(int _iMin, int _iMax) {
+        return _iMin + (int)below(_iMax - _iMin + 1);
+    }
+
+    // uniform in [0, 1)
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool chance(double _dProbability) {
+        return uniform() < _dProbability;
+    }
+
+ private:
+    static uint64_t rotl(uint64_t _u, int _iBits) {
+        return (_u << _iBits) | (_u >> (64 - _iBits));
+    }
+
+    std::array<uint64_t, 4>     m_state;
+};
+
+
+/* Packs fields (most significant bit first) straight into armoured ASCII (6 bits per character). */
+class ArmouredPayload
+{
+ public:
+    ArmouredPayload()
+        :m_uSize(0),
+         m_uAcc(0),
+         m_iAccBits(0)
+    {}
+
+    void clear() {
+        m_uSize = 0;
+        m_uAcc = 0;
+        m_iAccBits = 0;
+    }
+
+    // append _iBits (at most 32) of _uValue
+    void put(uint32_t _uValue, int _iBits) {
+        uint64_t uMask = (_iBits < 32) ? ((1ull << _iBits) - 1) : 0xffffffffull;
+        m_uAcc = (m_uAcc << _iBits) | (_uValue & uMask);
+        m_iAccBits += _iBits;
+
+        while (m_iAccBits >= 6) {
+            m_iAccBits -= 6;
+            putChar((m_uAcc >> m_iAccBits) & 0x3f);
+        }
+    }
+
+    // append two's complement value
+    void putSigned(int32_t _iValue, int _iBits) {
+        put((uint32_t)_iValue, _iBits);
+    }
+
+    // append _iChars 6 bit characters (padded with '@')
+    void putString(const char *_psz, int _iChars) {
+        size_t uLength = strlen(_psz);
+        for (int i = 0; i < _iChars; i++) {
+            unsigned char ch = (i < (int)uLength) ? (unsigned char)_psz[i] : '@';
+            put((ch >= 64) ? ch - 64 : ch, 6);
+        }
+    }
+
+    // pad the last character; returns the fill bits
+    int finish() {
+        int iFillBits = 0;
+        if (m_iAccBits > 0) {
+            iFillBits = 6 - m_iAccBits;
+            put(0, iFillBits);
+        }
+
+        return iFillBits;
+    }
+
+    const char *data() const {return m_chars.data();}
+    size_t size() const {return m_uSize;}
+
+ private:
+    void putChar(unsigned int _uValue) {
+        if (m_uSize < m_chars.size()) {
+            m_chars[m_uSize++] = (char)((_uValue < 40) ? _uValue + 48 : _uValue + 56);
+        }
+    }
+
+    std::array<char, GEN_MAX_PAYLOAD_CHARS>     m_chars;
+    size_t                                      m_uSize;
+    uint64_t                                    m_uAcc;
+    int                                         m_iAccBits;
+};
+
+
+/* Generator settings (see NmeaGenerator). */
+struct GeneratorConfig
+{
+    GeneratorConfig()
+        :m_uSeed(1),
+         m_uVessels(10000),
+         m_uStations(8),
+         m_dMultiFragmentRatio(0.1),
+         m_uInterleave(4),
+         m_dCorruptRate(0.0),
+         m_dDuplicateRate(0.0),
+         m_uMessageRate(1000),
+         m_uStartTime(1600000000),
+         m_dLat(37.2),
+         m_dLon(-88.2),
+         m_dRadius(0.5)
+    {}
+
+    uint64_t    m_uSeed;
+    size_t      m_uVessels;                 // fleet size (a quarter are class B)
+    size_t      m_uStations;                // receiving stations (tag block "s:")
+    double      m_dMultiFragmentRatio;      // share of messages sent as multi-sentence messages (type 5 and 8)
+    size_t      m_uInterleave;              // max sentences between fragments of a message (0: back to back)
+    double      m_dCorruptRate;             // share of corrupted sentences (CRC, truncated, missing fragment)
+    double      m_dDuplicateRate;           // share of messages also received by a second station
+    size_t      m_uMessageRate;             // messages per second of feed time (tag block "c:")
+    uint64_t    m_uStartTime;               // unix time of the first message
+    double      m_dLat;                     // area center and radius (degrees)
+    double      m_dLon;
+    double      m_dRadius;
+};
+
+
+/* Generator counters */
+struct GeneratorStats
+{
+    uint64_t    m_uMessages;                // messages generated (without duplicates)
+    uint64_t    m_uDuplicates;              // messages sent again from another station
+    uint64_t    m_uSentences;               // lines written (including corrupted lines)
+    uint64_t    m_uCorrupted;               // sentences corrupted (missing fragments included)
+    uint64_t    m_uBytes;
+};
+
+
+/*
+    Deterministic synthetic AIS feed.
+
+    A fleet of vessels (class A and B), base stations and aids to navigation moves around an area; every step
+    picks a sender and encodes one message of a common type (1, 2, 3, 4, 5, 8, 18, 21, 24) into armoured NMEA
+    sentences with correct checksums and an ORBCOMM style tag block (receiving station and unix timestamp).
+
+    Multi-sentence messages get a sequence id that is not in use by another open message, and their later
+    fragments are held back for up to m_uInterleave sentences (so fragments of different messages interleave).
+    Optionally sentences are corrupted (changed character, truncated line, missing fragment) and messages are
+    duplicated as received by a second station.
+    The output only depends on the configuration (same seed, same bytes), and steps write straight into the
+    caller's buffer (no allocations after construction).
+ */
+class NmeaGenerator
+{
+    struct Vessel
+    {
+        uint32_t    m_uMmsi;
+        uint32_t    m_uImo;
+        double      m_dLat;
+        double      m_dLon;
+        uint64_t    m_uLastReport;      // timestamp of last position update
+        int         m_iSog;             // speed over ground (1/10 knots)
+        int         m_iCog;             // course over ground (1/10 degrees)
+        int         m_iNavStatus;
+        int         m_iShipType;
+        int         m_iBow;
+        int         m_iStern;
+        int         m_iPort;
+        int         m_iStarboard;
+        int         m_iDraught;         // 1/10 m
+        bool        m_bClassB;
+        char        m_name[21];
+        char        m_callsign[8];
+        char        m_destination[21];
+    };
+
+    struct PendingLine
+    {
+        std::array<char, GEN_MAX_LINE>  m_line;
+        size_t                          m_uSize;
+        size_t                          m_uDelay;       // sentences still to go before this one
+        int                             m_iSequenceId;
+    };
+
+ public:
+    explicit NmeaGenerator(const GeneratorConfig &_config)
+        :m_config(_config),
+         m_random(_config.m_uSeed),
+         m_uPending(0),
+         m_iNextSequenceId(0),
+         m_stats{0, 0, 0, 0, 0}
+    {
+        m_config.m_uVessels = std::max(m_config.m_uVessels, (size_t)1);
+        m_config.m_uStations = std::max(m_config.m_uStations, (size_t)1);
+        m_config.m_uMessageRate = std::max(m_config.m_uMessageRate, (size_t)1);
+
+        for (size_t i = 0; i < m_config.m_uVessels; i++) {
+            m_vessels.push_back(makeVessel(i % 4 == 3));
+        }
+
+        for (size_t i = 0; i < m_config.m_uStations; i++) {
+            m_stations.push_back("rx" + std::to_string(i + 1));
+            m_baseStations.push_back(makeVessel(false));
+            m_baseStations.back().m_uMmsi = 3000000 + mmsiCountry() * 10000 + (uint32_t)i;
+        }
+
+        for (size_t i = 0; i < std::max(m_config.m_uVessels / 100, (size_t)1); i++) {
+            m_aids.push_back(makeVessel(false));
+            m_aids.back().m_uMmsi = 990000000 + mmsiCountry() * 10000 + (uint32_t)i;
+        }
+    }
+
+    /*
+        Generate one message (plus its duplicate and any held back fragments that are due).
+        Writes at most GEN_MAX_STEP bytes to _pOut; returns the number of bytes written.
+     */
+    size_t step(char *_pOut) {
+        char *pOut = _pOut;
+        uint64_t uTimestamp = m_config.m_uStartTime + m_stats.m_uMessages / m_config.m_uMessageRate;
+        size_t uStation = m_random.below(m_stations.size());
+        char channel = m_random.chance(0.5) ? 'A' : 'B';
+
+        m_payload.clear();
+        encodeMessage(uStation, uTimestamp);
+        int iFillBits = m_payload.finish();
+        m_stats.m_uMessages++;
+
+        pOut += writeMessage(pOut, uStation, uTimestamp, channel, iFillBits, m_config.m_uInterleave);
+
+        // the same message seen by another receiver (a little later, all fragments back to back)
+        if ( (m_stations.size() > 1) &&
+             (m_random.chance(m_config.m_dDuplicateRate) == true) )
+        {
+            size_t uOther = (uStation + 1 + m_random.below(m_stations.size() - 1)) % m_stations.size();
+            pOut += writeMessage(pOut, uOther, uTimestamp + m_random.below(2), channel, iFillBits, 0);
+            m_stats.m_uDuplicates++;
+        }
+
+        m_stats.m_uBytes += pOut - _pOut;
+        return pOut - _pOut;
+    }
+
+    /* Write all held back fragments (end of output). Writes at most GEN_MAX_STEP bytes. */
+    size_t flush(char *_pOut) {
+        char *pOut = _pOut;
+        while (m_uPending > 0) {
+            pOut += releasePending(pOut, 0);
+        }
+
+        m_stats.m_uBytes += pOut - _pOut;
+        return pOut - _pOut;
+    }
+
+    const GeneratorStats &stats() const {
+        return m_stats;
+    }
+
+ private:
+    Vessel makeVessel(bool _bClassB) {
+        static const std::array<const char*, 20> WORDS = {{
+            "ATLANTIC", "PACIFIC", "NORTHERN", "OCEAN", "SEA", "RIVER", "STAR", "SPIRIT", "QUEEN", "PRINCESS",
+            "EXPRESS", "TRADER", "PIONEER", "VOYAGER", "EAGLE", "FALCON", "HARMONY", "LIBERTY", "MARINER", "NAVIGATOR"
+        }};
+
+        static const std::array<const char*, 10> PORTS = {{
+            "PADUCAH", "CAIRO IL", "ST LOUIS", "MEMPHIS", "NEW ORLEANS", "BATON ROUGE", "LOUISVILLE", "CINCINNATI",
+            "PITTSBURGH", "HOUSTON"
+        }};
+
+        static const std::array<int, 8> SHIP_TYPES = {{31, 52, 60, 70, 79, 80, 89, 37}};
+
+        Vessel v;
+        v.m_uMmsi = mmsiCountry() * 1000000 + (uint32_t)m_random.below(1000000);
+        v.m_uImo = 9000000 + (uint32_t)m_random.below(999999);
+        v.m_dLat = m_config.m_dLat + (m_random.uniform() * 2 - 1) * m_config.m_dRadius;
+        v.m_dLon = m_config.m_dLon + (m_random.uniform() * 2 - 1) * m_config.m_dRadius;
+        v.m_uLastReport = m_config.m_uStartTime;
+        v.m_iSog = m_random.chance(0.3) ? 0 : m_random.range(10, 200);
+        v.m_iCog = m_random.range(0, 3599);
+        v.m_iNavStatus = (v.m_iSog == 0) ? 5 : 0;
+        v.m_iShipType = SHIP_TYPES[m_random.below(SHIP_TYPES.size())];
+        v.m_iBow = m_random.range(10, 200);
+        v.m_iStern = m_random.range(5, 100);
+        v.m_iPort = m_random.range(3, 20);
+        v.m_iStarboard = m_random.range(3, 20);
+        v.m_iDraught = m_random.range(20, 120);
+        v.m_bClassB = _bClassB;
+
+        snprintf(v.m_name, sizeof(v.m_name), "%s %s", WORDS[m_random.below(WORDS.size())], WORDS[m_random.below(WORDS.size())]);
+        snprintf(v.m_callsign, sizeof(v.m_callsign), "W%c%c%04u", 'A' + (int)m_random.below(26), 'A' + (int)m_random.below(26), (unsigned)m_random.below(10000));
+        snprintf(v.m_destination, sizeof(v.m_destination), "%s", PORTS[m_random.below(PORTS.size())]);
+        return v;
+    }
+
+    // maritime identification digits (mostly US)
+    uint32_t mmsiCountry() {
+        static const std::array<uint32_t, 8> MIDS = {{366, 367, 368, 369, 338, 316, 235, 636}};
+        return MIDS[m_random.below(MIDS.size())];
+    }
+
+    // dead reckoning since the last report, turning back at the edge of the area
+    void move(Vessel &_vessel, uint64_t _uTimestamp) {
+        double dHours = (_uTimestamp - std::min(_vessel.m_uLastReport, _uTimestamp)) / 3600.0;
+        double dDistance = _vessel.m_iSog / 10.0 * dHours / 60.0;      // degrees (1 nm = 1 minute)
+        double dCog = _vessel.m_iCog * M_PI / 1800.0;
+
+        _vessel.m_dLat += dDistance * cos(dCog);
+        _vessel.m_dLon += dDistance * sin(dCog) / std::max(cos(_vessel.m_dLat * M_PI / 180.0), 0.1);
+        _vessel.m_uLastReport = _uTimestamp;
+
+        if ( (fabs(_vessel.m_dLat - m_config.m_dLat) > m_config.m_dRadius) ||
+             (fabs(_vessel.m_dLon - m_config.m_dLon) > m_config.m_dRadius) )
+        {
+            _vessel.m_iCog = (_vessel.m_iCog + 1800) % 3600;
+        }
+        else {
+            _vessel.m_iCog = (_vessel.m_iCog + 3600 + m_random.range(-50, 50)) % 3600;
+        }
+    }
+
+    static int32_t aisLon(double _dLon) {return (int32_t)lround(_dLon * 600000.0);}
+    static int32_t aisLat(double _dLat) {return (int32_t)lround(_dLat * 600000.0);}
+
+    // pick a sender and message type and encode the message into m_payload
+    void encodeMessage(size_t _uStation, uint64_t _uTimestamp) {
+        double dRoll = m_random.uniform();
+        if (dRoll < 0.03) {
+            encodeBaseStation(m_baseStations[_uStation], _uTimestamp);
+            return;
+        }
+        else if (dRoll < 0.04) {
+            encodeAidToNavigation(m_aids[m_random.below(m_aids.size())]);
+            return;
+        }
+
+        Vessel &vessel = m_vessels[m_random.below(m_vessels.size())];
+        if (m_random.chance(m_config.m_dMultiFragmentRatio) == true) {
+            if (vessel.m_bClassB == false) {
+                encodeStaticVoyage(vessel);
+            }
+            else {
+                encodeBinaryBroadcast(vessel);
+            }
+        }
+        else {
+            move(vessel, _uTimestamp);
+            if (vessel.m_bClassB == false) {
+                double dType = m_random.uniform();
+                encodePositionA(vessel, (dType < 0.7) ? 1 : (dType < 0.95) ? 3 : 2, _uTimestamp);
+            }
+            else if (m_random.chance(0.1) == true) {
+                encodeStaticB(vessel, (int)m_random.below(2));
+            }
+            else {
+                encodePositionB(vessel, _uTimestamp);
+            }
+        }
+    }
+
+    // type 1, 2, 3 (168 bits)
+    void encodePositionA(const Vessel &_vessel, int _iType, uint64_t _uTimestamp) {
+        m_payload.put(_iType, 6);
+        m_payload.put(0, 2);                                // repeat indicator
+        m_payload.put(_vessel.m_uMmsi, 30);
+        m_payload.put(_vessel.m_iNavStatus, 4);
+        m_payload.putSigned(m_random.range(-10, 10), 8);   // rate of turn
+        m_payload.put(_vessel.m_iSog, 10);
+        m_payload.put(1, 1);                                // position accuracy
+        m_payload.putSigned(aisLon(_vessel.m_dLon), 28);
+        m_payload.putSigned(aisLat(_vessel.m_dLat), 27);
+        m_payload.put(_vessel.m_iCog, 12);
+        m_payload.put(_vessel.m_iCog / 10, 9);              // heading
+        m_payload.put(_uTimestamp % 60, 6);
+        m_payload.put(0, 2);                                // maneuver indicator
+        m_payload.put(0, 3);                                // spare
+        m_payload.put(0, 1);                                // RAIM
+        m_payload.put((uint32_t)m_random.below(1 << 19), 19);
+    }
+
+    // type 4 (168 bits)
+    void encodeBaseStation(const Vessel &_station, uint64_t _uTimestamp) {
+        time_t t = (time_t)_uTimestamp;
+        struct tm utc;
+        gmtime_r(&t, &utc);
+
+        m_payload.put(4, 6);
+        m_payload.put(0, 2);
+        m_payload.put(_station.m_uMmsi, 30);
+        m_payload.put(utc.tm_year + 1900, 14);
+        m_payload.put(utc.tm_mon + 1, 4);
+        m_payload.put(utc.tm_mday, 5);
+        m_payload.put(utc.tm_hour, 5);
+        m_payload.put(utc.tm_min, 6);
+        m_payload.put(utc.tm_sec, 6);
+        m_payload.put(1, 1);
+        m_payload.putSigned(aisLon(_station.m_dLon), 28);
+        m_payload.putSigned(aisLat(_station.m_dLat), 27);
+        m_payload.put(7, 4);                                // EPFD (surveyed)
+        m_payload.put(0, 10);
+        m_payload.put(0, 1);
+        m_payload.put((uint32_t)m_random.below(1 << 19), 19);
+    }
+
+    // type 5 (424 bits, two sentences)
+    void encodeStaticVoyage(const Vessel &_vessel) {
+        m_payload.put(5, 6);
+        m_payload.put(0, 2);
+        m_payload.put(_vessel.m_uMmsi, 30);
+        m_payload.put(0, 2);                                // AIS version
+        m_payload.put(_vessel.m_uImo, 30);
+        m_payload.putString(_vessel.m_callsign, 7);
+        m_payload.putString(_vessel.m_name, 20);
+        m_payload.put(_vessel.m_iShipType, 8);
+        m_payload.put(_vessel.m_iBow, 9);
+        m_payload.put(_vessel.m_iStern, 9);
+        m_payload.put(_vessel.m_iPort, 6);
+        m_payload.put(_vessel.m_iStarboard, 6);
+        m_payload.put(1, 4);                                // EPFD (GPS)
+        m_payload.put(m_random.range(1, 12), 4);            // ETA
+        m_payload.put(m_random.range(1, 28), 5);
+        m_payload.put(m_random.range(0, 23), 5);
+        m_payload.put(m_random.range(0, 59), 6);
+        m_payload.put(_vessel.m_iDraught, 8);
+        m_payload.putString(_vessel.m_destination, 20);
+        m_payload.put(0, 1);                                // DTE
+        m_payload.put(0, 1);
+    }
+
+    // type 8 with opaque application data (long enough for two sentences)
+    void encodeBinaryBroadcast(const Vessel &_vessel) {
+        m_payload.put(8, 6);
+        m_payload.put(0, 2);
+        m_payload.put(_vessel.m_uMmsi, 30);
+        m_payload.put(0, 2);
+        m_payload.put(1, 10);                               // DAC (international)
+        m_payload.put(31, 6);                               // FI (meteorological and hydrographic data)
+
+        int iBytes = m_random.range(40, (int)GEN_MAX_BINARY_BYTES);
+        for (int i = 0; i < iBytes; i++) {
+            m_payload.put((uint32_t)m_random.below(256), 8);
+        }
+    }
+
+    // type 18 (168 bits)
+    void encodePositionB(const Vessel &_vessel, uint64_t _uTimestamp) {
+        m_payload.put(18, 6);
+        m_payload.put(0, 2);
+        m_payload.put(_vessel.m_uMmsi, 30);
+        m_payload.put(0, 8);
+        m_payload.put(_vessel.m_iSog, 10);
+        m_payload.put(0, 1);
+        m_payload.putSigned(aisLon(_vessel.m_dLon), 28);
+        m_payload.putSigned(aisLat(_vessel.m_dLat), 27);
+        m_payload.put(_vessel.m_iCog, 12);
+        m_payload.put(511, 9);                              // heading not available
+        m_payload.put(_uTimestamp % 60, 6);
+        m_payload.put(0, 2);
+        m_payload.put(1, 1);                                // CS unit
+        m_payload.put(0, 1);
+        m_payload.put(1, 1);                                // DSC
+        m_payload.put(1, 1);                                // band
+        m_payload.put(1, 1);                                // message 22
+        m_payload.put(0, 1);
+        m_payload.put(0, 1);
+        m_payload.put((uint32_t)m_random.below(1 << 20), 20);
+    }
+
+    // type 24 part A (160 bits) or B (168 bits)
+    void encodeStaticB(const Vessel &_vessel, int _iPart) {
+        m_payload.put(24, 6);
+        m_payload.put(0, 2);
+        m_payload.put(_vessel.m_uMmsi, 30);
+        m_payload.put(_iPart, 2);
+
+        if (_iPart == 0) {
+            m_payload.putString(_vessel.m_name, 20);
+        }
+        else {
+            m_payload.put(_vessel.m_iShipType, 8);
+            m_payload.putString("GEN", 3);                  // vendor
+            m_payload.put(1, 4);                            // unit model
+            m_payload.put(_vessel.m_uMmsi & 0xfffff, 20);   // serial number
+            m_payload.putString(_vessel.m_callsign, 7);
+            m_payload.put(std::min(_vessel.m_iBow, 511), 9);
+            m_payload.put(std::min(_vessel.m_iStern, 511), 9);
+            m_payload.put(_vessel.m_iPort, 6);
+            m_payload.put(_vessel.m_iStarboard, 6);
+            m_payload.put(0, 6);
+        }
+    }
+
+    // type 21 (272 bits)
+    void encodeAidToNavigation(const Vessel &_aid) {
+        m_payload.put(21, 6);
+        m_payload.put(0, 2);
+        m_payload.put(_aid.m_uMmsi, 30);
+        m_payload.put(m_random.range(1, 31), 5);            // aid type
+        m_payload.putString(_aid.m_name, 20);
+        m_payload.put(1, 1);
+        m_payload.putSigned(aisLon(_aid.m_dLon), 28);
+        m_payload.putSigned(aisLat(_aid.m_dLat), 27);
+        m_payload.put(2, 9);
+        m_payload.put(2, 9);
+        m_payload.put(1, 6);
+        m_payload.put(1, 6);
+        m_payload.put(7, 4);
+        m_payload.put(60, 6);                               // second (not available)
+        m_payload.put(0, 1);
+        m_payload.put(0, 8);
+        m_payload.put(0, 1);
+        m_payload.put(0, 1);                                // virtual
+        m_payload.put(0, 1);
+        m_payload.put(0, 1);
+    }
+
+    /*
+        Write the sentences of m_payload; later fragments are held back for up to _uInterleave sentences.
+        Held back fragments that became due are written first.
+     */
+    size_t writeMessage(char *_pOut, size_t _uStation, uint64_t _uTimestamp, char _channel, int _iFillBits, size_t _uInterleave) {
+        char *pOut = _pOut;
+        size_t uFragments = (m_payload.size() + GEN_CHARS_PER_FRAGMENT - 1) / GEN_CHARS_PER_FRAGMENT;
+        int iSequenceId = -1;
+        if (uFragments > 1) {
+            if (m_uPending == GEN_MAX_PENDING) {
+                pOut += releasePending(pOut, 0);
+            }
+
+            iSequenceId = nextSequenceId();
+        }
+
+        for (size_t i = 0; i < uFragments; i++) {
+            size_t uOffset = i * GEN_CHARS_PER_FRAGMENT;
+            size_t uSize = std::min(GEN_CHARS_PER_FRAGMENT, m_payload.size() - uOffset);
+            int iFillBits = (i + 1 == uFragments) ? _iFillBits : 0;
+
+            size_t uDelay = (_uInterleave > 0) ? m_random.below(_uInterleave + 1) : 0;
+            if ( (i == 0) ||
+                 (uDelay == 0) )
+            {
+                pOut += releasePending(pOut, 1);
+                pOut += writeSentence(pOut, _uStation, _uTimestamp, uFragments, i + 1, iSequenceId, _channel,
+                                      m_payload.data() + uOffset, uSize, iFillBits);
+            }
+            else {
+                // queue behind the fragments already held back (fragments of a message stay in order)
+                PendingLine &pending = m_pending[m_uPending++];
+                pending.m_uSize = writeSentence(pending.m_line.data(), _uStation, _uTimestamp, uFragments, i + 1,
+                                                iSequenceId, _channel, m_payload.data() + uOffset, uSize, iFillBits);
+                pending.m_uDelay = std::max(uDelay, (m_uPending > 1) ? m_pending[m_uPending - 2].m_uDelay : 0);
+                pending.m_iSequenceId = iSequenceId;
+            }
+        }
+
+        return pOut - _pOut;
+    }
+
+    // count _uSentences down on all held back fragments and write the ones that are due (all if _uSentences is 0)
+    size_t releasePending(char *_pOut, size_t _uSentences) {
+        char *pOut = _pOut;
+        size_t uKept = 0;
+        for (size_t i = 0; i < m_uPending; i++) {
+            PendingLine &pending = m_pending[i];
+            pending.m_uDelay -= std::min(pending.m_uDelay, _uSentences);
+            if ( (pending.m_uDelay == 0) ||
+                 (_uSentences == 0) )
+            {
+                memcpy(pOut, pending.m_line.data(), pending.m_uSize);
+                pOut += pending.m_uSize;
+
+                // writing the oldest one only (see writeMessage()) keeps the rest queued
+                if (_uSentences == 0) {
+                    for (size_t j = i + 1; j < m_uPending; j++) {
+                        m_pending[uKept++] = m_pending[j];
+                    }
+
+                    break;
+                }
+            }
+            else {
+                m_pending[uKept++] = pending;
+            }
+        }
+
+        m_uPending = uKept;
+        return pOut - _pOut;
+    }
+
+    // sequence id not used by a held back fragment
+    int nextSequenceId() {
+        for (;;) {
+            int iId = m_iNextSequenceId;
+            m_iNextSequenceId = (m_iNextSequenceId + 1) % GEN_SEQUENCE_IDS;
+
+            bool bUsed = false;
+            for (size_t i = 0; i < m_uPending; i++) {
+                bUsed |= (m_pending[i].m_iSequenceId == iId);
+            }
+
+            if (bUsed == false) {
+                return iId;
+            }
+        }
+    }
+
+    // one line (tag block and sentence), possibly corrupted; returns the bytes written (0 if left out)
+    size_t writeSentence(char *_pOut, size_t _uStation, uint64_t _uTimestamp, size_t _uCount, size_t _uNum,
+                         int _iSequenceId, char _channel, const char *_pPayload, size_t _uSize, int _iFillBits)
+    {
+        size_t uCorruption = GEN_CORRUPT_MISSING + 1;
+        if (m_random.chance(m_config.m_dCorruptRate) == true) {
+            uCorruption = m_random.below((_uCount > 1) ? GEN_CORRUPT_MISSING + 1 : GEN_CORRUPT_MISSING);
+            m_stats.m_uCorrupted++;
+        }
+
+        if (uCorruption == GEN_CORRUPT_MISSING) {
+            return 0;
+        }
+
+        // tag block
+        char *p = _pOut;
+        *p++ = '\\';
+        char *pTag = p;
+        p = appendText(p, "s:");
+        p = appendText(p, m_stations[_uStation].c_str());
+        p = appendText(p, ",c:");
+        p = appendNumber(p, _uTimestamp);
+        p = appendChecksum(p, pTag);
+        *p++ = '\\';
+
+        // sentence
+        *p++ = '!';
+        char *pSentence = p;
+        p = appendText(p, "AIVDM,");
+        *p++ = (char)('0' + _uCount);
+        *p++ = ',';
+        *p++ = (char)('0' + _uNum);
+        *p++ = ',';
+        if (_iSequenceId >= 0) {
+            *p++ = (char)('0' + _iSequenceId);
+        }
+
+        *p++ = ',';
+        *p++ = _channel;
+        *p++ = ',';
+        char *pPayload = p;
+        memcpy(p, _pPayload, _uSize);
+        p += _uSize;
+        *p++ = ',';
+        *p++ = (char)('0' + _iFillBits);
+
+        p = appendChecksum(p, pSentence);
+
+        // corrupted after the checksum was calculated
+        if ( (uCorruption == GEN_CORRUPT_CRC) &&
+             (_uSize > 0) )
+        {
+            char &ch = pPayload[m_random.below(_uSize)];
+            ch = (ch == '0') ? '1' : '0';
+        }
+        else if (uCorruption == GEN_CORRUPT_TRUNCATED) {
+            p = pSentence + m_random.below(p - pSentence);
+        }
+
+        *p++ = '\r';
+        *p++ = '\n';
+
+        m_stats.m_uSentences++;
+        return p - _pOut;
+    }
+
+    static char *appendText(char *_p, const char *_psz) {
+        size_t uLength = strlen(_psz);
+        memcpy(_p, _psz, uLength);
+        return _p + uLength;
+    }
+
+    static char *appendNumber(char *_p, uint64_t _uValue) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + _uValue % 10);
+            _uValue /= 10;
+        } while (_uValue > 0);
+
+        while (n > 0) {
+            *_p++ = digits[--n];
+        }
+
+        return _p;
+    }
+
+    // "*XX" checksum of the text from _pBegin up to _p
+    static char *appendChecksum(char *_p, const char *_pBegin) {
+        static const char HEX[] = "0123456789ABCDEF";
+        uint8_t uCrc = 0;
+        for (const char *pc = _pBegin; pc < _p; pc++) {
+            uCrc ^= (uint8_t)*pc;
+        }
+
+        *_p++ = '*';
+        *_p++ = HEX[uCrc >> 4];
+        *_p++ = HEX[uCrc & 0xf];
+        return _p;
+    }
+
+    GeneratorConfig                             m_config;
+    GenRandom                                   m_random;
+    std::vector<Vessel>                         m_vessels;
+    std::vector<Vessel>                         m_baseStations;     // one per receiving station
+    std::vector<Vessel>                         m_aids;
+    std::vector<std::string>                    m_stations;
+    ArmouredPayload                             m_payload;
+    std::array<PendingLine, GEN_MAX_PENDING>    m_pending;          // in output order
+    size_t                                      m_uPending;
+    int                                         m_iNextSequenceId;
+    GeneratorStats                              m_stats;
+};
+
+
+
+#endif // #ifndef AIS_GENERATOR_H
@@ -0,0 +1,530 @@
+#ifndef AIS_HEATMAP_H
+#define AIS_HEATMAP_H
+
+#include "processing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+
+const size_t HEATMAP_TILE_SIZE          = 256;      // tile edge (pixels)
+const size_t HEATMAP_CUBE_TILE_SIZE     = 8;        // tile edge of time binned heatmaps (few positions per bin and tile)
+
+/* Projections */
+const size_t HEATMAP_EQUIRECTANGULAR    = 0;        // lon/lat linear
+const size_t HEATMAP_WEB_MERCATOR       = 1;        // lat as mercator y (bbox latitudes within +-85.05)
+
+
+/* Raster size, area and projection of a heatmap (default: whole world, 4096x4096, equirectangular) */
+struct HeatmapConfig
+{
+    HeatmapConfig()
+        :m_uWidth(4096),
+         m_uHeight(4096),
+         m_dMinLon(-180.0),
+         m_dMinLat(-90.0),
+         m_dMaxLon(180.0),
+         m_dMaxLat(90.0),
+         m_uProjection(HEATMAP_EQUIRECTANGULAR),
+         m_uWorkers(0),
+         m_uBinSeconds(0)
+    {}
+
+    size_t      m_uWidth;
+    size_t      m_uHeight;
+    double      m_dMinLon;                  // bbox (degrees; min lat is the bottom row)
+    double      m_dMinLat;
+    double      m_dMaxLon;
+    double      m_dMaxLat;
+    size_t      m_uProjection;
+    size_t      m_uWorkers;                 // accumulators (0: one per hardware thread)
+    uint64_t    m_uBinSeconds;              // time bin length (by tag block timestamp; 0: one heatmap for all)
+};
+
+
+/* Maps positions to pixels (row 0 at the top, i.e. at max latitude) */
+class HeatmapProjection
+{
+ public:
+    explicit HeatmapProjection(const HeatmapConfig &_config)
+        :m_uWidth(_config.m_uWidth),
+         m_uHeight(_config.m_uHeight),
+         m_uProjection(_config.m_uProjection),
+         m_dMinLon(_config.m_dMinLon),
+         m_dTop(y(_config.m_dMaxLat))
+    {
+        m_dScaleX = _config.m_uWidth / (_config.m_dMaxLon - _config.m_dMinLon);
+        m_dScaleY = _config.m_uHeight / (m_dTop - y(_config.m_dMinLat));
+    }
+
+    // pixel of a position (degrees); false if outside the bbox
+    bool pixel(double _dLon, double _dLat, size_t &_uX, size_t &_uY) const {
+        double dX = (_dLon - m_dMinLon) * m_dScaleX;
+        double dY = (m_dTop - y(_dLat)) * m_dScaleY;
+        if ( (dX >= 0) && (dX < m_uWidth) &&
+             (dY >= 0) && (dY < m_uHeight) )
+        {
+            _uX = (size_t)dX;
+            _uY = (size_t)dY;
+            return true;
+        }
+
+        return false;
+    }
+
+ private:
+    double y(double _dLat) const {
+        if (m_uProjection == HEATMAP_WEB_MERCATOR) {
+            return std::log(std::tan(M_PI / 4 + _dLat * M_PI / 360));
+        }
+        else {
+            return _dLat;
+        }
+    }
+
+    size_t      m_uWidth;
+    size_t      m_uHeight;
+    size_t      m_uProjection;
+    double      m_dMinLon;
+    double      m_dTop;                     // projected max latitude
+    double      m_dScaleX;                  // pixels per degree / per projected unit
+    double      m_dScaleY;
+};
+
+
+/*
+    Position count raster, stored as tiles of HEATMAP_TILE_SIZE^2 32-bit counts. Tiles are only allocated once
+    a position falls into them, so sparse traffic (coasts, shipping lanes) takes little memory.
+ */
+class HeatmapGrid
+{
+ public:
+    HeatmapGrid(size_t _uWidth, size_t _uHeight)
+        :m_uWidth(_uWidth),
+         m_uHeight(_uHeight),
+         m_uTilesX((_uWidth + HEATMAP_TILE_SIZE - 1) / HEATMAP_TILE_SIZE),
+         m_uTilesY((_uHeight + HEATMAP_TILE_SIZE - 1) / HEATMAP_TILE_SIZE),
+         m_tiles(m_uTilesX * m_uTilesY)
+    {}
+
+    HeatmapGrid(HeatmapGrid &&) = default;
+    HeatmapGrid &operator=(HeatmapGrid &&) = default;
+
+    void add(size_t _uX, size_t _uY, uint32_t _uCount = 1) {
+        uint32_t *pTile = tile((_uY / HEATMAP_TILE_SIZE) * m_uTilesX + _uX / HEATMAP_TILE_SIZE, true);
+        pTile[(_uY % HEATMAP_TILE_SIZE) * HEATMAP_TILE_SIZE + _uX % HEATMAP_TILE_SIZE] += _uCount;
+    }
+
+    uint32_t count(size_t _uX, size_t _uY) const {
+        const uint32_t *pTile = m_tiles[(_uY / HEATMAP_TILE_SIZE) * m_uTilesX + _uX / HEATMAP_TILE_SIZE].get();
+        return (pTile != nullptr) ? pTile[(_uY % HEATMAP_TILE_SIZE) * HEATMAP_TILE_SIZE + _uX % HEATMAP_TILE_SIZE] : 0;
+    }
+
+    // add all counts of _other (same size)
+    void merge(const HeatmapGrid &_other) {
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            const uint32_t *pOther = _other.m_tiles[i].get();
+            if (pOther != nullptr) {
+                uint32_t *pTile = tile(i, true);
+                for (size_t j = 0; j < HEATMAP_TILE_SIZE * HEATMAP_TILE_SIZE; j++) {
+                    pTile[j] += pOther[j];
+                }
+            }
+        }
+    }
+
+    uint32_t maxCount() const {
+        uint32_t uMax = 0;
+        for (const auto &pTile : m_tiles) {
+            if (pTile != nullptr) {
+                uMax = std::max(uMax, *std::max_element(pTile.get(), pTile.get() + HEATMAP_TILE_SIZE * HEATMAP_TILE_SIZE));
+            }
+        }
+
+        return uMax;
+    }
+
+    /*
+        Whole raster as 16-bit image (row by row), counts scaled linearly so that _uMaxCount is 65535 (the max
+        count of the grid if 0; e.g. the max of all frames of an animation, so that they share one scale).
+     */
+    void image16(std::vector<uint16_t> &_image, uint32_t _uMaxCount = 0) const {
+        _image.assign(m_uWidth * m_uHeight, 0);
+        double dScale = 65535.0 / std::max((_uMaxCount > 0) ? _uMaxCount : maxCount(), (uint32_t)1);
+        for (size_t uTileY = 0; uTileY < m_uTilesY; uTileY++) {
+            for (size_t uTileX = 0; uTileX < m_uTilesX; uTileX++) {
+                const uint32_t *pTile = m_tiles[uTileY * m_uTilesX + uTileX].get();
+                if (pTile == nullptr) {
+                    continue;
+                }
+
+                size_t uRows = std::min(HEATMAP_TILE_SIZE, m_uHeight - uTileY * HEATMAP_TILE_SIZE);
+                size_t uCols = std::min(HEATMAP_TILE_SIZE, m_uWidth - uTileX * HEATMAP_TILE_SIZE);
+                for (size_t y = 0; y < uRows; y++) {
+                    uint16_t *pOut = _image.data() + (uTileY * HEATMAP_TILE_SIZE + y) * m_uWidth + uTileX * HEATMAP_TILE_SIZE;
+                    for (size_t x = 0; x < uCols; x++) {
+                        pOut[x] = (uint16_t)std::min(pTile[y * HEATMAP_TILE_SIZE + x] * dScale + 0.5, 65535.0);
+                    }
+                }
+            }
+        }
+    }
+
+    // tile by index (row major, m_uTilesX per row); nullptr if nothing was counted in it (unless _bCreate is set)
+    uint32_t *tile(size_t _uTile, bool _bCreate) {
+        if ( (m_tiles[_uTile] == nullptr) &&
+             (_bCreate == true) )
+        {
+            m_tiles[_uTile].reset(new uint32_t[HEATMAP_TILE_SIZE * HEATMAP_TILE_SIZE]());
+        }
+
+        return m_tiles[_uTile].get();
+    }
+
+    const uint32_t *tile(size_t _uTile) const {
+        return m_tiles[_uTile].get();
+    }
+
+    size_t width() const {return m_uWidth;}
+    size_t height() const {return m_uHeight;}
+    size_t tilesX() const {return m_uTilesX;}
+    size_t tilesY() const {return m_uTilesY;}
+
+ private:
+    size_t                                      m_uWidth;
+    size_t                                      m_uHeight;
+    size_t                                      m_uTilesX;
+    size_t                                      m_uTilesY;
+    std::vector<std::unique_ptr<uint32_t[]>>    m_tiles;
+};
+
+
+/*
+    Position count raster per time bin (e.g. per hour), for animations and trends. Only tiles that have counts in
+    a bin exist (HEATMAP_CUBE_TILE_SIZE^2 32-bit counts, hashed by bin and tile), so memory scales with the cells
+    occupied per bin rather than with bins times raster size. forEachFrame() makes the rasters of all bins in one
+    pass over the tiles, frame() the raster of a single bin.
+ */
+class HeatmapCube
+{
+ public:
+    HeatmapCube(size_t _uWidth, size_t _uHeight, uint64_t _uBinSeconds)
+        :m_uWidth(_uWidth),
+         m_uHeight(_uHeight),
+         m_uTilesX((_uWidth + HEATMAP_CUBE_TILE_SIZE - 1) / HEATMAP_CUBE_TILE_SIZE),
+         m_uBinSeconds(std::max(_uBinSeconds, (uint64_t)1)),
+         m_uLastKey(UINT64_MAX),
+         m_pLastTile(nullptr)
+    {}
+
+    HeatmapCube(HeatmapCube &&) = default;
+    HeatmapCube &operator=(HeatmapCube &&) = default;
+
+    // count a position at unix time _uTimestamp
+    void add(uint64_t _uTimestamp, size_t _uX, size_t _uY, uint32_t _uCount = 1) {
+        uint64_t uKey = key(_uTimestamp / m_uBinSeconds, (_uY / HEATMAP_CUBE_TILE_SIZE) * m_uTilesX + _uX / HEATMAP_CUBE_TILE_SIZE);
+        uint32_t *pTile = tile(uKey);
+        pTile[(_uY % HEATMAP_CUBE_TILE_SIZE) * HEATMAP_CUBE_TILE_SIZE + _uX % HEATMAP_CUBE_TILE_SIZE] += _uCount;
+    }
+
+    // add all counts of _other (same size and bin length)
+    void merge(const HeatmapCube &_other) {
+        for (const auto &entry : _other.m_tiles) {
+            uint32_t *pTile = tile(entry.first);
+            for (size_t j = 0; j < HEATMAP_CUBE_TILE_SIZE * HEATMAP_CUBE_TILE_SIZE; j++) {
+                pTile[j] += entry.second[j];
+            }
+        }
+    }
+
+    // start times of the bins with counts (sorted)
+    std::vector<uint64_t> bins() const {
+        std::vector<uint64_t> bins;
+        for (const auto &entry : m_tiles) {
+            bins.push_back((entry.first >> 32) * m_uBinSeconds);
+        }
+
+        std::sort(bins.begin(), bins.end());
+        bins.erase(std::unique(bins.begin(), bins.end()), bins.end());
+        return bins;
+    }
+
+    // raster of the bin starting at _uBinStart (scans all tiles, see forEachFrame() for all bins)
+    HeatmapGrid frame(uint64_t _uBinStart) const {
+        HeatmapGrid grid(m_uWidth, m_uHeight);
+        for (const auto &entry : m_tiles) {
+            if ((entry.first >> 32) == _uBinStart / m_uBinSeconds) {
+                addTile(grid, entry.first, entry.second.get());
+            }
+        }
+
+        return grid;
+    }
+
+    /*
+        Call _func(binStart, grid) for every bin with counts, in time order. Tiles are sorted by key once (the
+        bin is in the upper bits), so every tile is visited once however many bins there are.
+     */
+    template <typename F>
+    void forEachFrame(F _func) const {
+        std::vector<std::pair<uint64_t, const uint32_t*>> tiles;
+        tiles.reserve(m_tiles.size());
+        for (const auto &entry : m_tiles) {
+            tiles.emplace_back(entry.first, entry.second.get());
+        }
+
+        std::sort(tiles.begin(), tiles.end());
+
+        for (size_t i = 0; i < tiles.size(); ) {
+            uint64_t uBin = tiles[i].first >> 32;
+            HeatmapGrid grid(m_uWidth, m_uHeight);
+            for ( ; (i < tiles.size()) && ((tiles[i].first >> 32) == uBin); i++) {
+                addTile(grid, tiles[i].first, tiles[i].second);
+            }
+
+            _func(uBin * m_uBinSeconds, grid);
+        }
+    }
+
+    // raster of all bins
+    HeatmapGrid total() const {
+        HeatmapGrid grid(m_uWidth, m_uHeight);
+        for (const auto &entry : m_tiles) {
+            addTile(grid, entry.first, entry.second.get());
+        }
+
+        return grid;
+    }
+
+    // max count of any cell in any bin
+    uint32_t maxCount() const {
+        uint32_t uMax = 0;
+        for (const auto &entry : m_tiles) {
+            uMax = std::max(uMax, *std::max_element(entry.second.get(), entry.second.get() + HEATMAP_CUBE_TILE_SIZE * HEATMAP_CUBE_TILE_SIZE));
+        }
+
+        return uMax;
+    }
+
+    size_t tiles() const {return m_tiles.size();}
+    uint64_t binSeconds() const {return m_uBinSeconds;}
+
+ private:
+    static uint64_t key(uint64_t _uBin, uint64_t _uTile) {
+        return (_uBin << 32) | _uTile;
+    }
+
+    // tile by key (created if missing); consecutive positions often fall into the same tile
+    uint32_t *tile(uint64_t _uKey) {
+        if (_uKey != m_uLastKey) {
+            auto &pTile = m_tiles[_uKey];
+            if (pTile == nullptr) {
+                pTile.reset(new uint32_t[HEATMAP_CUBE_TILE_SIZE * HEATMAP_CUBE_TILE_SIZE]());
+            }
+
+            m_uLastKey = _uKey;
+            m_pLastTile = pTile.get();
+        }
+
+        return m_pLastTile;
+    }
+
+    void addTile(HeatmapGrid &_grid, uint64_t _uKey, const uint32_t *_pTile) const {
+        size_t uTile = (size_t)(_uKey & 0xffffffff);
+        size_t uX0 = (uTile % m_uTilesX) * HEATMAP_CUBE_TILE_SIZE;
+        size_t uY0 = (uTile / m_uTilesX) * HEATMAP_CUBE_TILE_SIZE;
+        for (size_t y = 0; y < HEATMAP_CUBE_TILE_SIZE; y++) {
+            for (size_t x = 0; x < HEATMAP_CUBE_TILE_SIZE; x++) {
+                uint32_t uCount = _pTile[y * HEATMAP_CUBE_TILE_SIZE + x];
+                if (uCount > 0) {
+                    _grid.add(uX0 + x, uY0 + y, uCount);
+                }
+            }
+        }
+    }
+
+    size_t                                                      m_uWidth;
+    size_t                                                      m_uHeight;
+    size_t                                                      m_uTilesX;
+    uint64_t                                                    m_uBinSeconds;
+    std::unordered_map<uint64_t, std::unique_ptr<uint32_t[]>>   m_tiles;        // by bin (upper 32 bits) and tile
+    uint64_t                                                    m_uLastKey;
+    uint32_t                                                    *m_pLastTile;
+};
+
+
+/* Position (degrees) of a position report (types 1, 2, 3, 18 and 19); false for other types or short payloads */
+inline bool getPosition(const MsgPayload &_payload, double &_dLon, double &_dLat)
+{
+    size_t uBitIndex = 0;
+    unsigned int uType = getUnsignedValue(_payload, uBitIndex, 6);
+    if ( (uType >= 1) && (uType <= 3) ) {
+        uBitIndex = 61;
+    }
+    else if ( (uType == 18) || (uType == 19) ) {
+        uBitIndex = 57;
+    }
+    else {
+        return false;
+    }
+
+    if (_payload.m_bitsUsed < uBitIndex + 55) {
+        return false;
+    }
+
+    _dLon = getSignedValue(_payload, uBitIndex, 28) / 600000.0;
+    _dLat = getSignedValue(_payload, uBitIndex, 27) / 600000.0;
+    return true;
+}
+
+
+/*
+    Position density heatmap, filled as a payload stage (in parallel on the pipeline workers), e.g.
+        HeatmapStage heatmap(config);
+        builder.stage([&heatmap](Payloads &_payloads){heatmap.add(_payloads);});
+
+    With HeatmapConfig::m_uBinSeconds positions are counted per time bin (by their tag block timestamp) into
+    sparse cubes (see HeatmapCube, mergedCube()), so all frames come from one pass over the data. Positions
+    without a timestamp (no tag block) belong to no bin: they are only counted in merged() and untimed().
+
+    Every chunk is counted into one of m_uWorkers accumulators (tiled grids of their own), picked per thread and
+    locked for the chunk, so workers normally never share one. merged() sums the accumulators, at the end or at
+    any time while running (accumulators are locked one at a time); counts are exact, so the result is the same
+    as counting serially.
+    Positions outside the bbox and 'not available' positions (181/91 degrees) are not counted.
+ */
+class HeatmapStage
+{
+ public:
+    explicit HeatmapStage(const HeatmapConfig &_config = HeatmapConfig())
+        :m_config(_config),
+         m_projection(_config),
+         m_uPositions(0),
+         m_uUntimed(0)
+    {
+        size_t uWorkers = (_config.m_uWorkers > 0) ? _config.m_uWorkers : std::max(std::thread::hardware_concurrency(), 1u);
+        for (size_t i = 0; i < uWorkers; i++) {
+            m_accumulators.push_back(std::make_unique<Accumulator>(_config));
+        }
+    }
+
+    HeatmapStage(const HeatmapStage &) = delete;
+    HeatmapStage &operator=(const HeatmapStage &) = delete;
+
+    // count positions of a chunk (thread safe)
+    void add(const Payloads &_payloads) {
+        Accumulator &accumulator = lockAccumulator();
+        uint64_t uPositions = 0;
+        uint64_t uUntimed = 0;
+        for (const MsgPayload &payload : _payloads) {
+            double dLon, dLat;
+            size_t uX, uY;
+            if ( (getPosition(payload, dLon, dLat) == true) &&
+                 (m_projection.pixel(dLon, dLat, uX, uY) == true) )
+            {
+                if ( (m_config.m_uBinSeconds > 0) && (payload.m_uTimestamp > 0) ) {
+                    accumulator.m_cube.add(payload.m_uTimestamp, uX, uY);
+                }
+                else {
+                    // without time bins, or no timestamp to bin by
+                    accumulator.m_grid.add(uX, uY);
+                    uUntimed++;
+                }
+
+                uPositions++;
+            }
+        }
+
+        accumulator.m_mutex.unlock();
+        m_uPositions.fetch_add(uPositions, std::memory_order_relaxed);
+        if (m_config.m_uBinSeconds > 0) {
+            m_uUntimed.fetch_add(uUntimed, std::memory_order_relaxed);
+        }
+    }
+
+    // sum of all accumulators (all time bins and positions without timestamp)
+    HeatmapGrid merged() const {
+        HeatmapGrid grid = (m_config.m_uBinSeconds > 0) ? mergedCube().total() : HeatmapGrid(m_config.m_uWidth, m_config.m_uHeight);
+        for (const auto &pAccumulator : m_accumulators) {
+            std::lock_guard<std::mutex> lock(pAccumulator->m_mutex);
+            grid.merge(pAccumulator->m_grid);
+        }
+
+        return grid;
+    }
+
+    // sum of all accumulators per time bin (empty without m_uBinSeconds)
+    HeatmapCube mergedCube() const {
+        HeatmapCube cube(m_config.m_uWidth, m_config.m_uHeight, m_config.m_uBinSeconds);
+        for (const auto &pAccumulator : m_accumulators) {
+            std::lock_guard<std::mutex> lock(pAccumulator->m_mutex);
+            cube.merge(pAccumulator->m_cube);
+        }
+
+        return cube;
+    }
+
+    // positions counted so far
+    uint64_t positions() const {
+        return m_uPositions.load(std::memory_order_relaxed);
+    }
+
+    // positions without timestamp, not in any time bin (0 without m_uBinSeconds)
+    uint64_t untimed() const {
+        return m_uUntimed.load(std::memory_order_relaxed);
+    }
+
+    const HeatmapConfig &config() const {
+        return m_config;
+    }
+
+ private:
+    struct alignas(64) Accumulator
+    {
+        explicit Accumulator(const HeatmapConfig &_config)
+            :m_grid(_config.m_uWidth, _config.m_uHeight),
+             m_cube(_config.m_uWidth, _config.m_uHeight, _config.m_uBinSeconds)
+        {}
+
+        std::mutex      m_mutex;
+        HeatmapGrid     m_grid;             // without time bins or timestamp
+        HeatmapCube     m_cube;             // with time bins
+    };
+
+    // lock an accumulator, starting with the one of the calling thread (threads get them round robin)
+    Accumulator &lockAccumulator() {
+        static std::atomic<size_t> uNext(0);
+        static thread_local size_t uSlot = uNext++;
+
+        for (size_t i = 0; i < m_accumulators.size(); i++) {
+            Accumulator &accumulator = *m_accumulators[(uSlot + i) % m_accumulators.size()];
+            if (accumulator.m_mutex.try_lock() == true) {
+                return accumulator;
+            }
+        }
+
+        Accumulator &accumulator = *m_accumulators[uSlot % m_accumulators.size()];
+        accumulator.m_mutex.lock();
+        return accumulator;
+    }
+
+    HeatmapConfig                               m_config;
+    HeatmapProjection                           m_projection;
+    std::vector<std::unique_ptr<Accumulator>>   m_accumulators;
+    std::atomic<uint64_t>                       m_uPositions;
+    std::atomic<uint64_t>                       m_uUntimed;
+};
+
+
+
+#endif // #ifndef AIS_HEATMAP_H
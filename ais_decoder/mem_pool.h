@@ -3,62 +3,415 @@
 
 
 
+#include "affinity.h"
+#include "queue.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
-#include <mutex>
-#include <vector>
+#include <string>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+
+
+const size_t POOL_ALIGNMENT = 64;           // objects start on a cache line
+const size_t POOL_MAGAZINE_SIZE = 32;       // objects moved between thread cache and global stack at a time
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+
+/* Pool counters */
+struct PoolStats
+{
+    size_t      m_uObjectSize;      // bytes per object (including header)
+    size_t      m_uAllocated;       // objects allocated from the system (or arena), overflow objects while in use
+    size_t      m_uInUse;           // objects handed out and not returned yet
+    size_t      m_uHighWater;       // max objects in use
+    size_t      m_uBudget;          // arena size in objects (0 if unbounded)
+    size_t      m_uOverflow;        // objects allocated past the budget (only with allowOverflow())
+    bool        m_bHugePages;       // arena is backed by (explicit or transparent) huge pages
+};
 
 
+/*
+    Stack like pool of memory for a single type.
 
-/* Stack like pool of memory for a single type. */
+    Every thread keeps a small cache (magazine) of free objects, so most allocations and frees touch no shared state.
+    Full magazines are handed to a lock-free global stack as a chain of MAGAZINE_SIZE objects (one CAS), and empty
+    magazines refill from it in the same way.
+
+    Free objects are kept per NUMA node: objects go back to the node they were allocated on, and allocations are
+    served from the node of the calling thread (new objects are first touched there, so pages are node local).
+    A thread cache only holds objects of its own node; objects of other nodes go straight to their global stack.
+
+    By default the pool grows without bound (malloc on demand, nothing is freed until exit).
+    reserve() switches to a bounded arena: all objects are preallocated up front (optionally on 2MB huge pages) and
+    allocations block until an object is returned once the arena is used up (back-pressure on producers).
+    In bounded mode frees bypass the thread caches, so blocked producers see every returned object.
+    Users that hold objects while allocating more (e.g. chunks in a reorder buffer) have to bound what they hold
+    below the budget themselves (see BasicPipeline, which limits input chunks in flight to it).
+    With allowOverflow() a producer blocked for the given time allocates past the budget instead (counted as
+    overflow); overflow objects go back to the system when released, so memory returns to the budget.
+ */
 template <typename obj_type>
 class MemoryPool
 {
+ protected:
+    static const size_t     HEADER_SIZE = POOL_ALIGNMENT;      // holds the owner node and arena flag, in front of each object
+    static const size_t     BLOCK_SIZE = (HEADER_SIZE + sizeof(obj_type) + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+    static const uint64_t   PTR_MASK = (1ull << 48) - 1;        // tagged stack head: 48 bit pointer, 16 bit ABA tag
+
+    struct Header
+    {
+        int         m_iNode;
+        bool        m_bArena;
+    };
+
+    // links kept in free objects
+    struct FreeLink
+    {
+        FreeLink    *m_pNext;           // next object in chain
+        FreeLink    *m_pNextChain;      // next chain on global stack
+    };
+
+    struct alignas(POOL_ALIGNMENT) NodeStack
+    {
+        std::atomic<uint64_t>   m_head{0};
+    };
+
+    /* Thread cache of free objects (all of one node); returned to the global stacks when the thread exits. */
+    struct Magazine
+    {
+        Magazine()
+            :m_uCount(0),
+             m_iNode(currentNumaNode())
+        {}
+
+        ~Magazine() {
+            auto &pool = instance();
+            while (m_uCount > 0) {
+                size_t n = std::min(m_uCount, POOL_MAGAZINE_SIZE);
+                pool.pushChain(m_iNode, m_objects.data() + m_uCount - n, n);
+                m_uCount -= n;
+            }
+        }
+
+        std::array<void*, POOL_MAGAZINE_SIZE * 2>   m_objects;
+        size_t                                      m_uCount;
+        int                                         m_iNode;
+    };
+
  public:
+    MemoryPool()
+        :m_pArena(nullptr),
+         m_uArenaSize(0),
+         m_uBudget(0),
+         m_bHugePages(false),
+         m_bBounded(false),
+         m_uAllocated(0),
+         m_uOverflow(0),
+         m_iOverflowTimeoutMs(-1),
+         m_iInUse(0),
+         m_iHighWater(0)
+    {}
+
     ~MemoryPool() {
-        for (auto *p : m_pool) {
-            free(p);
+        for (int i = 0; i < MAX_NUMA_NODES; i++) {
+            for (FreeLink *pChain = popChain(i); pChain != nullptr; pChain = popChain(i)) {
+                while (pChain != nullptr) {
+                    FreeLink *pNext = pChain->m_pNext;
+                    char *pBlock = (char*)pChain - HEADER_SIZE;
+                    if (((Header*)pBlock)->m_bArena == false) {
+                        free(pBlock);
+                    }
+
+                    pChain = pNext;
+                }
+            }
         }
+
+        freeArena();
     }
-    
+
     static MemoryPool &instance() {
         static MemoryPool thePool;
         return thePool;
     }
-    
+
     // allocate or find available objects
     static void *getObjectPtr() {
-        return instance().findObjectPtr();
+        return instance().findObjectPtr(magazine());
     }
-    
+
     // put object back in pool
     static void releaseObjectPtr(void *_p) {
-        return instance().returnObjectPtr(_p);
+        return instance().returnObjectPtr(magazine(), _p);
+    }
+
+    /*
+        Preallocate an arena of _uObjects objects and bound the pool to it (call once, at startup, before the
+        first object is allocated). With _bHugePages the arena is mapped on explicit 2MB huge pages if the system
+        has them reserved, otherwise transparent huge pages are requested. Arena objects belong to the NUMA node of
+        the calling thread. Returns false if already bounded, objects were already allocated (they would be used
+        on top of the budget) or the arena could not be allocated.
+     */
+    static bool reserve(size_t _uObjects, bool _bHugePages = false) {
+        return instance().reserveArena(_uObjects, _bHugePages);
+    }
+
+    // bounded mode: allocate past the budget after blocking for _timeout (default: block until an object is free)
+    static void allowOverflow(const std::chrono::milliseconds &_timeout) {
+        instance().m_iOverflowTimeoutMs = _timeout.count();
     }
-    
+
+    static PoolStats stats() {
+        return instance().poolStats();
+    }
+
  private:
-    void *findObjectPtr() {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_pool.empty() == true) {
-            return malloc(sizeof(obj_type));
+    static Magazine &magazine() {
+        static thread_local Magazine theMagazine;
+        return theMagazine;
+    }
+
+    static Header *header(void *_p) {
+        return (Header*)((char*)_p - HEADER_SIZE);
+    }
+
+    void *findObjectPtr(Magazine &_magazine) {
+        if ( (_magazine.m_uCount == 0) &&
+             (refill(_magazine) == false) )
+        {
+            // arena used up, so wait for an object to be returned
+            int64_t iOverflowTimeoutMs = m_iOverflowTimeoutMs;
+            auto timeout = (iOverflowTimeoutMs < 0) ? WAIT_FOREVER : std::chrono::milliseconds(iOverflowTimeoutMs);
+            if ( (m_bBounded == false) ||
+                 (m_freeWaiter.wait([&]{return refill(_magazine);}, timeout) == false) )
+            {
+                m_uOverflow += m_bBounded ? 1 : 0;
+                m_uAllocated++;
+                addInUse(1);
+                
+                char *p = (char*)aligned_alloc(POOL_ALIGNMENT, BLOCK_SIZE);
+                *(Header*)p = Header{_magazine.m_iNode, false};
+                return p + HEADER_SIZE;
+            }
         }
-        else {
-            void *p = m_pool.back();
-            m_pool.pop_back();
-            return p;
+
+        addInUse(1);
+        return _magazine.m_objects[--_magazine.m_uCount];
+    }
+
+    void returnObjectPtr(Magazine &_magazine, void *_p) {
+        addInUse(-1);
+
+        int iNode = header(_p)->m_iNode;
+        if ( (m_bBounded == true) &&
+             (header(_p)->m_bArena == false) )
+        {
+            // overflow (never on the node stacks), so give it back to keep memory at the budget
+            m_uAllocated--;
+            free(header(_p));
+            return;
         }
+
+        if ( (iNode != _magazine.m_iNode) ||
+             (m_bBounded == true) )
+        {
+            pushChain(iNode, &_p, 1);
+            m_freeWaiter.notify();
+            return;
+        }
+
+        if (_magazine.m_uCount == _magazine.m_objects.size()) {
+            // hand half of the cache to the global stack
+            _magazine.m_uCount -= POOL_MAGAZINE_SIZE;
+            pushChain(iNode, _magazine.m_objects.data() + _magazine.m_uCount, POOL_MAGAZINE_SIZE);
+        }
+
+        _magazine.m_objects[_magazine.m_uCount++] = _p;
     }
 
-    void returnObjectPtr(void *_p) {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_pool.push_back(_p);
+    // refill thread cache from global stack (own node first; any node in bounded mode)
+    bool refill(Magazine &_magazine) {
+        FreeLink *pChain = popChain(_magazine.m_iNode);
+        for (int i = 0; (i < MAX_NUMA_NODES) && (pChain == nullptr) && (m_bBounded == true); i++) {
+            pChain = popChain(i);
+        }
+
+        for (FreeLink *p = pChain; p != nullptr; p = p->m_pNext) {
+            _magazine.m_objects[_magazine.m_uCount++] = p;
+        }
+
+        return _magazine.m_uCount > 0;
+    }
+
+    // NOTE: one relaxed atomic per chunk (chunks hold hundreds of messages, so this is cheap)
+    void addInUse(int64_t _iCount) {
+        int64_t iInUse = m_iInUse.fetch_add(_iCount, std::memory_order_relaxed) + _iCount;
+        int64_t iHighWater = m_iHighWater.load(std::memory_order_relaxed);
+        while ( (iInUse > iHighWater) &&
+                (m_iHighWater.compare_exchange_weak(iHighWater, iInUse, std::memory_order_relaxed) == false) )
+        {}
+    }
+
+    PoolStats poolStats() const {
+        PoolStats stats;
+        stats.m_uObjectSize = BLOCK_SIZE;
+        stats.m_uAllocated = m_uAllocated;
+        stats.m_uInUse = (size_t)std::max(m_iInUse.load(), (int64_t)0);
+        stats.m_uHighWater = (size_t)std::max(m_iHighWater.load(), (int64_t)0);
+        stats.m_uBudget = m_uBudget;
+        stats.m_uOverflow = m_uOverflow;
+        stats.m_bHugePages = m_bHugePages;
+        return stats;
+    }
+
+    bool reserveArena(size_t _uObjects, bool _bHugePages) {
+        if ( (m_bBounded == true) ||
+             (m_uAllocated > 0) ||
+             (_uObjects == 0) )
+        {
+            return false;
+        }
+
+        m_uArenaSize = _uObjects * BLOCK_SIZE;
+#ifdef __linux__
+        if (_bHugePages == true) {
+            m_uArenaSize = (m_uArenaSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            void *p = mmap(nullptr, m_uArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p == MAP_FAILED) {
+                p = mmap(nullptr, m_uArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED) {
+                    madvise(p, m_uArenaSize, MADV_HUGEPAGE);
+                }
+            }
+
+            m_pArena = (p != MAP_FAILED) ? (char*)p : nullptr;
+            m_bHugePages = (m_pArena != nullptr);
+        }
+        else
+#endif
+        {
+            m_pArena = (char*)aligned_alloc(POOL_ALIGNMENT, m_uArenaSize);
+        }
+
+        if (m_pArena == nullptr) {
+            m_uArenaSize = 0;
+            return false;
+        }
+
+        // carve arena into objects (single object chains, so that no thread cache hoards the budget)
+        int iNode = currentNumaNode();
+        for (size_t i = _uObjects; i > 0; i--) {
+            char *p = m_pArena + (i - 1) * BLOCK_SIZE;
+            *(Header*)p = Header{iNode, true};
+
+            void *pObject = p + HEADER_SIZE;
+            pushChain(iNode, &pObject, 1);
+        }
+
+        m_uAllocated += _uObjects;
+        m_uBudget = _uObjects;
+        m_bBounded = true;
+        return true;
+    }
+
+    void freeArena() {
+        if (m_pArena == nullptr) {
+            return;
+        }
+
+#ifdef __linux__
+        if (m_bHugePages == true) {
+            munmap(m_pArena, m_uArenaSize);
+        }
+        else
+#endif
+        {
+            free(m_pArena);
+        }
+
+        m_pArena = nullptr;
+    }
+
+    // link objects into a chain and push it onto the node stack
+    void pushChain(int _iNode, void **_pObjects, size_t _n) {
+        for (size_t i = 0; i < _n; i++) {
+            ((FreeLink*)_pObjects[i])->m_pNext = (i + 1 < _n) ? (FreeLink*)_pObjects[i + 1] : nullptr;
+        }
+
+        FreeLink *pFirst = (FreeLink*)_pObjects[0];
+        auto &head = m_nodes[_iNode].m_head;
+        uint64_t uHead = head.load(std::memory_order_relaxed);
+        do {
+            pFirst->m_pNextChain = (FreeLink*)(uHead & PTR_MASK);
+        } while (head.compare_exchange_weak(uHead, tagged(pFirst, uHead), std::memory_order_release, std::memory_order_relaxed) == false);
+    }
+
+    // pop a chain from the node stack (nullptr if empty)
+    FreeLink *popChain(int _iNode) {
+        auto &head = m_nodes[_iNode].m_head;
+        uint64_t uHead = head.load(std::memory_order_acquire);
+        for (;;) {
+            FreeLink *pFirst = (FreeLink*)(uHead & PTR_MASK);
+            if (pFirst == nullptr) {
+                return nullptr;
+            }
+
+            // NOTE: objects on the stacks are never freed while the pool is used (unbounded pools keep all objects,
+            // bounded pools only free overflow objects, which are never pushed), so a stale read here is harmless
+            // (the tag makes the CAS fail)
+            FreeLink *pNextChain = pFirst->m_pNextChain;
+            if (head.compare_exchange_weak(uHead, tagged(pNextChain, uHead), std::memory_order_acquire, std::memory_order_acquire) == true) {
+                return pFirst;
+            }
+        }
     }
-    
+
+    // new head value, with the ABA tag of the old head incremented
+    static uint64_t tagged(FreeLink *_p, uint64_t _uOldHead) {
+        return (uint64_t)_p | ((_uOldHead & ~PTR_MASK) + (PTR_MASK + 1));
+    }
+
  private:
-    std::vector<void*>   m_pool;
-    std::mutex           m_mutex;
+    static_assert(sizeof(void*) == 8, "Tagged stack head expects 64 bit pointers.");
+    static_assert(sizeof(obj_type) >= sizeof(FreeLink), "Pool objects must be able to hold the free list links.");
+
+    std::array<NodeStack, MAX_NUMA_NODES>   m_nodes;
+    IdleWaiter                              m_freeWaiter;       // producers blocked on the arena budget
+
+    char                                    *m_pArena;
+    size_t                                  m_uArenaSize;
+    size_t                                  m_uBudget;
+    bool                                    m_bHugePages;
+    std::atomic<bool>                       m_bBounded;
+    std::atomic<size_t>                     m_uAllocated;
+    std::atomic<size_t>                     m_uOverflow;
+    std::atomic<int64_t>                    m_iOverflowTimeoutMs;   // -1: never allocate past the budget
+    std::atomic<int64_t>                    m_iInUse;
+    std::atomic<int64_t>                    m_iHighWater;
 };
 
 
+/* Export the counters of MemoryPool<T> as gauges (labelled with the pool name). */
+template <typename T>
+void addPoolMetrics(MetricsRegistry &_registry, const std::string &_strPool)
+{
+    std::string strLabels = "pool=\"" + _strPool + "\"";
+    _registry.gauge("ais_pool_allocated", strLabels, "Pool objects allocated.", []{return (double)MemoryPool<T>::stats().m_uAllocated;});
+    _registry.gauge("ais_pool_in_use", strLabels, "Pool objects in use.", []{return (double)MemoryPool<T>::stats().m_uInUse;});
+    _registry.gauge("ais_pool_high_water", strLabels, "Max pool objects in use.", []{return (double)MemoryPool<T>::stats().m_uHighWater;});
+    _registry.gauge("ais_pool_overflow", strLabels, "Pool objects allocated past the budget.", []{return (double)MemoryPool<T>::stats().m_uOverflow;});
+}
+
+
 
 
 #endif // #ifndef AIS_POOL_H
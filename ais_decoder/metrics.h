@@ -0,0 +1,488 @@
+#ifndef AIS_METRICS_H
+#define AIS_METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+const size_t METRIC_SHARDS = 16;            // counter/histogram slots (threads are spread over the slots)
+const size_t METRIC_BUCKETS = 32;           // power of two histogram buckets (last one is +Inf)
+const size_t METRIC_ALIGNMENT = 64;         // one slot per cache line
+
+
+/* Metric slot of the calling thread (threads get slots round robin, so concurrent writers rarely share a line). */
+inline size_t metricShard()
+{
+    static std::atomic<size_t> uNext(0);
+    static thread_local size_t uShard = uNext++ % METRIC_SHARDS;
+    return uShard;
+}
+
+
+/* Monotonic counter; lock-free, threads add to their own slot and readers sum the slots. */
+class MetricCounter
+{
+ public:
+    MetricCounter() {
+        for (auto &shard : m_shards) {
+            shard.m_uValue.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(uint64_t _uValue = 1) {
+        m_shards[metricShard()].m_uValue.fetch_add(_uValue, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t uValue = 0;
+        for (auto &shard : m_shards) {
+            uValue += shard.m_uValue.load(std::memory_order_relaxed);
+        }
+
+        return uValue;
+    }
+
+ private:
+    struct alignas(METRIC_ALIGNMENT) Shard
+    {
+        std::atomic<uint64_t>   m_uValue;
+    };
+
+    std::array<Shard, METRIC_SHARDS>    m_shards;
+};
+
+
+/*
+    Histogram with power of two buckets; lock-free like MetricCounter.
+    Bucket i counts values up to 2^i - 1 (i.e. values of bit width i), the last bucket counts everything larger.
+ */
+class MetricHistogram
+{
+ public:
+    MetricHistogram() {
+        for (auto &shard : m_shards) {
+            for (auto &bucket : shard.m_buckets) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+
+            shard.m_uSum.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t _uValue) {
+        size_t uBucket = (_uValue == 0) ? 0 : (size_t)(64 - __builtin_clzll(_uValue));
+        auto &shard = m_shards[metricShard()];
+        shard.m_buckets[std::min(uBucket, METRIC_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+        shard.m_uSum.fetch_add(_uValue, std::memory_order_relaxed);
+    }
+
+    // upper bound of bucket (UINT64_MAX for the last one)
+    static uint64_t bucketBound(size_t _uBucket) {
+        return (_uBucket < METRIC_BUCKETS - 1) ? ((uint64_t)1 << _uBucket) - 1 : UINT64_MAX;
+    }
+
+    uint64_t bucket(size_t _uBucket) const {
+        uint64_t uCount = 0;
+        for (auto &shard : m_shards) {
+            uCount += shard.m_buckets[_uBucket].load(std::memory_order_relaxed);
+        }
+
+        return uCount;
+    }
+
+    uint64_t count() const {
+        uint64_t uCount = 0;
+        for (size_t i = 0; i < METRIC_BUCKETS; i++) {
+            uCount += bucket(i);
+        }
+
+        return uCount;
+    }
+
+    /*
+        Estimated value at quantile _dQuantile (0 to 1): linear interpolation within the power of two bucket the
+        quantile falls into (so within a factor of two of the true value). 0 if nothing was recorded.
+     */
+    uint64_t quantile(double _dQuantile) const {
+        std::array<uint64_t, METRIC_BUCKETS> buckets;
+        uint64_t uCount = 0;
+        for (size_t i = 0; i < METRIC_BUCKETS; i++) {
+            buckets[i] = bucket(i);
+            uCount += buckets[i];
+        }
+
+        double dRank = std::min(std::max(_dQuantile, 0.0), 1.0) * uCount;
+        uint64_t uBelow = 0;
+        for (size_t i = 0; i < METRIC_BUCKETS; i++) {
+            if ( (buckets[i] > 0) &&
+                 (uBelow + buckets[i] >= dRank) )
+            {
+                uint64_t uLower = (i == 0) ? 0 : ((uint64_t)1 << (i - 1));
+                uint64_t uUpper = (i < METRIC_BUCKETS - 1) ? bucketBound(i) : uLower * 2;
+                return uLower + (uint64_t)((uUpper - uLower) * ((dRank - uBelow) / buckets[i]));
+            }
+
+            uBelow += buckets[i];
+        }
+
+        return 0;
+    }
+
+    uint64_t sum() const {
+        uint64_t uSum = 0;
+        for (auto &shard : m_shards) {
+            uSum += shard.m_uSum.load(std::memory_order_relaxed);
+        }
+
+        return uSum;
+    }
+
+ private:
+    struct alignas(METRIC_ALIGNMENT) Shard
+    {
+        std::array<std::atomic<uint64_t>, METRIC_BUCKETS>   m_buckets;
+        std::atomic<uint64_t>                               m_uSum;
+    };
+
+    std::array<Shard, METRIC_SHARDS>    m_shards;
+};
+
+
+/* Records the time from construction to destruction (in nanoseconds) into a histogram; does nothing without one. */
+class MetricTimer
+{
+ public:
+    explicit MetricTimer(MetricHistogram *_pHistogram)
+        :m_pHistogram(_pHistogram)
+    {
+        if (m_pHistogram != nullptr) {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~MetricTimer() {
+        if (m_pHistogram != nullptr) {
+            auto elapsed = std::chrono::steady_clock::now() - m_start;
+            m_pHistogram->record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+    MetricTimer(const MetricTimer &) = delete;
+    MetricTimer &operator=(const MetricTimer &) = delete;
+
+ private:
+    MetricHistogram                         *m_pHistogram;
+    std::chrono::steady_clock::time_point   m_start;
+};
+
+
+/*
+    Named metrics (Prometheus naming: name plus optional labels, e.g. stage="fragments").
+    Registration takes a lock and returns a metric that stays valid for the lifetime of the registry; updates
+    do not touch the registry. Gauges are sampled through a callback when exported.
+ */
+class MetricsRegistry
+{
+ public:
+    using Gauge = std::function<double()>;
+
+ public:
+    MetricCounter &counter(const std::string &_strName, const std::string &_strLabels, const std::string &_strHelp) {
+        auto &entry = add(_strName, _strLabels, _strHelp);
+        if (entry.m_pCounter == nullptr) {
+            entry.m_pCounter = std::make_unique<MetricCounter>();
+        }
+
+        return *entry.m_pCounter;
+    }
+
+    MetricHistogram &histogram(const std::string &_strName, const std::string &_strLabels, const std::string &_strHelp) {
+        auto &entry = add(_strName, _strLabels, _strHelp);
+        if (entry.m_pHistogram == nullptr) {
+            entry.m_pHistogram = std::make_unique<MetricHistogram>();
+        }
+
+        return *entry.m_pHistogram;
+    }
+
+    void gauge(const std::string &_strName, const std::string &_strLabels, const std::string &_strHelp, Gauge _gauge) {
+        add(_strName, _strLabels, _strHelp).m_gauge = std::move(_gauge);
+    }
+
+    // all metrics in Prometheus text format
+    std::string text() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::string strText;
+        const std::string *pLastName = nullptr;
+        for (auto &it : m_entries) {
+            auto &entry = it.second;
+            if ( (pLastName == nullptr) ||
+                 (*pLastName != entry.m_strName) )
+            {
+                const char *pType = (entry.m_pCounter != nullptr) ? "counter" : (entry.m_pHistogram != nullptr) ? "histogram" : "gauge";
+                strText += "# HELP " + entry.m_strName + " " + entry.m_strHelp + "\n";
+                strText += "# TYPE " + entry.m_strName + " " + pType + "\n";
+                pLastName = &entry.m_strName;
+            }
+
+            if (entry.m_pCounter != nullptr) {
+                appendSample(strText, entry.m_strName, entry.m_strLabels, "", std::to_string(entry.m_pCounter->value()));
+            }
+            else if (entry.m_pHistogram != nullptr) {
+                auto &histogram = *entry.m_pHistogram;
+                uint64_t uCount = 0;
+                for (size_t i = 0; i < METRIC_BUCKETS; i++) {
+                    uCount += histogram.bucket(i);
+                    std::string strBound = (i < METRIC_BUCKETS - 1) ? std::to_string(MetricHistogram::bucketBound(i)) : "+Inf";
+                    appendSample(strText, entry.m_strName + "_bucket", entry.m_strLabels, "le=\"" + strBound + "\"", std::to_string(uCount));
+                }
+
+                appendSample(strText, entry.m_strName + "_sum", entry.m_strLabels, "", std::to_string(histogram.sum()));
+                appendSample(strText, entry.m_strName + "_count", entry.m_strLabels, "", std::to_string(uCount));
+            }
+            else if (entry.m_gauge != nullptr) {
+                char buffer[64];
+                snprintf(buffer, sizeof(buffer), "%.17g", entry.m_gauge());
+                appendSample(strText, entry.m_strName, entry.m_strLabels, "", buffer);
+            }
+        }
+
+        return strText;
+    }
+
+    // write all metrics to a file (replaced atomically, e.g. for the node exporter textfile collector)
+    bool writeFile(const std::string &_strPath) const {
+        std::string strTmpPath = _strPath + ".tmp";
+        FILE *pFile = fopen(strTmpPath.c_str(), "w");
+        if (pFile == nullptr) {
+            return false;
+        }
+
+        std::string strText = text();
+        bool bOk = fwrite(strText.data(), 1, strText.size(), pFile) == strText.size();
+        bOk = (fclose(pFile) == 0) && bOk;
+
+        return (bOk == true) && (rename(strTmpPath.c_str(), _strPath.c_str()) == 0);
+    }
+
+ private:
+    struct Entry
+    {
+        std::string                         m_strName;
+        std::string                         m_strLabels;
+        std::string                         m_strHelp;
+        std::unique_ptr<MetricCounter>      m_pCounter;
+        std::unique_ptr<MetricHistogram>    m_pHistogram;
+        Gauge                               m_gauge;
+    };
+
+    Entry &add(const std::string &_strName, const std::string &_strLabels, const std::string &_strHelp) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &entry = m_entries[_strName + "{" + _strLabels + "}"];     // groups samples by name
+        entry.m_strName = _strName;
+        entry.m_strLabels = _strLabels;
+        entry.m_strHelp = _strHelp;
+        return entry;
+    }
+
+    static void appendSample(std::string &_strText, const std::string &_strName, const std::string &_strLabels, const std::string &_strExtraLabel, const std::string &_strValue) {
+        _strText += _strName;
+        if ( (_strLabels.empty() == false) ||
+             (_strExtraLabel.empty() == false) )
+        {
+            _strText += "{" + _strLabels;
+            _strText += ( (_strLabels.empty() == false) && (_strExtraLabel.empty() == false) ) ? "," : "";
+            _strText += _strExtraLabel + "}";
+        }
+
+        _strText += " " + _strValue + "\n";
+    }
+
+ private:
+    mutable std::mutex                  m_mutex;
+    std::map<std::string, Entry>        m_entries;
+};
+
+
+class StagePerf;
+
+
+/* Items into and out of a pipeline stage (and chunks processed), optionally with performance counters (see perf.h). */
+struct StageMetrics
+{
+    StageMetrics(MetricsRegistry &_registry, const std::string &_strStage)
+        :m_itemsIn(_registry.counter("ais_stage_items_in_total", "stage=\"" + _strStage + "\"", "Items into a pipeline stage.")),
+         m_itemsOut(_registry.counter("ais_stage_items_out_total", "stage=\"" + _strStage + "\"", "Items out of a pipeline stage.")),
+         m_chunks(_registry.counter("ais_stage_chunks_total", "stage=\"" + _strStage + "\"", "Chunks processed by a pipeline stage.")),
+         m_pPerf(nullptr)
+    {}
+
+    void record(size_t _uItemsIn, size_t _uItemsOut) {
+        m_itemsIn.add(_uItemsIn);
+        m_itemsOut.add(_uItemsOut);
+        m_chunks.add();
+    }
+
+    MetricCounter       &m_itemsIn;
+    MetricCounter       &m_itemsOut;
+    MetricCounter       &m_chunks;
+    StagePerf           *m_pPerf;       // counted per chunk if set
+};
+
+
+/* Time blocked in queue push/pop and queue depth after every push or batch push (see BlockingQueue::setMetrics()). */
+struct QueueMetrics
+{
+    QueueMetrics(MetricsRegistry &_registry, const std::string &_strQueue)
+        :m_pushWait(_registry.histogram("ais_queue_push_wait_ns", "queue=\"" + _strQueue + "\"", "Time blocked in queue push (ns).")),
+         m_popWait(_registry.histogram("ais_queue_pop_wait_ns", "queue=\"" + _strQueue + "\"", "Time blocked in queue pop (ns).")),
+         m_depth(_registry.histogram("ais_queue_depth", "queue=\"" + _strQueue + "\"", "Queue depth after push (chunks)."))
+    {}
+
+    MetricHistogram     &m_pushWait;
+    MetricHistogram     &m_popWait;
+    MetricHistogram     &m_depth;
+};
+
+
+/*
+    Minimal HTTP endpoint serving metrics text (e.g. for Prometheus scraping); answers every request with the
+    current text. Listens on localhost only.
+ */
+class MetricsServer
+{
+ public:
+    using Text = std::function<std::string()>;
+
+ public:
+    MetricsServer()
+        :m_fd(-1),
+         m_wake{-1, -1}
+    {}
+
+    ~MetricsServer() {
+        stop();
+    }
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    // start serving on 127.0.0.1:_uPort; returns false if the port could not be opened
+    bool start(uint16_t _uPort, Text _text) {
+        stop();
+
+        m_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_fd < 0) {
+            return false;
+        }
+
+        int iReuse = 1;
+        setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &iReuse, sizeof(iReuse));
+
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(_uPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if ( (bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+             (listen(m_fd, 8) != 0) ||
+             (pipe(m_wake.data()) != 0) )
+        {
+            stop();
+            return false;
+        }
+
+        m_text = std::move(_text);
+        m_thread = std::thread([this]{run();});
+        return true;
+    }
+
+    void stop() {
+        if (m_thread.joinable() == true) {
+            char c = 0;
+            (void)write(m_wake[1], &c, 1);
+            m_thread.join();
+        }
+
+        for (int *pFd : {&m_fd, &m_wake[0], &m_wake[1]}) {
+            if (*pFd >= 0) {
+                close(*pFd);
+                *pFd = -1;
+            }
+        }
+    }
+
+ private:
+    void run() {
+        for (;;) {
+            std::array<struct pollfd, 2> pfd = {{{m_fd, POLLIN, 0}, {m_wake[0], POLLIN, 0}}};
+            if ( (poll(pfd.data(), pfd.size(), -1) < 0) ||
+                 (pfd[1].revents != 0) )
+            {
+                break;
+            }
+
+            int fd = accept(m_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                respond(fd);
+                close(fd);
+            }
+        }
+    }
+
+    void respond(int _fd) {
+        // read (and ignore) the request, but do not let a silent client stall the server
+        struct pollfd pfd = {_fd, POLLIN, 0};
+        char buffer[4096];
+        if ( (poll(&pfd, 1, 100) <= 0) ||
+             (recv(_fd, buffer, sizeof(buffer), 0) <= 0) )
+        {
+            return;
+        }
+
+        std::string strBody = m_text();
+        std::string strResponse = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                  std::to_string(strBody.size()) + "\r\nConnection: close\r\n\r\n" + strBody;
+
+        size_t uSent = 0;
+        while (uSent < strResponse.size()) {
+            ssize_t n = send(_fd, strResponse.data() + uSent, strResponse.size() - uSent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+
+            uSent += (size_t)n;
+        }
+    }
+
+ private:
+    int                     m_fd;
+    std::array<int, 2>      m_wake;         // self-pipe for stop
+    std::thread             m_thread;
+    Text                    m_text;
+};
+
+
+
+#endif // #ifndef AIS_METRICS_H
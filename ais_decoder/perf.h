@@ -0,0 +1,238 @@
+#ifndef AIS_PERF_H
+#define AIS_PERF_H
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+
+
+const size_t PERF_CYCLES                = 0;
+const size_t PERF_INSTRUCTIONS          = 1;
+const size_t PERF_LLC_MISSES            = 2;
+const size_t PERF_BRANCH_MISSES         = 3;
+const size_t PERF_TASK_CLOCK            = 4;    // ns on cpu (software event, also available in VMs without a PMU)
+const size_t PERF_EVENTS                = 5;
+
+
+inline const char *perfEventName(size_t _uEvent)
+{
+    static const std::array<const char*, PERF_EVENTS> NAMES = {{
+        "cycles", "instructions", "llc_misses", "branch_misses", "task_clock_ns"
+    }};
+
+    return (_uEvent < NAMES.size()) ? NAMES[_uEvent] : "unknown";
+}
+
+
+using PerfCounts = std::array<uint64_t, PERF_EVENTS>;
+
+
+/*
+    Performance counters of the calling thread (user space only), opened as one perf_event_open group so that all
+    events are counted over the same intervals. Events the cpu, VM or kernel settings (perf_event_paranoid) do not
+    allow are left out and read as 0. Linux only (nothing opens elsewhere).
+ */
+class PerfCounters
+{
+ public:
+    PerfCounters()
+        :m_uOpened(0)
+    {
+        m_fds.fill(-1);
+    }
+
+    ~PerfCounters() {
+        close();
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // open counters for the calling thread; returns false if no event could be opened
+    bool open() {
+        close();
+
+#ifdef __linux__
+        static const std::array<std::pair<uint32_t, uint64_t>, PERF_EVENTS> EVENTS = {{
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+        }};
+
+        int leader = -1;
+        for (size_t i = 0; i < PERF_EVENTS; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = EVENTS[i].first;
+            attr.config = EVENTS[i].second;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd >= 0) {
+                m_fds[i] = fd;
+                m_events[m_uOpened++] = i;
+                leader = (leader < 0) ? fd : leader;
+            }
+        }
+#endif
+
+        return m_uOpened > 0;
+    }
+
+    void close() {
+        for (auto &fd : m_fds) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+        m_uOpened = 0;
+    }
+
+    // current counts (all 0 if nothing is open)
+    bool read(PerfCounts &_counts) const {
+        _counts.fill(0);
+        if (m_uOpened == 0) {
+            return false;
+        }
+
+        std::array<uint64_t, PERF_EVENTS + 1> values;      // number of events, then one value per event
+        ssize_t n = ::read(m_fds[m_events[0]], values.data(), sizeof(uint64_t) * (m_uOpened + 1));
+        if (n != (ssize_t)(sizeof(uint64_t) * (m_uOpened + 1))) {
+            return false;
+        }
+
+        for (size_t i = 0; i < m_uOpened; i++) {
+            _counts[m_events[i]] = values[i + 1];
+        }
+
+        return true;
+    }
+
+    bool supported(size_t _uEvent) const {
+        return m_fds[_uEvent] >= 0;
+    }
+
+    // counters of the calling thread (opened on first use)
+    static const PerfCounters &thread() {
+        static thread_local PerfCounters counters;
+        static thread_local bool bOpened = counters.open();
+        (void)bOpened;
+        return counters;
+    }
+
+ private:
+    std::array<int, PERF_EVENTS>        m_fds;          // by event (-1 if not open)
+    std::array<size_t, PERF_EVENTS>     m_events;       // events in group order (first one is the group leader)
+    size_t                              m_uOpened;
+};
+
+
+/* Performance counter totals of a pipeline stage (ais_stage_perf_total{stage, event}). */
+class StagePerf
+{
+ public:
+    StagePerf(MetricsRegistry &_registry, const std::string &_strStage) {
+        for (size_t i = 0; i < PERF_EVENTS; i++) {
+            m_counters[i] = &_registry.counter("ais_stage_perf_total", "stage=\"" + _strStage + "\",event=\"" + perfEventName(i) + "\"",
+                                               "Performance counter totals per pipeline stage (user space).");
+        }
+    }
+
+    void add(const PerfCounts &_start, const PerfCounts &_end) {
+        for (size_t i = 0; i < PERF_EVENTS; i++) {
+            if (_end[i] > _start[i]) {
+                m_counters[i]->add(_end[i] - _start[i]);
+            }
+        }
+    }
+
+    uint64_t value(size_t _uEvent) const {
+        return m_counters[_uEvent]->value();
+    }
+
+    // e.g. "ipc=1.85 llc/item=0.02 br/item=0.91 ns/item=45.2" (events without counts are left out)
+    std::string summary(uint64_t _uItems) const {
+        std::string strSummary;
+        char buffer[64];
+        double dItems = (double)std::max(_uItems, (uint64_t)1);
+
+        if (value(PERF_CYCLES) > 0) {
+            snprintf(buffer, sizeof(buffer), " ipc=%.2f", (double)value(PERF_INSTRUCTIONS) / value(PERF_CYCLES));
+            strSummary += buffer;
+        }
+
+        if (value(PERF_LLC_MISSES) > 0) {
+            snprintf(buffer, sizeof(buffer), " llc/item=%.3f", value(PERF_LLC_MISSES) / dItems);
+            strSummary += buffer;
+        }
+
+        if (value(PERF_BRANCH_MISSES) > 0) {
+            snprintf(buffer, sizeof(buffer), " br/item=%.3f", value(PERF_BRANCH_MISSES) / dItems);
+            strSummary += buffer;
+        }
+
+        if (value(PERF_TASK_CLOCK) > 0) {
+            snprintf(buffer, sizeof(buffer), " ns/item=%.1f", value(PERF_TASK_CLOCK) / dItems);
+            strSummary += buffer;
+        }
+
+        return strSummary;
+    }
+
+ private:
+    std::array<MetricCounter*, PERF_EVENTS>     m_counters;
+};
+
+
+/* Adds the counts of the calling thread from construction to destruction to a stage (does nothing without one). */
+class PerfScope
+{
+ public:
+    explicit PerfScope(StagePerf *_pPerf)
+        :m_pPerf(_pPerf)
+    {
+        if (m_pPerf != nullptr) {
+            PerfCounters::thread().read(m_start);
+        }
+    }
+
+    ~PerfScope() {
+        if (m_pPerf != nullptr) {
+            PerfCounts end;
+            if (PerfCounters::thread().read(end) == true) {
+                m_pPerf->add(m_start, end);
+            }
+        }
+    }
+
+    PerfScope(const PerfScope &) = delete;
+    PerfScope &operator=(const PerfScope &) = delete;
+
+ private:
+    StagePerf       *m_pPerf;
+    PerfCounts      m_start;
+};
+
+
+
+#endif // #ifndef AIS_PERF_H
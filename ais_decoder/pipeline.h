@@ -0,0 +1,728 @@
+#ifndef AIS_PIPELINE_H
+#define AIS_PIPELINE_H
+
+#include "affinity.h"
+#include "chunk.h"
+#include "decoder.h"
+#include "mem_pool.h"
+#include "metrics.h"
+#include "perf.h"
+#include "processing.h"
+#include "queue.h"
+#include "scheduler.h"
+#include "sequence.h"
+#include "source.h"
+#include "strutils.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+const size_t AIS_INPUT_BUFFER_SIZE = 1024 * 64;
+
+
+/* Pipeline settings (see PipelineBuilder). */
+struct PipelineConfig
+{
+    PipelineConfig()
+        :m_iFragmentThreads(1),
+         m_iMessageThreads(1),
+         m_flushDeadline(5000),
+         m_latencyTarget(0),
+         m_pScheduler(nullptr),
+         m_bPerfCounters(false)
+    {}
+
+    int                         m_iFragmentThreads;     // stage threads (not used with a scheduler)
+    int                         m_iMessageThreads;
+    std::chrono::microseconds   m_flushDeadline;        // max age of partial input chunks
+    std::chrono::microseconds   m_latencyTarget;        // adaptive input chunk size if not zero
+    TaskScheduler               *m_pScheduler;          // run chunk processing as tasks on this (shared) scheduler
+    bool                        m_bPerfCounters;        // performance counters per stage (see perf.h)
+    
+    // stage thread affinity (unpinned if empty; stage cpus are not used with a scheduler, see TaskScheduler)
+    std::vector<int>            m_inputCpus;
+    std::vector<int>            m_fragmentCpus;
+    std::vector<int>            m_messageCpus;
+    std::vector<int>            m_sinkCpus;
+};
+
+
+/*
+    NMEA decoding pipeline: source -> fragments -> messages -> payload stages -> sinks.
+    Owns its queues, threads and processing state, so several independent pipelines can run in one process.
+
+    By default every stage runs on its own threads, connected by queues (queue types are template parameters).
+    With a task scheduler, chunk processing runs as tasks instead (only the source keeps a thread), so pipelines
+    that share a scheduler also share its cores.
+
+    Payload stages are called on every payload chunk, in parallel (e.g. filters); sinks are called one chunk at a
+    time and in input order.
+    Chunks come from the (process wide) chunk memory pools, which keep chunks on the NUMA node they were allocated on;
+    with all threads of a pipeline pinned to one node (PipelineBuilder::numaNode), a pipeline replica per socket
+    keeps its chunks node local.
+    With bounded pools (MemoryPool::reserve) the input stage keeps input chunks in flight (read and not yet through
+    the sinks) below the smallest pool budget, so later stages never wait for a chunk while the sink holds chunks
+    for reordering, and memory stays within the budget. Pipelines sharing bounded pools need budgets for all of them.
+    
+    Every pipeline has its own metrics registry (see metrics()): items in and out per stage, time blocked in
+    the queues, queue depth distribution, chunks in flight, chunk pool usage and dropped input per stage,
+    reason and source station. Optionally (PipelineBuilder::perfCounters) hardware performance counters per stage
+    (see perfSummary()). Builds with AIS_TRACE_LATENCY add chunk latency per segment and end-to-end
+    (see LatencyMetrics and latency()).
+ */
+template <typename QueueFragments = BlockingQueue<std::unique_ptr<Fragments>, 1024>,
+          typename QueueMessages = BlockingQueue<std::unique_ptr<Messages>, 1024>,
+          typename QueuePayloads = BlockingQueue<std::unique_ptr<Payloads>, 1024>>
+class BasicPipeline
+{
+ public:
+    using PayloadStage = std::function<void(Payloads &)>;
+    using PayloadSink = std::function<void(const Payloads &)>;
+
+ protected:
+    static const size_t     TASK_CHUNKS_PER_THREAD = 4;     // input chunks in flight per scheduler thread
+
+    /* Queue compatible adapter that hands input chunks to the scheduler (blocks while too many are in flight). */
+    struct TaskInput
+    {
+        template <typename T>
+        bool push(T &&_p) {
+            m_pipeline.postFragments(std::forward<T>(_p));
+            return true;
+        }
+
+        size_t size() const {return m_pipeline.m_uChunksInFlight;}
+        size_t maxSize() const {return m_pipeline.maxChunksInFlight();}
+
+        BasicPipeline   &m_pipeline;
+    };
+
+    /* Fragment queue adapter for bounded chunk pools (blocks while as many input chunks are in flight as fit the pools). */
+    struct BoundedInput
+    {
+        template <typename T>
+        bool push(T &&_p) {
+            m_pipeline.enterInFlight();
+            return m_pipeline.m_fragmentQueue.push(std::forward<T>(_p));
+        }
+
+        size_t size() const {return m_pipeline.m_fragmentQueue.size();}
+        size_t maxSize() const {return m_pipeline.m_fragmentQueue.maxSize();}
+
+        BasicPipeline   &m_pipeline;
+    };
+
+ public:
+    explicit BasicPipeline(NmeaSource _source, const PipelineConfig &_config = PipelineConfig())
+        :m_source(std::move(_source)),
+         m_config(_config),
+         m_inputMetrics(m_metrics, "input"),
+         m_fragmentMetrics(m_metrics, "fragments"),
+         m_messageMetrics(m_metrics, "messages"),
+         m_sinkMetrics(m_metrics, "sink"),
+         m_fragmentQueueMetrics(m_metrics, "fragments"),
+         m_messageQueueMetrics(m_metrics, "messages"),
+         m_payloadQueueMetrics(m_metrics, "payloads"),
+         m_inputDrops(m_metrics, "input"),
+         m_fragmentDrops(m_metrics, "fragments"),
+         m_messageDrops(m_metrics, "messages"),
+#if AIS_TRACE_LATENCY
+         m_latencyMetrics(m_metrics),
+#endif
+         m_input(_config.m_flushDeadline),
+         m_iFragmentThreads(0),
+         m_iMessageThreads(0),
+         m_uChunksInFlight(0),
+         m_uPoolChunkLimit(SIZE_MAX),
+         m_uChunkCount(0),
+         m_bStarted(false),
+         m_bStop(false),
+         m_bFinished(false)
+    {
+        if (m_config.m_latencyTarget.count() > 0) {
+            m_pController = std::make_unique<ChunkSizeController>(8, m_config.m_latencyTarget);
+            m_input.m_pController = m_pController.get();
+        }
+        
+        if (m_config.m_bPerfCounters == true) {
+            m_pInputPerf = std::make_unique<StagePerf>(m_metrics, "input");
+            m_pFragmentPerf = std::make_unique<StagePerf>(m_metrics, "fragments");
+            m_pMessagePerf = std::make_unique<StagePerf>(m_metrics, "messages");
+            m_pSinkPerf = std::make_unique<StagePerf>(m_metrics, "sink");
+            m_inputMetrics.m_pPerf = m_pInputPerf.get();
+            m_fragmentMetrics.m_pPerf = m_pFragmentPerf.get();
+            m_messageMetrics.m_pPerf = m_pMessagePerf.get();
+            m_sinkMetrics.m_pPerf = m_pSinkPerf.get();
+        }
+        
+        m_input.m_pMetrics = &m_inputMetrics;
+        m_input.m_pDrops = &m_inputDrops;
+        m_fragmentQueue.setMetrics(&m_fragmentQueueMetrics);
+        m_messageQueue.setMetrics(&m_messageQueueMetrics);
+        m_payloadQueue.setMetrics(&m_payloadQueueMetrics);
+        
+        m_metrics.gauge("ais_queue_size", "queue=\"fragments\"", "Chunks in queue.", [this]{return (double)m_fragmentQueue.size();});
+        m_metrics.gauge("ais_queue_size", "queue=\"messages\"", "Chunks in queue.", [this]{return (double)m_messageQueue.size();});
+        m_metrics.gauge("ais_queue_size", "queue=\"payloads\"", "Chunks in queue.", [this]{return (double)m_payloadQueue.size();});
+        m_metrics.gauge("ais_pipeline_chunks_in_flight", "", "Input chunks in flight (task mode or bounded pools).", [this]{return (double)m_uChunksInFlight;});
+        m_metrics.gauge("ais_pipeline_chunk_target", "", "Input chunk fill target.", [this]{return (double)chunkTarget();});
+        addPoolMetrics<Fragments>(m_metrics, "fragments");
+        addPoolMetrics<Messages>(m_metrics, "messages");
+        addPoolMetrics<Payloads>(m_metrics, "payloads");
+    }
+
+    ~BasicPipeline() {
+        stop();
+    }
+
+    BasicPipeline(const BasicPipeline &) = delete;
+    BasicPipeline &operator=(const BasicPipeline &) = delete;
+
+    // add payload stage (before start)
+    void addStage(PayloadStage _stage) {
+        m_stages.push_back(std::move(_stage));
+    }
+
+    // add sink (before start)
+    void addSink(PayloadSink _sink) {
+        m_sinks.push_back(std::move(_sink));
+    }
+
+    // start reading and processing input; returns false if already started or there is no source
+    bool start() {
+        if ( (m_bStarted == true) ||
+             (m_source.m_read == nullptr) )
+        {
+            return false;
+        }
+
+        m_bStarted = true;
+        m_uPoolChunkLimit = poolChunkLimit();
+        if (m_config.m_pScheduler != nullptr) {
+            m_pFragmentStrand = std::make_unique<TaskStrand>(*m_config.m_pScheduler);
+            m_pPayloadStrand = std::make_unique<TaskStrand>(*m_config.m_pScheduler);
+            m_threads.emplace_back([this]{
+                setThreadAffinity(m_config.m_inputCpus);
+                runTaskInput();
+            });
+        }
+        else {
+            m_iFragmentThreads = std::max(m_config.m_iFragmentThreads, 1);
+            m_iMessageThreads = std::max(m_config.m_iMessageThreads, 1);
+            int iFragmentThreads = m_iFragmentThreads;
+            int iMessageThreads = m_iMessageThreads;
+
+            m_threads.emplace_back([this]{
+                setThreadAffinity(m_config.m_inputCpus);
+                if (m_uPoolChunkLimit < SIZE_MAX) {
+                    BoundedInput input{*this};
+                    runInput(input);
+                }
+                else {
+                    runInput(m_fragmentQueue);
+                }
+
+                m_fragmentQueue.close();
+            });
+
+            for (int i = 0; i < iFragmentThreads; i++) {
+                m_threads.emplace_back([this]{
+                    setThreadAffinity(m_config.m_fragmentCpus);
+                    runFragments();
+                });
+            }
+
+            for (int i = 0; i < iMessageThreads; i++) {
+                m_threads.emplace_back([this]{
+                    setThreadAffinity(m_config.m_messageCpus);
+                    runMessages();
+                });
+            }
+
+            m_threads.emplace_back([this]{
+                setThreadAffinity(m_config.m_sinkCpus);
+                runSink();
+            });
+        }
+
+        return true;
+    }
+
+    // stop reading input, then drain the chunks already read
+    void stop() {
+        m_bStop = true;
+        if ( (m_bStarted == true) &&
+             (m_source.m_cancel != nullptr) )
+        {
+            m_source.m_cancel();
+        }
+
+        drain();
+    }
+
+    // wait for the end of input and until all chunks have gone through the sinks
+    void drain() {
+        wait(WAIT_FOREVER);
+        for (auto &thread : m_threads) {
+            thread.join();
+        }
+
+        m_threads.clear();
+        m_pFragmentStrand.reset();
+        m_pPayloadStrand.reset();
+    }
+
+    // wait until all input has been processed; returns false on timeout
+    bool wait(const std::chrono::milliseconds &_timeout) {
+        if (m_bStarted == false) {
+            return true;
+        }
+
+        return m_finished.wait([this]{return m_bFinished == true;}, _timeout);
+    }
+
+    bool finished() const {
+        return m_bFinished;
+    }
+
+    size_t fragmentQueueSize() const {return m_fragmentQueue.size();}
+    size_t messageQueueSize() const {return m_messageQueue.size();}
+    size_t payloadQueueSize() const {return m_payloadQueue.size();}
+    size_t chunksInFlight() const {return m_uChunksInFlight;}
+
+    // current input chunk fill target
+    size_t chunkTarget() const {
+        return (m_pController != nullptr) ? m_pController->target() : AIS_CHUNK_SIZE;
+    }
+
+    // payload chunks delivered to the sinks
+    uint64_t chunkCount() const {
+        return m_uChunkCount;
+    }
+
+    // input dropped by all stages
+    uint64_t dropCount() const {
+        return m_inputDrops.total() + m_fragmentDrops.total() + m_messageDrops.total();
+    }
+
+    // pipeline metrics (e.g. MetricsRegistry::writeFile() or a MetricsServer)
+    MetricsRegistry &metrics() {
+        return m_metrics;
+    }
+
+    /*
+        Performance counters per stage, e.g. "fragments: ipc=1.85 llc/item=0.02 br/item=0.91 ns/item=45.2 | ...",
+        per item into the stage (fragments for the input stage); empty without performance counters.
+     */
+    std::string perfSummary() const {
+        if (m_pInputPerf == nullptr) {
+            return "";
+        }
+
+        return "input:" + m_pInputPerf->summary(m_inputMetrics.m_itemsOut.value()) +
+               " | fragments:" + m_pFragmentPerf->summary(m_fragmentMetrics.m_itemsIn.value()) +
+               " | messages:" + m_pMessagePerf->summary(m_messageMetrics.m_itemsIn.value()) +
+               " | sink:" + m_pSinkPerf->summary(m_sinkMetrics.m_itemsIn.value());
+    }
+
+#if AIS_TRACE_LATENCY
+    // chunk latency per segment and end-to-end (latency tracing builds only)
+    const LatencyMetrics &latency() const {
+        return m_latencyMetrics;
+    }
+#endif
+
+ private:
+    // read source until end of stream (or stop) and push input chunks
+    template <typename Queue>
+    void runInput(Queue &_queue) {
+        while (m_bStop == false) {
+            int n = m_source.m_read(m_nmeaData.data() + m_nmeaData.size(), m_nmeaData.maxSize() - m_nmeaData.size(), inputTimeout());
+            if (n < 0) {
+                break;
+            }
+            else if (n == 0) {
+                flushNmeaData(_queue, m_input, false);
+                continue;
+            }
+
+            m_nmeaData.setSize(m_nmeaData.size() + n);
+            m_inputMetrics.m_itemsIn.add(n);
+
+            size_t bytesUsed = 0;
+            {
+                PerfScope perf(m_inputMetrics.m_pPerf);
+                bytesUsed = processNmeaData(_queue, m_nmeaData, m_input);
+            }
+            if (bytesUsed > 0) {
+                // keep partial line for next read
+                size_t droppedSize = m_nmeaData.size() - bytesUsed;
+                memmove(m_nmeaData.data(), m_nmeaData.data() + bytesUsed, droppedSize);
+                m_nmeaData.setSize(droppedSize);
+            }
+            else if (m_nmeaData.size() == m_nmeaData.maxSize()) {
+                m_nmeaData.setSize(0);      // no line end in a full buffer, so drop it
+            }
+        }
+
+        // end of input, so terminate partial last line and push everything left
+        if ( (m_nmeaData.size() > 0) &&
+             (m_nmeaData.size() < m_nmeaData.maxSize()) )
+        {
+            m_nmeaData.data()[m_nmeaData.size()] = '\n';
+            m_nmeaData.setSize(m_nmeaData.size() + 1);
+            processNmeaData(_queue, m_nmeaData, m_input);
+        }
+
+        m_nmeaData.setSize(0);
+        flushNmeaData(_queue, m_input, true);
+    }
+
+    // wait for input at most until the flush deadline of a partial chunk (block when there is none)
+    std::chrono::milliseconds inputTimeout() const {
+        if ( (m_input.m_pFragments == nullptr) ||
+             (m_input.m_pFragments->empty() == true) )
+        {
+            return WAIT_FOREVER;
+        }
+
+        auto age = NmeaInputState::Clock::now() - m_input.m_tsChunk;
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(m_input.m_flushDeadline - age + 999us);
+        return std::max(timeout, 0ms);
+    }
+
+    void runFragments() {
+        // the sequence gate is only needed when several threads share the reassembly state
+        SequenceGate *pGate = (m_config.m_iFragmentThreads > 1) ? &m_fragmentGate : nullptr;
+        while (m_fragmentQueue.finished() == false) {
+            processFragments(m_messageQueue, m_fragmentQueue, m_multiLineState, pGate, &m_fragmentMetrics, &m_fragmentDrops);
+        }
+
+        if (--m_iFragmentThreads == 0) {
+            m_messageQueue.close();
+        }
+    }
+
+    void runMessages() {
+        while (m_messageQueue.finished() == false) {
+            processMessages(m_payloadQueue, m_messageQueue, [this](Payloads &_payloads){runStages(_payloads);}, &m_messageMetrics, &m_messageDrops);
+        }
+
+        if (--m_iMessageThreads == 0) {
+            m_payloadQueue.close();
+        }
+    }
+
+    void runSink() {
+        ReorderBuffer<std::unique_ptr<Payloads>> reorder;     // message stage may run on several threads
+
+        std::unique_ptr<Payloads> pPayloads;
+        while (m_payloadQueue.pop(pPayloads) == true) {
+            uint64_t uSequence = pPayloads->m_uSequence;
+            reorder.push(uSequence, std::move(pPayloads));
+
+            size_t uDelivered = 0;
+            while (reorder.pop(pPayloads) == true) {
+                runSinks(*pPayloads);
+                pPayloads.reset();
+                uDelivered++;
+            }
+
+            if (m_uPoolChunkLimit < SIZE_MAX) {
+                leaveInFlight(uDelivered);
+            }
+        }
+
+        setFinished();
+    }
+
+    void runStages(Payloads &_payloads) {
+        for (auto &stage : m_stages) {
+            stage(_payloads);
+        }
+    }
+
+    void runSinks(const Payloads &_payloads) {
+#if AIS_TRACE_LATENCY
+        m_latencyMetrics.record(_payloads.m_trace);
+#endif
+        PerfScope perf(m_sinkMetrics.m_pPerf);
+        for (auto &sink : m_sinks) {
+            sink(_payloads);
+        }
+
+        m_sinkMetrics.record(_payloads.size(), 0);
+        m_uChunkCount++;
+    }
+
+    void setFinished() {
+        m_bFinished = true;
+        m_finished.notify();
+    }
+
+    size_t maxChunksInFlight() const {
+        size_t uMax = (m_config.m_pScheduler != nullptr) ? m_config.m_pScheduler->threadCount() * TASK_CHUNKS_PER_THREAD : SIZE_MAX;
+        return std::min(uMax, m_uPoolChunkLimit);
+    }
+
+    /*
+        Input chunks in flight that fit bounded chunk pools (SIZE_MAX if unbounded): every input chunk holds at most
+        one chunk of each type at a time, and the input stage holds one more fragments chunk while filling it.
+     */
+    static size_t poolChunkLimit() {
+        size_t uLimit = SIZE_MAX;
+        for (size_t uBudget : {MemoryPool<Fragments>::stats().m_uBudget, MemoryPool<Messages>::stats().m_uBudget, MemoryPool<Payloads>::stats().m_uBudget}) {
+            if (uBudget > 0) {
+                uLimit = std::min(uLimit, std::max(uBudget, (size_t)2) - 1);
+            }
+        }
+
+        return uLimit;
+    }
+
+    // block until another input chunk may be in flight, then count it
+    void enterInFlight() {
+        std::unique_lock<std::mutex> lock(m_inFlightMutex);
+        m_inFlightCv.wait(lock, [this]{return m_uChunksInFlight < maxChunksInFlight();});
+        m_uChunksInFlight++;
+    }
+
+    void leaveInFlight(size_t _uChunks) {
+        if (_uChunks > 0) {
+            std::lock_guard<std::mutex> lock(m_inFlightMutex);
+            m_uChunksInFlight -= _uChunks;
+            m_inFlightCv.notify_all();
+        }
+    }
+
+    /*
+        Task mode: fragment chunks are processed in order on one strand (multi-sentence reassembly state),
+        message chunks on any worker and payload chunks go through the sink strand (reordered).
+        Empty chunks are passed on as well, so that sequence numbers have no gaps.
+     */
+    void runTaskInput() {
+        TaskInput input{*this};
+        runInput(input);
+
+        {
+            std::unique_lock<std::mutex> lock(m_inFlightMutex);
+            m_inFlightCv.wait(lock, [this]{return m_uChunksInFlight == 0;});
+        }
+
+        setFinished();
+    }
+
+    void postFragments(std::unique_ptr<Fragments> &&_pFragments) {
+        enterInFlight();
+
+        std::shared_ptr<Fragments> pFragments = std::move(_pFragments);
+        m_pFragmentStrand->post([this, pFragments]{
+            PerfScope perf(m_fragmentMetrics.m_pPerf);
+            std::shared_ptr<Messages> pMessages = std::make_unique<Messages>();
+            DropLog drops;
+            processFragmentsChunk(*pMessages, *pFragments, m_multiLineState, &drops);
+            m_fragmentMetrics.record(pFragments->size(), pMessages->size());
+            m_fragmentDrops.merge(drops);
+
+            m_config.m_pScheduler->spawn([this, pMessages]{
+                PerfScope perf(m_messageMetrics.m_pPerf);
+                std::shared_ptr<Payloads> pPayloads = std::make_unique<Payloads>();
+                DropLog drops;
+                processMessagesChunk(*pPayloads, *pMessages, &drops);
+                runStages(*pPayloads);
+                m_messageMetrics.record(pMessages->size(), pPayloads->size());
+                m_messageDrops.merge(drops);
+
+                m_pPayloadStrand->post([this, pPayloads]{
+                    m_taskReorder.push(pPayloads->m_uSequence, std::shared_ptr<Payloads>(pPayloads));
+
+                    size_t uDelivered = 0;
+                    std::shared_ptr<Payloads> p;
+                    while (m_taskReorder.pop(p) == true) {
+                        runSinks(*p);
+                        p.reset();
+                        uDelivered++;
+                    }
+
+                    // NOTE: last access to the pipeline (drain may return once nothing is in flight)
+                    leaveInFlight(uDelivered);
+                });
+            });
+        });
+    }
+
+ private:
+    NmeaSource                          m_source;
+    PipelineConfig                      m_config;
+    std::vector<PayloadStage>           m_stages;
+    std::vector<PayloadSink>            m_sinks;
+
+    // metrics (input items in are bytes read)
+    MetricsRegistry                     m_metrics;
+    StageMetrics                        m_inputMetrics;
+    StageMetrics                        m_fragmentMetrics;
+    StageMetrics                        m_messageMetrics;
+    StageMetrics                        m_sinkMetrics;
+    QueueMetrics                        m_fragmentQueueMetrics;
+    QueueMetrics                        m_messageQueueMetrics;
+    QueueMetrics                        m_payloadQueueMetrics;
+    DropMetrics                         m_inputDrops;
+    DropMetrics                         m_fragmentDrops;
+    DropMetrics                         m_messageDrops;
+#if AIS_TRACE_LATENCY
+    LatencyMetrics                      m_latencyMetrics;
+#endif
+    std::unique_ptr<StagePerf>          m_pInputPerf;           // performance counters (if enabled)
+    std::unique_ptr<StagePerf>          m_pFragmentPerf;
+    std::unique_ptr<StagePerf>          m_pMessagePerf;
+    std::unique_ptr<StagePerf>          m_pSinkPerf;
+
+    // input
+    String<AIS_INPUT_BUFFER_SIZE>       m_nmeaData;
+    NmeaInputState                      m_input;
+    std::unique_ptr<ChunkSizeController>    m_pController;
+
+    // stages
+    QueueFragments                      m_fragmentQueue;
+    QueueMessages                       m_messageQueue;
+    QueuePayloads                       m_payloadQueue;
+    MultiLineState                      m_multiLineState;
+    SequenceGate                        m_fragmentGate;
+    std::atomic<int>                    m_iFragmentThreads;     // fragment stage threads still running (last one closes message queue)
+    std::atomic<int>                    m_iMessageThreads;      // message stage threads still running (last one closes payload queue)
+    std::vector<std::thread>            m_threads;
+
+    // task mode
+    std::unique_ptr<TaskStrand>         m_pFragmentStrand;
+    std::unique_ptr<TaskStrand>         m_pPayloadStrand;
+    ReorderBuffer<std::shared_ptr<Payloads>>    m_taskReorder;
+    std::mutex                          m_inFlightMutex;
+    std::condition_variable             m_inFlightCv;
+    std::atomic<size_t>                 m_uChunksInFlight;
+    size_t                              m_uPoolChunkLimit;      // max input chunks in flight for bounded pools (SIZE_MAX if unbounded)
+
+    std::atomic<uint64_t>               m_uChunkCount;
+    std::atomic<bool>                   m_bStarted;
+    std::atomic<bool>                   m_bStop;
+    std::atomic<bool>                   m_bFinished;
+    IdleWaiter                          m_finished;
+};
+
+
+using Pipeline = BasicPipeline<>;
+
+
+/*
+    Fluent pipeline setup, e.g.:
+        auto pPipeline = PipelineBuilder<>().source(source).messageThreads(4).sink(sink).build();
+    build() returns nullptr if no source was set.
+ */
+template <typename PipelineType = Pipeline>
+class PipelineBuilder
+{
+ public:
+    PipelineBuilder &source(NmeaSource _source) {
+        m_source = std::move(_source);
+        return *this;
+    }
+
+    PipelineBuilder &fragmentThreads(int _iThreads) {
+        m_config.m_iFragmentThreads = _iThreads;
+        return *this;
+    }
+
+    PipelineBuilder &messageThreads(int _iThreads) {
+        m_config.m_iMessageThreads = _iThreads;
+        return *this;
+    }
+
+    PipelineBuilder &flushDeadline(const std::chrono::microseconds &_deadline) {
+        m_config.m_flushDeadline = _deadline;
+        return *this;
+    }
+
+    PipelineBuilder &latencyTarget(const std::chrono::microseconds &_target) {
+        m_config.m_latencyTarget = _target;
+        return *this;
+    }
+
+    PipelineBuilder &perfCounters(bool _bEnable) {
+        m_config.m_bPerfCounters = _bEnable;
+        return *this;
+    }
+
+    PipelineBuilder &scheduler(TaskScheduler &_scheduler) {
+        m_config.m_pScheduler = &_scheduler;
+        return *this;
+    }
+
+    PipelineBuilder &inputCpus(const std::vector<int> &_cpus) {
+        m_config.m_inputCpus = _cpus;
+        return *this;
+    }
+
+    PipelineBuilder &fragmentCpus(const std::vector<int> &_cpus) {
+        m_config.m_fragmentCpus = _cpus;
+        return *this;
+    }
+
+    PipelineBuilder &messageCpus(const std::vector<int> &_cpus) {
+        m_config.m_messageCpus = _cpus;
+        return *this;
+    }
+
+    PipelineBuilder &sinkCpus(const std::vector<int> &_cpus) {
+        m_config.m_sinkCpus = _cpus;
+        return *this;
+    }
+
+    // pin all pipeline threads to the cpus of a NUMA node (e.g. one pipeline replica per socket)
+    PipelineBuilder &numaNode(int _iNode) {
+        auto cpus = numaNodeCpus(_iNode);
+        return inputCpus(cpus).fragmentCpus(cpus).messageCpus(cpus).sinkCpus(cpus);
+    }
+
+    PipelineBuilder &stage(typename PipelineType::PayloadStage _stage) {
+        m_stages.push_back(std::move(_stage));
+        return *this;
+    }
+
+    PipelineBuilder &sink(typename PipelineType::PayloadSink _sink) {
+        m_sinks.push_back(std::move(_sink));
+        return *this;
+    }
+
+    std::unique_ptr<PipelineType> build() const {
+        if (m_source.m_read == nullptr) {
+            return nullptr;
+        }
+
+        auto pPipeline = std::make_unique<PipelineType>(m_source, m_config);
+        for (auto &stage : m_stages) {
+            pPipeline->addStage(stage);
+        }
+
+        for (auto &sink : m_sinks) {
+            pPipeline->addSink(sink);
+        }
+
+        return pPipeline;
+    }
+
+ private:
+    NmeaSource                                              m_source;
+    PipelineConfig                                          m_config;
+    std::vector<typename PipelineType::PayloadStage>        m_stages;
+    std::vector<typename PipelineType::PayloadSink>         m_sinks;
+};
+
+
+
+#endif // #ifndef AIS_PIPELINE_H
@@ -3,58 +3,418 @@
 
 #include "chunk.h"
 #include "decoder.h"
+#include "metrics.h"
+#include "perf.h"
 #include "queue.h"
+#include "sequence.h"
+#include "trace.h"
 
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 #include <cstring>
 
 
 const size_t AIS_CHUNK_SIZE = 512;
 const int MAX_PROC_COUNT = 512;
+const size_t AIS_BATCH_SIZE = 8;            // chunks moved per queue operation
+const size_t MAX_DROP_STATIONS = 256;       // stations with their own drop counters (others are counted as "other")
 using Fragments = Chunk<NmeaFrg, AIS_CHUNK_SIZE>;
 using Messages = Chunk<NmeaMsg, AIS_CHUNK_SIZE>;
 using Payloads = Chunk<MsgPayload, AIS_CHUNK_SIZE>;
 
 
+#if AIS_RETAIN_RAW
+/*
+    Raw sentences of one chunk of messages (AIS_RETAIN_RAW).
+    Written by the fragment stage and shared by reference with the payload chunk made from the messages chunk.
+ */
+struct RawText
+{
+    RawText()
+        :m_size(0)
+    {}
+    
+    RawRef append(const char *_pData, size_t _uSize) {
+        _uSize = std::min(_uSize, m_data.size() - m_size);
+        RawRef ref{(uint32_t)m_size, (uint32_t)_uSize};
+        memcpy(m_data.data() + m_size, _pData, _uSize);
+        m_size += _uSize;
+        return ref;
+    }
+    
+    StringRef get(const RawRef &_ref) const {
+        StringRef str;
+        str.m_pData = const_cast<char*>(m_data.data());
+        str.m_uOffset = _ref.m_uOffset;
+        str.m_uSize = _ref.m_uSize;
+        return str;
+    }
+    
+    void *operator new(size_t) {
+        return MemoryPool<RawText>::getObjectPtr();
+    }
+    
+    void operator delete(void *_p) {
+        MemoryPool<RawText>::releaseObjectPtr(_p);
+    }
+    
+    std::array<char, AIS_CHUNK_SIZE * (MAX_CHARS_PER_MESSAGE + MAX_FRAGMENTS)>     m_data;
+    size_t                                                                          m_size;
+};
+
+
+/* Keep raw sentence(s) of a message that was just produced from _frg (single sentence or completed multi-sentence). */
+inline void retainRaw(Messages &_messages, NmeaMsg &_msg, const NmeaFrg &_frg, const MultiLineState &_state)
+{
+    if (_messages.m_pRaw == nullptr) {
+        _messages.m_pRaw = std::shared_ptr<RawText>(new RawText());
+    }
+    
+    auto &raw = *_messages.m_pRaw;
+    if (_frg.m_uFragmentCount == 1) {
+        _msg.m_raw = raw.append(_frg.m_sentence.data(), _frg.m_sentence.size());
+        return;
+    }
+    
+    const auto &fragments = _state[_frg.m_uMsgId];
+    _msg.m_raw = raw.append(fragments.m_fragments[0].m_sentence.data(), fragments.m_fragments[0].m_sentence.size());
+    for (size_t i = 1; i < fragments.m_count; i++) {
+        _msg.m_raw.m_uSize += raw.append("\n", 1).m_uSize;
+        _msg.m_raw.m_uSize += raw.append(fragments.m_fragments[i].m_sentence.data(), fragments.m_fragments[i].m_sentence.size()).m_uSize;
+    }
+}
+
+
+/* Raw sentence(s) of a decoded payload. */
+inline StringRef rawSentence(const Payloads &_payloads, const MsgPayload &_payload)
+{
+    return (_payloads.m_pRaw != nullptr) ? _payloads.m_pRaw->get(_payload.m_raw) : StringRef();
+}
+#endif
+
+
+/*
+    Adjusts the fill target of input chunks at runtime (between a min size and AIS_CHUNK_SIZE).
+    Chunks shrink when the measured chunk latency is above the latency target, and grow (for throughput)
+    when the downstream queue is backing up or latency is well below the target.
+    Latency is measured by the caller, e.g. the time to fill and push an input chunk.
+ */
+class ChunkSizeController
+{
+ public:
+    ChunkSizeController(size_t _uMinSize, const std::chrono::microseconds &_latencyTarget)
+        :m_uMinSize(std::max(_uMinSize, (size_t)1)),
+         m_latencyTarget(_latencyTarget),
+         m_uTarget(AIS_CHUNK_SIZE)
+    {}
+    
+    size_t target() const {
+        return m_uTarget.load(std::memory_order_relaxed);
+    }
+    
+    void update(size_t _uQueueSize, size_t _uQueueMaxSize, const std::chrono::nanoseconds &_latency) {
+        size_t uTarget = target();
+        if (_latency > m_latencyTarget) {
+            uTarget = uTarget / 2;
+        }
+        else if (_uQueueSize * 2 > _uQueueMaxSize) {
+            uTarget = uTarget * 2;
+        }
+        else if (_latency * 2 < m_latencyTarget) {
+            uTarget = uTarget + uTarget / 4 + 1;
+        }
+        
+        m_uTarget.store(std::min(std::max(uTarget, m_uMinSize), AIS_CHUNK_SIZE), std::memory_order_relaxed);
+    }
+    
+ private:
+    const size_t                    m_uMinSize;
+    const std::chrono::nanoseconds  m_latencyTarget;
+    std::atomic<size_t>             m_uTarget;
+};
+
+
+/*
+    Dropped input per reason: per stage (lock-free counters) and per source station (registered on first drop).
+    Drop logs are merged once per chunk, and only if something was dropped.
+ */
+class DropMetrics
+{
+ protected:
+    using Counters = std::array<MetricCounter*, DROP_REASONS>;
+    
+ public:
+    DropMetrics(MetricsRegistry &_registry, const std::string &_strStage)
+        :m_registry(_registry)
+    {
+        for (size_t i = 0; i < DROP_REASONS; i++) {
+            m_stage[i] = &_registry.counter("ais_dropped_total", "stage=\"" + _strStage + "\",reason=\"" + dropReasonName(i) + "\"",
+                                            "Input dropped per stage and reason.");
+        }
+    }
+    
+    // drops of this stage (all reasons)
+    uint64_t total() const {
+        uint64_t uTotal = 0;
+        for (auto pCounter : m_stage) {
+            uTotal += pCounter->value();
+        }
+        
+        return uTotal;
+    }
+    
+    void merge(const DropLog &_drops) {
+        if (_drops.empty() == true) {
+            return;
+        }
+        
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &station : _drops.m_stations) {
+            auto &counters = stationCounters(station.m_station);
+            for (size_t i = 0; i < DROP_REASONS; i++) {
+                if (station.m_counts[i] == 0) {
+                    continue;
+                }
+                
+                if (counters.second[i] == nullptr) {
+                    counters.second[i] = &m_registry.counter("ais_station_dropped_total",
+                                                             "station=\"" + counters.first + "\",reason=\"" + dropReasonName(i) + "\"",
+                                                             "Input dropped per source station and reason (all stages).");
+                }
+                
+                m_stage[i]->add(station.m_counts[i]);
+                counters.second[i]->add(station.m_counts[i]);
+            }
+        }
+    }
+    
+ private:
+    // counters of a station by label value (NOTE: lock has to be held)
+    std::pair<const std::string, Counters> &stationCounters(const StationStr &_station) {
+        std::string strStation(_station.data(), _station.size());
+        for (auto &c : strStation) {
+            c = ( (isalnum((unsigned char)c) != 0) || (c == '-') || (c == '.') || (c == ':') ) ? c : '_';
+        }
+        
+        strStation = strStation.empty() ? "unknown" : strStation;
+        if ( (m_stations.size() >= MAX_DROP_STATIONS) &&
+             (m_stations.count(strStation) == 0) )
+        {
+            strStation = "other";
+        }
+        
+        return *m_stations.emplace(strStation, Counters{}).first;
+    }
+    
+ private:
+    MetricsRegistry                     &m_registry;
+    Counters                            m_stage;
+    std::mutex                          m_mutex;
+    std::map<std::string, Counters>     m_stations;
+};
+
+
+/*
+    Chunk latency from the stage timestamps (see ChunkTrace), recorded when a chunk reaches the sinks.
+    Per segment between two stage boundaries and end-to-end (first sentence read to sink), in nanoseconds, with
+    estimated p50/p99/p999 exported as gauges. Latency is per chunk, i.e. that of its oldest sentence.
+ */
+class LatencyMetrics
+{
+ protected:
+    static const size_t     SEGMENTS = TRACE_POINTS;      // one per stage boundary after the first, plus end-to-end
+    
+ public:
+    explicit LatencyMetrics(MetricsRegistry &_registry)
+        :m_dTicksPerNs(traceTicksPerNs())
+    {
+        static const std::array<const char*, SEGMENTS> NAMES = {{
+            "input", "fragment_queue", "fragments", "message_queue", "messages", "payload_queue", "end_to_end"
+        }};
+        
+        static const std::array<std::pair<double, const char*>, 3> QUANTILES = {{
+            {0.5, "0.5"}, {0.99, "0.99"}, {0.999, "0.999"}
+        }};
+        
+        for (size_t i = 0; i < SEGMENTS; i++) {
+            std::string strLabels = std::string("segment=\"") + NAMES[i] + "\"";
+            m_segments[i] = &_registry.histogram("ais_latency_ns", strLabels, "Chunk latency per pipeline segment (ns).");
+            
+            MetricHistogram *pHistogram = m_segments[i];
+            for (auto &quantile : QUANTILES) {
+                double dQuantile = quantile.first;
+                _registry.gauge("ais_latency_quantile_ns", strLabels + ",quantile=\"" + quantile.second + "\"",
+                                "Estimated chunk latency quantile per pipeline segment (ns).",
+                                [pHistogram, dQuantile]{return (double)pHistogram->quantile(dQuantile);});
+            }
+        }
+    }
+    
+    // record a chunk handed to the sinks now
+    void record(const ChunkTrace &_trace) {
+        uint64_t uSink = traceTicks();
+        for (size_t i = 1; i < TRACE_POINTS; i++) {
+            uint64_t uEnd = (i < TRACE_SINK) ? _trace.m_ticks[i] : uSink;
+            m_segments[i - 1]->record(nanoseconds(_trace.m_ticks[i - 1], uEnd));
+        }
+        
+        m_segments[SEGMENTS - 1]->record(nanoseconds(_trace.m_ticks[TRACE_ARRIVAL], uSink));
+    }
+    
+    // end-to-end latency estimate (ns)
+    uint64_t endToEnd(double _dQuantile) const {
+        return m_segments[SEGMENTS - 1]->quantile(_dQuantile);
+    }
+    
+ private:
+    uint64_t nanoseconds(uint64_t _uStart, uint64_t _uEnd) const {
+        return (_uEnd > _uStart) ? (uint64_t)((_uEnd - _uStart) / m_dTicksPerNs) : 0;
+    }
+    
+ private:
+    double                                      m_dTicksPerNs;
+    std::array<MetricHistogram*, SEGMENTS>      m_segments;
+};
+
+
+/*
+    Input stage state kept between processNmeaData calls.
+    The current chunk is topped up across calls and pushed when it is full, or once the flush deadline has
+    passed since its first fragment was added (bounded latency on quiet live feeds).
+    Chunks are numbered from m_uSequence; an optional chunk size controller sets the chunk fill target.
+    With stage metrics, every chunk pushed is counted (fragments out); with drop metrics, lines that could not be
+    read are counted by reason (merged whenever a chunk is due).
+ */
+struct NmeaInputState
+{
+    using Clock = std::chrono::steady_clock;
+    
+    explicit NmeaInputState(const std::chrono::microseconds &_flushDeadline = std::chrono::microseconds(5000))
+        :m_uSequence(0),
+         m_pController(nullptr),
+         m_flushDeadline(_flushDeadline),
+         m_pMetrics(nullptr),
+         m_pDrops(nullptr)
+    {}
+    
+    std::unique_ptr<Fragments>      m_pFragments;       // current (partial) chunk
+    Clock::time_point               m_tsChunk;          // time first fragment was added to current chunk
+    uint64_t                        m_uSequence;        // next chunk sequence number
+    ChunkSizeController             *m_pController;
+    std::chrono::microseconds       m_flushDeadline;
+    StageMetrics                    *m_pMetrics;
+    DropMetrics                     *m_pDrops;
+    DropLog                         m_drops;            // drops since last merge
+};
+
+
+/*
+    Push current input chunk if it is not empty and forced or past its flush deadline.
+    Returns true if a chunk was pushed.
+    
+    QueueFragments has to be a compatible container holding Fragments (defined above).
+ */
+template <typename QueueFragments>
+bool flushNmeaData(QueueFragments &_fragmentQueue, NmeaInputState &_input, bool _bForce)
+{
+    if ( (_input.m_pDrops != nullptr) &&
+         (_input.m_drops.empty() == false) )
+    {
+        _input.m_pDrops->merge(_input.m_drops);
+        _input.m_drops.clear();
+    }
+    
+    auto &pFragments = _input.m_pFragments;
+    if ( (pFragments == nullptr) ||
+         (pFragments->empty() == true) )
+    {
+        return false;
+    }
+    
+    auto latency = NmeaInputState::Clock::now() - _input.m_tsChunk;
+    if ( (_bForce == false) &&
+         (latency < _input.m_flushDeadline) )
+    {
+        return false;
+    }
+    
+    if (_input.m_pController != nullptr) {
+        _input.m_pController->update(_fragmentQueue.size(), _fragmentQueue.maxSize(), latency);
+    }
+    
+    if (_input.m_pMetrics != nullptr) {
+        _input.m_pMetrics->record(0, pFragments->size());
+    }
+    
+    pFragments->m_uSequence = _input.m_uSequence++;
+    AIS_TRACE_STAMP(*pFragments, TRACE_INPUT);
+    _fragmentQueue.push(std::move(pFragments));
+    return true;
+}
+
+
 /*
     Process NMEA raw input data.
-    Processes only one chunk of data at a time.
-    Returns the number of bytes processed from the input.
+    Returns the number of bytes processed from the input (a partial last line is left for the next call).
     
+    Full chunks are pushed as they fill up; the last partial chunk is kept in the input state and only pushed
+    once its flush deadline has passed (see flushNmeaData).
+    With a chunk size controller, chunks are filled up to the controller target and the controller is
+    updated with the output queue size and the time taken to fill each chunk.
     QueueFragments has to be a compatible container holding Fragments (defined above).
  */
 template <typename QueueFragments, typename NmeaData>
-size_t processNmeaData(QueueFragments &_fragmentQueue, const NmeaData &_nmeaData)
+size_t processNmeaData(QueueFragments &_fragmentQueue, const NmeaData &_nmeaData, NmeaInputState &_input)
 {
     // process data
     char *pData = const_cast<char*>(_nmeaData.data());
     char *pEnd = pData + _nmeaData.size();
-    std::unique_ptr<Fragments> pFragments;
+    auto &pFragments = _input.m_pFragments;
     
     while (pData < pEnd) {
         if (pFragments == nullptr) {
             pFragments = std::make_unique<Fragments>();
+            if (_input.m_pController != nullptr) {
+                pFragments->setTarget(_input.m_pController->target());
+            }
         }
         
+        // line end (a last line without one is read up to the end of data)
+        char *pLine = pData;
+        char *pLineEnd = (char*)memchr(pData, '\n', pEnd - pData);
+        char *pLimit = (pLineEnd != nullptr) ? pLineEnd + 1 : pEnd;
+        
         // process optional header
         auto &fragment = pFragments->push_back();
-        size_t n = readHeader(fragment, pData, pEnd - pData);
+        size_t n = readHeader(fragment, pData, pLimit - pData);
         pData += n;
 
         // skip '!' and '$'
         pData = (*pData == '!') ? pData + 1 : pData;
         pData = (*pData == '$') ? pData + 1 : pData;
+        char *pSentence = pData;
 
-        n = readSentence(fragment, pData, pEnd - pData);
+        n = readSentence(fragment, pData, pLimit - pData);
         if (n > 0) {
             // read EOLs
             pData += n;
             pData = ((pData < pEnd) && (*pData == '\r')) ? pData + 1 : pData;
             pData = ((pData < pEnd) && (*pData == '\n')) ? pData + 1 : pData;
             
+            if (pFragments->size() == 1) {
+                _input.m_tsChunk = NmeaInputState::Clock::now();
+                AIS_TRACE_STAMP(*pFragments, TRACE_ARRIVAL);
+            }
+            
             // try to output full chunk
             if (pFragments->full() == true) {
-                _fragmentQueue.push(std::move(pFragments));
+                flushNmeaData(_fragmentQueue, _input, true);
             }
         }
         else {
@@ -62,112 +422,393 @@ size_t processNmeaData(QueueFragments &_fragmentQueue, const NmeaData &_nmeaData
             pFragments->pop_back();
             
             // skip to next line
-            auto pNewData = (char*)memchr(pData, '\n', pEnd - pData);
-            if (pNewData != nullptr) {
-                pData = pNewData + 1;
+            if (pLineEnd != nullptr) {
+                // count dropped line (not empty lines)
+                if ( (_input.m_pDrops != nullptr) &&
+                     (pLineEnd - pLine > 1) )
+                {
+                    _input.m_drops.add(sentenceDropReason(pLine, pSentence, pLineEnd - pLine), fragment.m_station);
+                }
+                
+                pData = pLineEnd + 1;
             }
             
-            // end of data reached
+            // end of data reached (keep partial line, including its header, for next call)
             else {
+                pData = pLine;
                 break;
             }
         }
     }
 
-    // output last chunk
-    if ( (pFragments != nullptr) &&
-         (pFragments->empty() == false) )
-    {
-        _fragmentQueue.push(std::move(pFragments));
-    }
+    // output last chunk if it is due
+    flushNmeaData(_fragmentQueue, _input, false);
     
     return pData - _nmeaData.data();
 }
 
 
+/*
+    Process NMEA raw input data.
+    Processes only one chunk of data at a time (all fragments are pushed before returning).
+    Returns the number of bytes processed from the input.
+    
+    Output chunks are numbered from _uSequence (incremented for every chunk pushed).
+    QueueFragments has to be a compatible container holding Fragments (defined above).
+ */
+template <typename QueueFragments, typename NmeaData>
+size_t processNmeaData(QueueFragments &_fragmentQueue, const NmeaData &_nmeaData, uint64_t &_uSequence, ChunkSizeController *_pController)
+{
+    NmeaInputState input;
+    input.m_uSequence = _uSequence;
+    input.m_pController = _pController;
+    
+    size_t n = processNmeaData(_fragmentQueue, _nmeaData, input);
+    flushNmeaData(_fragmentQueue, input, true);
+    
+    _uSequence = input.m_uSequence;
+    return n;
+}
+
+
+/* Process NMEA raw input data (fixed size chunks). */
+template <typename QueueFragments, typename NmeaData>
+size_t processNmeaData(QueueFragments &_fragmentQueue, const NmeaData &_nmeaData, uint64_t &_uSequence)
+{
+    return processNmeaData(_fragmentQueue, _nmeaData, _uSequence, nullptr);
+}
+
+
+/* Process NMEA raw input data (chunks numbered per calling thread). */
+template <typename QueueFragments, typename NmeaData>
+size_t processNmeaData(QueueFragments &_fragmentQueue, const NmeaData &_nmeaData)
+{
+    static thread_local uint64_t uSequence = 0;
+    return processNmeaData(_fragmentQueue, _nmeaData, uSequence);
+}
+
+
+/*
+    Process one chunk of fragments into a chunk of messages.
+    Returns the number of fragments processed.
+    
+    Chunks from the same input have to be processed in order and with the same reassembly state.
+    Dropped fragments are counted in the optional drop log.
+ */
+inline size_t processFragmentsChunk(Messages &_messages, const Fragments &_fragments, MultiLineState &_state, DropLog *_pDrops = nullptr)
+{
+    AIS_TRACE_COPY(_messages, _fragments);
+    AIS_TRACE_STAMP(_messages, TRACE_FRAGMENTS_START);
+    
+    size_t count = 0;
+    for (auto &frg : _fragments) {
+        assert(_messages.full() == false);
+        auto &message = _messages.push_back();
+        if (processSentence(message, frg, _state, _pDrops) == false) {
+            _messages.pop_back();
+        }
+#if AIS_RETAIN_RAW
+        else {
+            retainRaw(_messages, message, frg, _state);
+        }
+#endif
+        
+        count++;
+    }
+    
+    _messages.m_uSequence = _fragments.m_uSequence;
+    AIS_TRACE_STAMP(_messages, TRACE_FRAGMENTS_END);
+    return count;
+}
+
+
+/*
+    Process one chunk of fragments into a chunk of messages, with several threads working on the same input.
+    CRC checks and single sentence messages run in parallel; multi-sentence reassembly runs in chunk
+    sequence order through the gate (shared reassembly state). Messages keep the position of the fragment that
+    completes them (same output as the single threaded version): a slot is reserved for every last fragment in the
+    first pass and filled behind the gate; slots left empty (incomplete messages) are compacted afterwards.
+    Returns the number of fragments processed.
+ */
+inline size_t processFragmentsChunk(Messages &_messages, const Fragments &_fragments, MultiLineState &_state, SequenceGate &_gate, DropLog *_pDrops = nullptr)
+{
+    AIS_TRACE_COPY(_messages, _fragments);
+    AIS_TRACE_STAMP(_messages, TRACE_FRAGMENTS_START);
+    
+    // multi-sentence fragments: fragment index, message position and whether a slot was reserved there
+    std::array<uint16_t, AIS_CHUNK_SIZE> multiLine;
+    std::array<uint16_t, AIS_CHUNK_SIZE> positions;
+    std::array<bool, AIS_CHUNK_SIZE> reserved;
+    size_t uMultiLine = 0;
+    
+    for (size_t i = 0; i < _fragments.size(); i++) {
+        const auto &frg = _fragments.begin()[i];
+        if (checkSentence(frg, _pDrops) == false) {
+            continue;
+        }
+        
+        assert(_messages.full() == false);
+        if (frg.m_uFragmentCount == 1) {
+            auto &message = _messages.push_back();
+            processSingleLineSentence(message, frg);
+#if AIS_RETAIN_RAW
+            retainRaw(_messages, message, frg, _state);
+#endif
+        }
+        else {
+            multiLine[uMultiLine] = (uint16_t)i;
+            positions[uMultiLine] = (uint16_t)_messages.size();
+            reserved[uMultiLine] = (frg.m_uFragmentNum == frg.m_uFragmentCount);
+            if (reserved[uMultiLine] == true) {
+                _messages.push_back();
+            }
+            
+            uMultiLine++;
+        }
+    }
+    
+    std::array<uint16_t, AIS_CHUNK_SIZE> empty;                 // reserved slots left empty (ascending)
+    size_t uEmpty = 0;
+    std::vector<std::pair<uint16_t, NmeaMsg>> unreserved;       // completed by other than the last fragment (inconsistent counts)
+    
+    _gate.enter(_fragments.m_uSequence);
+    for (size_t i = 0; i < uMultiLine; i++) {
+        const auto &frg = _fragments.begin()[multiLine[i]];
+        if (reserved[i] == true) {
+            auto &message = _messages.begin()[positions[i]];
+            if (processMultiLineSentence(message, frg, _state, _pDrops) == false) {
+                empty[uEmpty++] = positions[i];
+            }
+#if AIS_RETAIN_RAW
+            else {
+                retainRaw(_messages, message, frg, _state);
+            }
+#endif
+        }
+        else {
+            NmeaMsg message;
+            if (processMultiLineSentence(message, frg, _state, _pDrops) == true) {
+#if AIS_RETAIN_RAW
+                retainRaw(_messages, message, frg, _state);
+#endif
+                unreserved.emplace_back(positions[i], message);
+            }
+        }
+    }
+    
+    _gate.leave();
+    
+    if (unreserved.empty() == false) {
+        // rare, so rebuild the chunk: unreserved messages go in front of the message at their position
+        std::vector<NmeaMsg> messages(_messages.begin(), _messages.end());
+        size_t uNext = 0;
+        size_t uNextEmpty = 0;
+        _messages.clear();
+        for (size_t i = 0; i <= messages.size(); i++) {
+            while ( (uNext < unreserved.size()) && (unreserved[uNext].first == i) ) {
+                _messages.push_back() = unreserved[uNext++].second;
+            }
+            
+            if ( (uNextEmpty < uEmpty) && (empty[uNextEmpty] == i) ) {
+                uNextEmpty++;
+            }
+            else if (i < messages.size()) {
+                _messages.push_back() = messages[i];
+            }
+        }
+    }
+    else if (uEmpty > 0) {
+        // drop empty slots, keeping the order of the rest
+        size_t uOut = empty[0];
+        size_t uNextEmpty = 0;
+        for (size_t i = empty[0]; i < _messages.size(); i++) {
+            if ( (uNextEmpty < uEmpty) && (empty[uNextEmpty] == i) ) {
+                uNextEmpty++;
+            }
+            else {
+                _messages.begin()[uOut++] = _messages.begin()[i];
+            }
+        }
+        
+        while (_messages.size() > uOut) {
+            _messages.pop_back();
+        }
+    }
+    
+    _messages.m_uSequence = _fragments.m_uSequence;
+    AIS_TRACE_STAMP(_messages, TRACE_FRAGMENTS_END);
+    return _fragments.size();
+}
+
+
+/*
+    Process one chunk of messages into a chunk of decoded payloads.
+    Returns the number of messages processed.
+    Messages without payload bits are counted in the optional drop log (station unknown at this stage).
+ */
+inline size_t processMessagesChunk(Payloads &_payloads, const Messages &_messages, DropLog *_pDrops = nullptr)
+{
+    AIS_TRACE_COPY(_payloads, _messages);
+    AIS_TRACE_STAMP(_payloads, TRACE_MESSAGES_START);
+    
+    size_t count = 0;
+    for (auto &msg : _messages) {
+        assert(_payloads.full() == false);
+        auto &payload = _payloads.push_back();
+        if (decodeAscii(payload, msg) == 0) {
+            // nothing decoded, so rewind
+            _payloads.pop_back();
+            
+            if (_pDrops != nullptr) {
+                _pDrops->add(DROP_EMPTY_PAYLOAD, StationStr());
+            }
+        }
+        
+        count++;
+    }
+    
+#if AIS_RETAIN_RAW
+    _payloads.m_pRaw = _messages.m_pRaw;
+#endif
+    _payloads.m_uSequence = _messages.m_uSequence;
+    AIS_TRACE_STAMP(_payloads, TRACE_MESSAGES_END);
+    return count;
+}
+
+
 /*
     Process fragments and produce messages.
-    Stops when output queue is full.
+    Blocks while the input queue is empty; returns after MAX_PROC_COUNT chunks or once the input queue is
+    finished (closed and drained, see BlockingQueue::close()).
     Returns the number of fragments processed.
     
+    Fragment chunks are popped and message chunks pushed in batches of up to AIS_BATCH_SIZE.
+    Empty output chunks are passed on as well, so that sequence numbers downstream have no gaps.
+    Several threads may run this on the same queues if they share the reassembly state and a sequence gate.
+    With stage metrics, fragments in and messages out are counted per chunk (and performance counters if the stage
+    metrics have them); with drop metrics, dropped fragments.
     QueueFragments has to be a compatible container holding Fragments (defined above).
     QueueMessages has to be a compatible container holding Messages (defined above).
 */
 template <typename QueueMessages, typename QueueFragments>
-size_t processFragments(QueueMessages &_messageQueue, QueueFragments &_fragmentQueue)
+size_t processFragments(QueueMessages &_messageQueue, QueueFragments &_fragmentQueue, MultiLineState &_state, SequenceGate *_pGate, StageMetrics *_pMetrics = nullptr, DropMetrics *_pDrops = nullptr)
 {
+    std::array<std::unique_ptr<Fragments>, AIS_BATCH_SIZE> fragmentsBatch;
+    std::array<std::unique_ptr<Messages>, AIS_BATCH_SIZE> messagesBatch;
+    DropLog drops;
+    DropLog *pDrops = (_pDrops != nullptr) ? &drops : nullptr;
+    
     size_t count = 0;
-    for (int i = 0; i < MAX_PROC_COUNT; i++) {
-        auto pFragments = _fragmentQueue.pop();
-        if (pFragments == nullptr) {
+    for (int i = 0; i < MAX_PROC_COUNT; ) {
+        size_t n = _fragmentQueue.pop_n(fragmentsBatch.data(), fragmentsBatch.size());
+        if (n == 0) {
             break;
         }
 
-        auto pMessages = std::make_unique<Messages>();
-        auto &fragments = *pFragments;
-        for (auto &frg : fragments) {
-            assert(pMessages->full() == false);
-            auto &message = pMessages->push_back();
-            if (processSentence(message, frg) == false) {
-                pMessages->pop_back();
+        for (size_t j = 0; j < n; j++) {
+            PerfScope perf((_pMetrics != nullptr) ? _pMetrics->m_pPerf : nullptr);
+            auto pMessages = std::make_unique<Messages>();
+            if (_pGate != nullptr) {
+                count += processFragmentsChunk(*pMessages, *fragmentsBatch[j], _state, *_pGate, pDrops);
+            }
+            else {
+                count += processFragmentsChunk(*pMessages, *fragmentsBatch[j], _state, pDrops);
+            }
+            
+            if (_pMetrics != nullptr) {
+                _pMetrics->record(fragmentsBatch[j]->size(), pMessages->size());
             }
             
-            count++;
+            if (drops.empty() == false) {
+                _pDrops->merge(drops);
+                drops.clear();
+            }
+            
+            fragmentsBatch[j].reset();
+            messagesBatch[j] = std::move(pMessages);
         }
 
-        if ( (pMessages != nullptr) &&
-             (pMessages->empty() == false) )
-        {
-            _messageQueue.push(std::move(pMessages));
-        }
+        _messageQueue.push_n(messagesBatch.data(), n);
+        i += (int)n;
     }
     
     return count;
 }
 
 
+/* Process fragments and produce messages (single thread per queue; reassembly state per calling thread). */
+template <typename QueueMessages, typename QueueFragments>
+size_t processFragments(QueueMessages &_messageQueue, QueueFragments &_fragmentQueue)
+{
+    static thread_local MultiLineState state;
+    return processFragments(_messageQueue, _fragmentQueue, state, nullptr);
+}
+
+
 /*
     Process messages and produce decoded payloads.
-    Stops when output queue is full.
+    Blocks while the input queue is empty; returns after MAX_PROC_COUNT chunks or once the input queue is
+    finished (closed and drained, see BlockingQueue::close()).
     Returns the number of messages processed.
     
+    Message chunks are popped and payload chunks pushed in batches of up to AIS_BATCH_SIZE.
+    Empty output chunks are passed on as well, so that sequence numbers downstream have no gaps.
+    _onPayloads is called on every payload chunk before it is pushed (e.g. payload filters).
+    With stage metrics, messages in and payloads out are counted per chunk (and performance counters if the stage
+    metrics have them); with drop metrics, dropped messages.
     QueueMessages has to be a compatible container holding Messages (defined above).
     QueuePayloads has to be a compatible container holding Payloads (defined above).
 */
-template <typename QueuePayloads, typename QueueMessages>
-size_t processMessages(QueuePayloads &_payloadQueue, QueueMessages &_messageQueue)
+template <typename QueuePayloads, typename QueueMessages, typename Func>
+size_t processMessages(QueuePayloads &_payloadQueue, QueueMessages &_messageQueue, Func &&_onPayloads, StageMetrics *_pMetrics = nullptr, DropMetrics *_pDrops = nullptr)
 {
+    std::array<std::unique_ptr<Messages>, AIS_BATCH_SIZE> messagesBatch;
+    std::array<std::unique_ptr<Payloads>, AIS_BATCH_SIZE> payloadsBatch;
+    DropLog drops;
+    DropLog *pDrops = (_pDrops != nullptr) ? &drops : nullptr;
+    
     size_t count = 0;
-    for (int i = 0; i < MAX_PROC_COUNT; i++) {
-        auto pMessages = _messageQueue.pop();
-        if (pMessages == nullptr) {
+    for (int i = 0; i < MAX_PROC_COUNT; ) {
+        size_t n = _messageQueue.pop_n(messagesBatch.data(), messagesBatch.size());
+        if (n == 0) {
             break;
         }
             
-        auto pPayloads = std::make_unique<Payloads>();
-        auto &messages = *pMessages;
-        for (auto &msg : messages) {
-            assert(pPayloads->full() == false);
-            auto &payload = pPayloads->push_back();
-            if (decodeAscii(payload, msg) == 0) {
-                // nothing decoded, so rewind
-                pPayloads->pop_back();
+        for (size_t j = 0; j < n; j++) {
+            PerfScope perf((_pMetrics != nullptr) ? _pMetrics->m_pPerf : nullptr);
+            auto pPayloads = std::make_unique<Payloads>();
+            count += processMessagesChunk(*pPayloads, *messagesBatch[j], pDrops);
+            _onPayloads(*pPayloads);
+            
+            if (_pMetrics != nullptr) {
+                _pMetrics->record(messagesBatch[j]->size(), pPayloads->size());
+            }
+            
+            if (drops.empty() == false) {
+                _pDrops->merge(drops);
+                drops.clear();
             }
             
-            count++;
+            messagesBatch[j].reset();
+            payloadsBatch[j] = std::move(pPayloads);
         }
 
-        if ( (pPayloads != nullptr) &&
-             (pPayloads->empty() == false) )
-        {
-            _payloadQueue.push(std::move(pPayloads));
-        }
+        _payloadQueue.push_n(payloadsBatch.data(), n);
+        i += (int)n;
     }
     
     return count;
 }
 
 
+/* Process messages and produce decoded payloads. */
+template <typename QueuePayloads, typename QueueMessages>
+size_t processMessages(QueuePayloads &_payloadQueue, QueueMessages &_messageQueue)
+{
+    return processMessages(_payloadQueue, _messageQueue, [](Payloads &){});
+}
+
+
 
 
 
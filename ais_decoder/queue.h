@@ -2,6 +2,7 @@
 #define AIS_QUEUE_H
 
 
+#include "metrics.h"
 
 #include <memory>
 #include <atomic>
@@ -9,6 +10,15 @@
 #include <string>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#endif
 
 using namespace std::literals::chrono_literals;
 
@@ -18,9 +28,28 @@ constexpr bool isPowerOf2(int _n) {
 }
 
 
+const size_t CACHE_LINE_SIZE = 64;
+const std::chrono::milliseconds WAIT_FOREVER = std::chrono::milliseconds::max();     // no timeout on blocking calls
+
+
+/* CPU hint for spin loops */
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+
 /*
    Ring buffer based queue (thread-safe for multiple producers and consumers).
    Pop and push operations may block.
+   
+   close() marks the end of the stream: nothing may be pushed afterwards, and once the remaining items have been
+   popped, blocked and later pops return immediately with nothing (see finished()).
+   
+   With metrics set (setMetrics()), time blocked in push and pop and the depth after every push are recorded.
  */
 template <typename payload_type, int N>
 class BlockingQueue
@@ -33,26 +62,29 @@ class BlockingQueue
     BlockingQueue()
         :m_uSize(0),
          m_uFront(0),
-         m_uBack(0)
+         m_uBack(0),
+         m_bClosed(false),
+         m_pMetrics(nullptr)
     {}
     
     template <typename T>
     bool push(T &&_p) {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_cv.wait(lock, [&]{return !full();});
+        waitNotFull(lock);
 
         m_array[m_uBack & MASK] = std::forward<T>(_p);
         m_uBack++;
         m_uSize = m_uBack - m_uFront;
+        recordDepth();
 
         lock.unlock();
         m_cv.notify_one();
         return true;
     }
     
-    bool pop(payload_type &_p, const std::chrono::milliseconds &_timeout = 5000ms) {
+    bool pop(payload_type &_p, const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
         std::unique_lock<std::mutex> lock(m_mutex);
-        if (m_cv.wait_for(lock, _timeout, [&]{return !empty();}) == false) {
+        if (waitNotEmpty(lock, _timeout) == false) {
             return false;
         }
 
@@ -65,9 +97,9 @@ class BlockingQueue
         return true;
     }
     
-    payload_type pop(const std::chrono::milliseconds &_timeout = 5000ms) {
+    payload_type pop(const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
         std::unique_lock<std::mutex> lock(m_mutex);
-        if (m_cv.wait_for(lock, _timeout, [&]{return !empty();}) == false) {
+        if (waitNotEmpty(lock, _timeout) == false) {
             return payload_type{};
         }
 
@@ -80,10 +112,88 @@ class BlockingQueue
         return p;
     }
     
+    // push all _n items (blocking while full); takes the lock and wakes consumers once per batch that fits
+    size_t push_n(payload_type *_p, size_t _n) {
+        size_t count = 0;
+        while (count < _n) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            waitNotFull(lock);
+            count += pushAvailable(_p + count, _n - count);
+            
+            lock.unlock();
+            m_cv.notify_all();
+        }
+        
+        return count;
+    }
+    
+    // push as many of the _n items as fit without blocking; returns the number of items pushed
+    size_t try_push_n(payload_type *_p, size_t _n) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        size_t count = pushAvailable(_p, _n);
+        
+        lock.unlock();
+        if (count > 0) {
+            m_cv.notify_all();
+        }
+        
+        return count;
+    }
+    
+    // pop up to _n items (blocking until at least one is available); returns the number of items popped
+    size_t pop_n(payload_type *_p, size_t _n, const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (waitNotEmpty(lock, _timeout) == false) {
+            return 0;
+        }
+        
+        size_t count = popAvailable(_p, _n);
+        
+        lock.unlock();
+        m_cv.notify_all();
+        return count;
+    }
+    
+    // pop up to _n items without blocking; returns the number of items popped
+    size_t try_pop_n(payload_type *_p, size_t _n) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        size_t count = popAvailable(_p, _n);
+        
+        lock.unlock();
+        if (count > 0) {
+            m_cv.notify_all();
+        }
+        
+        return count;
+    }
+    
+    // end of stream (wakes up all blocked consumers)
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bClosed = true;
+        }
+        
+        m_cv.notify_all();
+    }
+    
+    bool closed() const {
+        return m_bClosed;
+    }
+    
+    // closed and drained
+    bool finished() const {
+        return (m_bClosed == true) && (empty() == true);
+    }
+    
     bool empty() const {
         return m_uSize == 0;
     }
     
+    size_t maxSize() const {
+        return (size_t)N;
+    }
+    
     bool full() const {
         return m_uSize >= N;
     }
@@ -92,6 +202,69 @@ class BlockingQueue
         return m_uSize;
     }
     
+    // record wait times and depth (set before the queue is used; nullptr to stop recording)
+    void setMetrics(QueueMetrics *_pMetrics) {
+        m_pMetrics = _pMetrics;
+    }
+    
+ private:
+    // NOTE: lock has to be held
+    void waitNotFull(std::unique_lock<std::mutex> &_lock) {
+        if (full() == true) {
+            MetricTimer timer((m_pMetrics != nullptr) ? &m_pMetrics->m_pushWait : nullptr);
+            m_cv.wait(_lock, [&]{return !full();});
+        }
+    }
+    
+    // wait for an item; returns false on timeout or when closed and drained
+    bool waitNotEmpty(std::unique_lock<std::mutex> &_lock, const std::chrono::milliseconds &_timeout) {
+        auto ready = [&]{return (empty() == false) || (m_bClosed == true);};
+        if (ready() == true) {
+            return empty() == false;
+        }
+        
+        MetricTimer timer((m_pMetrics != nullptr) ? &m_pMetrics->m_popWait : nullptr);
+        if (_timeout == WAIT_FOREVER) {
+            m_cv.wait(_lock, ready);
+        }
+        else if (m_cv.wait_for(_lock, _timeout, ready) == false) {
+            return false;
+        }
+        
+        return empty() == false;
+    }
+    
+    void recordDepth() {
+        if (m_pMetrics != nullptr) {
+            m_pMetrics->m_depth.record(size());
+        }
+    }
+    
+    // NOTE: lock has to be held
+    size_t pushAvailable(payload_type *_p, size_t _n) {
+        size_t count = std::min(_n, (size_t)(N - (m_uBack - m_uFront)));
+        for (size_t i = 0; i < count; i++) {
+            m_array[m_uBack & MASK] = std::move(_p[i]);
+            m_uBack++;
+        }
+        
+        m_uSize = m_uBack - m_uFront;
+        recordDepth();
+        return count;
+    }
+    
+    // NOTE: lock has to be held
+    size_t popAvailable(payload_type *_p, size_t _n) {
+        size_t count = std::min(_n, (size_t)(m_uBack - m_uFront));
+        for (size_t i = 0; i < count; i++) {
+            _p[i] = std::move(m_array[m_uFront & MASK]);
+            m_uFront++;
+        }
+        
+        m_uSize = m_uBack - m_uFront;
+        return count;
+    }
+    
  private:
     std::array<payload_type, N>    m_array;
     std::mutex                     m_mutex;
@@ -99,6 +272,583 @@ class BlockingQueue
     std::atomic<uint32_t>          m_uSize;
     uint32_t                       m_uFront;
     uint32_t                       m_uBack;
+    std::atomic<bool>              m_bClosed;
+    QueueMetrics                   *m_pMetrics;
+};
+
+
+
+/*
+    Spin-then-sleep wait helper for the lock-free queues.
+    Waiters spin for a while (not on single CPU machines, where the notifier cannot run meanwhile) and then sleep
+    on a futex (Linux) or poll with short sleeps (other platforms).
+    Notifiers only make a system call when waiters went to sleep since the last wake up: the notifier that wakes
+    them resets the sleeper count, so a producer does not call into the kernel for every item it pushes until
+    the woken consumer actually runs.
+ */
+class IdleWaiter
+{
+ protected:
+    static const int        SPIN_COUNT = 1024;
+    
+ public:
+    IdleWaiter()
+        :m_uEpoch(0),
+         m_uSleepers(0)
+    {}
+    
+    // wait until _ready() returns true or the timeout expires (WAIT_FOREVER for no timeout)
+    template <typename Pred>
+    bool wait(Pred &&_ready, const std::chrono::milliseconds &_timeout) {
+        static const int iSpinCount = (std::thread::hardware_concurrency() > 1) ? SPIN_COUNT : 0;
+        for (int i = 0; i < iSpinCount; i++) {
+            if (_ready() == true) {
+                return true;
+            }
+            
+            cpuRelax();
+        }
+        
+        bool bForever = (_timeout == WAIT_FOREVER);
+        auto deadline = std::chrono::steady_clock::now() + (bForever ? 0ms : _timeout);
+        for (;;) {
+            // registered until the next notify() (not deregistered on return: at most one extra wake up)
+            m_uSleepers.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint32_t uEpoch = m_uEpoch.load(std::memory_order_acquire);
+            
+            if (_ready() == true) {
+                return true;
+            }
+            
+            auto now = std::chrono::steady_clock::now();
+            if ( (bForever == false) &&
+                 (now >= deadline) )
+            {
+                return false;
+            }
+            
+            auto timeout = bForever ? std::chrono::nanoseconds::max() : std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now);
+            sleep(uEpoch, timeout);
+        }
+    }
+    
+    // wake up all sleeping waiters (called after publishing state change)
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if ( (m_uSleepers.load(std::memory_order_relaxed) > 0) &&
+             (m_uSleepers.exchange(0) > 0) )
+        {
+            m_uEpoch.fetch_add(1, std::memory_order_release);
+            wake();
+        }
+    }
+    
+ private:
+    // sleep until woken up, the epoch changed or the timeout expired (nanoseconds::max() for no timeout)
+    void sleep(uint32_t _uEpoch, const std::chrono::nanoseconds &_timeout) {
+#ifdef __linux__
+        struct timespec ts;
+        ts.tv_sec = (time_t)(_timeout.count() / 1000000000);
+        ts.tv_nsec = (long)(_timeout.count() % 1000000000);
+        bool bForever = (_timeout == std::chrono::nanoseconds::max());
+        syscall(SYS_futex, (uint32_t*)&m_uEpoch, FUTEX_WAIT_PRIVATE, _uEpoch, bForever ? nullptr : &ts, nullptr, 0);
+#else
+        if (m_uEpoch.load(std::memory_order_acquire) == _uEpoch) {
+            std::this_thread::sleep_for(std::min(_timeout, std::chrono::nanoseconds(100000)));
+        }
+#endif
+    }
+    
+    void wake() {
+#ifdef __linux__
+        syscall(SYS_futex, (uint32_t*)&m_uEpoch, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+    }
+    
+ private:
+    std::atomic<uint32_t>       m_uEpoch;
+    std::atomic<uint32_t>       m_uSleepers;
+};
+
+
+/*
+   Lock-free ring buffer based queue (single producer and single consumer only).
+   Same interface as BlockingQueue (including close()); pop and push operations may block (spin, then sleep).
+ */
+template <typename payload_type, int N>
+class SpscQueue
+{
+ static_assert(isPowerOf2(N), "Queue internal size should be a power of two.");
+ protected:
+    static const size_t     MASK = N-1;
+    
+ public:
+    SpscQueue()
+        :m_uFront(0),
+         m_uBackCache(0),
+         m_uBack(0),
+         m_uFrontCache(0),
+         m_bClosed(false),
+         m_pMetrics(nullptr)
+    {}
+    
+    template <typename T>
+    bool push(T &&_p) {
+        uint32_t uBack = m_uBack.load(std::memory_order_relaxed);
+        if (uBack - m_uFrontCache >= N) {
+            auto ready = [&]{
+                m_uFrontCache = m_uFront.load(std::memory_order_acquire);
+                return uBack - m_uFrontCache < N;
+            };
+            
+            if (ready() == false) {
+                MetricTimer timer(pushWait());
+                m_notFull.wait(ready, WAIT_FOREVER);
+            }
+        }
+        
+        m_array[uBack & MASK] = std::forward<T>(_p);
+        m_uBack.store(uBack + 1, std::memory_order_release);
+        m_notEmpty.notify();
+        recordDepth();
+        return true;
+    }
+    
+    bool pop(payload_type &_p, const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
+        uint32_t uFront = m_uFront.load(std::memory_order_relaxed);
+        if ( (uFront == m_uBackCache) &&
+             (waitNotEmpty(uFront, _timeout) == false) )
+        {
+            return false;
+        }
+        
+        _p = std::move(m_array[uFront & MASK]);
+        m_uFront.store(uFront + 1, std::memory_order_release);
+        m_notFull.notify();
+        return true;
+    }
+    
+    payload_type pop(const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
+        payload_type p{};
+        pop(p, _timeout);
+        return p;
+    }
+    
+    // push all _n items (blocking while full); publishes and wakes the consumer once per batch that fits
+    size_t push_n(payload_type *_p, size_t _n) {
+        size_t count = 0;
+        while (count < _n) {
+            size_t n = try_push_n(_p + count, _n - count);
+            if (n == 0) {
+                uint32_t uBack = m_uBack.load(std::memory_order_relaxed);
+                auto ready = [&]{
+                    m_uFrontCache = m_uFront.load(std::memory_order_acquire);
+                    return uBack - m_uFrontCache < N;
+                };
+                
+                MetricTimer timer(pushWait());
+                m_notFull.wait(ready, WAIT_FOREVER);
+            }
+            
+            count += n;
+        }
+        
+        return count;
+    }
+    
+    // push as many of the _n items as fit without blocking; returns the number of items pushed
+    size_t try_push_n(payload_type *_p, size_t _n) {
+        uint32_t uBack = m_uBack.load(std::memory_order_relaxed);
+        if (uBack - m_uFrontCache + _n > N) {
+            m_uFrontCache = m_uFront.load(std::memory_order_acquire);
+        }
+        
+        size_t count = std::min(_n, (size_t)(N - (uBack - m_uFrontCache)));
+        for (size_t i = 0; i < count; i++) {
+            m_array[(uBack + i) & MASK] = std::move(_p[i]);
+        }
+        
+        if (count > 0) {
+            m_uBack.store(uBack + (uint32_t)count, std::memory_order_release);
+            m_notEmpty.notify();
+            recordDepth();
+        }
+        
+        return count;
+    }
+    
+    // pop up to _n items (blocking until at least one is available); returns the number of items popped
+    size_t pop_n(payload_type *_p, size_t _n, const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
+        uint32_t uFront = m_uFront.load(std::memory_order_relaxed);
+        if ( (uFront == m_uBackCache) &&
+             (waitNotEmpty(uFront, _timeout) == false) )
+        {
+            return 0;
+        }
+        
+        return try_pop_n(_p, _n);
+    }
+    
+    // pop up to _n items without blocking; returns the number of items popped
+    size_t try_pop_n(payload_type *_p, size_t _n) {
+        uint32_t uFront = m_uFront.load(std::memory_order_relaxed);
+        if (m_uBackCache - uFront < _n) {
+            m_uBackCache = m_uBack.load(std::memory_order_acquire);
+        }
+        
+        size_t count = std::min(_n, (size_t)(m_uBackCache - uFront));
+        for (size_t i = 0; i < count; i++) {
+            _p[i] = std::move(m_array[(uFront + i) & MASK]);
+        }
+        
+        if (count > 0) {
+            m_uFront.store(uFront + (uint32_t)count, std::memory_order_release);
+            m_notFull.notify();
+        }
+        
+        return count;
+    }
+    
+    // end of stream (wakes up blocked consumer)
+    void close() {
+        m_bClosed.store(true, std::memory_order_release);
+        m_notEmpty.notify();
+    }
+    
+    bool closed() const {
+        return m_bClosed.load(std::memory_order_acquire);
+    }
+    
+    // closed and drained
+    bool finished() const {
+        return (closed() == true) && (empty() == true);
+    }
+    
+    bool empty() const {
+        return size() == 0;
+    }
+    
+    size_t maxSize() const {
+        return (size_t)N;
+    }
+    
+    bool full() const {
+        return size() >= N;
+    }
+    
+    size_t size() const {
+        return m_uBack.load(std::memory_order_acquire) - m_uFront.load(std::memory_order_acquire);
+    }
+    
+    // see BlockingQueue::setMetrics()
+    void setMetrics(QueueMetrics *_pMetrics) {
+        m_pMetrics = _pMetrics;
+    }
+    
+ private:
+    MetricHistogram *pushWait() const {
+        return (m_pMetrics != nullptr) ? &m_pMetrics->m_pushWait : nullptr;
+    }
+    
+    void recordDepth() {
+        if (m_pMetrics != nullptr) {
+            m_pMetrics->m_depth.record(size());
+        }
+    }
+    
+    // wait for an item; returns false on timeout or when closed and drained
+    bool waitNotEmpty(uint32_t _uFront, const std::chrono::milliseconds &_timeout) {
+        bool bItem = false;
+        auto ready = [&]{
+            bool bClosed = closed();    // check before items, so that the last items before close are not missed
+            m_uBackCache = m_uBack.load(std::memory_order_acquire);
+            bItem = (_uFront != m_uBackCache);
+            return bItem || bClosed;
+        };
+        
+        // re-check back first: a stale copy is not a wait
+        if (ready() == true) {
+            return bItem;
+        }
+        
+        MetricTimer timer((m_pMetrics != nullptr) ? &m_pMetrics->m_popWait : nullptr);
+        m_notEmpty.wait(ready, _timeout);
+        return bItem;
+    }
+    
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t>  m_uFront;          // consumer owned
+    uint32_t                                        m_uBackCache;      // consumer copy of back
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t>  m_uBack;           // producer owned
+    uint32_t                                        m_uFrontCache;     // producer copy of front
+    alignas(CACHE_LINE_SIZE) IdleWaiter             m_notEmpty;
+    alignas(CACHE_LINE_SIZE) IdleWaiter             m_notFull;
+    std::atomic<bool>                               m_bClosed;
+    QueueMetrics                                    *m_pMetrics;
+    alignas(CACHE_LINE_SIZE) std::array<payload_type, N>    m_array;
+};
+
+
+/*
+   Lock-free bounded ring buffer based queue (multiple producers and consumers; D. Vyukov's algorithm).
+   Same interface as BlockingQueue (including close()); pop and push operations may block (spin, then sleep).
+ */
+template <typename payload_type, int N>
+class MpmcQueue
+{
+ static_assert(isPowerOf2(N), "Queue internal size should be a power of two.");
+ protected:
+    static const size_t     MASK = N-1;
+    
+    struct Cell
+    {
+        std::atomic<size_t>     m_uSequence;
+        payload_type            m_data;
+    };
+    
+ public:
+    MpmcQueue()
+        :m_uBack(0),
+         m_uFront(0),
+         m_bClosed(false),
+         m_pMetrics(nullptr)
+    {
+        for (size_t i = 0; i < N; i++) {
+            m_array[i].m_uSequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    template <typename T>
+    bool push(T &&_p) {
+        if (tryPush(std::forward<T>(_p)) == false) {
+            auto ready = [&]{return tryPush(std::forward<T>(_p));};
+            MetricTimer timer(pushWait());
+            m_notFull.wait(ready, WAIT_FOREVER);
+        }
+        
+        m_notEmpty.notify();
+        recordDepth();
+        return true;
+    }
+    
+    bool pop(payload_type &_p, const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
+        if ( (tryPop(_p) == false) &&
+             (waitPop(_p, _timeout) == false) )
+        {
+            return false;
+        }
+        
+        m_notFull.notify();
+        return true;
+    }
+    
+    payload_type pop(const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
+        payload_type p{};
+        pop(p, _timeout);
+        return p;
+    }
+    
+    // push all _n items (blocking while full); wakes consumers once per batch that fits
+    size_t push_n(payload_type *_p, size_t _n) {
+        size_t count = 0;
+        while (count < _n) {
+            size_t n = try_push_n(_p + count, _n - count);
+            if (n == 0) {
+                auto ready = [&]{return tryPush(std::move(_p[count]));};
+                {
+                    MetricTimer timer(pushWait());
+                    m_notFull.wait(ready, WAIT_FOREVER);
+                }
+                
+                m_notEmpty.notify();
+                recordDepth();
+                n = 1;
+            }
+            
+            count += n;
+        }
+        
+        return count;
+    }
+    
+    // push as many of the _n items as fit without blocking; returns the number of items pushed
+    size_t try_push_n(payload_type *_p, size_t _n) {
+        size_t count = 0;
+        while ( (count < _n) &&
+                (tryPush(std::move(_p[count])) == true) )
+        {
+            count++;
+        }
+        
+        if (count > 0) {
+            m_notEmpty.notify();
+            recordDepth();
+        }
+        
+        return count;
+    }
+    
+    // pop up to _n items (blocking until at least one is available); returns the number of items popped
+    size_t pop_n(payload_type *_p, size_t _n, const std::chrono::milliseconds &_timeout = WAIT_FOREVER) {
+        if ( (_n == 0) ||
+             ( (tryPop(_p[0]) == false) &&
+               (waitPop(_p[0], _timeout) == false) ) )
+        {
+            return 0;
+        }
+        
+        size_t count = 1;
+        while ( (count < _n) &&
+                (tryPop(_p[count]) == true) )
+        {
+            count++;
+        }
+        
+        m_notFull.notify();
+        return count;
+    }
+    
+    // pop up to _n items without blocking; returns the number of items popped
+    size_t try_pop_n(payload_type *_p, size_t _n) {
+        size_t count = 0;
+        while ( (count < _n) &&
+                (tryPop(_p[count]) == true) )
+        {
+            count++;
+        }
+        
+        if (count > 0) {
+            m_notFull.notify();
+        }
+        
+        return count;
+    }
+    
+    // end of stream (wakes up blocked consumer)
+    void close() {
+        m_bClosed.store(true, std::memory_order_release);
+        m_notEmpty.notify();
+    }
+    
+    bool closed() const {
+        return m_bClosed.load(std::memory_order_acquire);
+    }
+    
+    // closed and drained
+    bool finished() const {
+        return (closed() == true) && (empty() == true);
+    }
+    
+    bool empty() const {
+        return size() == 0;
+    }
+    
+    size_t maxSize() const {
+        return (size_t)N;
+    }
+    
+    bool full() const {
+        return size() >= N;
+    }
+    
+    size_t size() const {
+        size_t uBack = m_uBack.load(std::memory_order_acquire);
+        size_t uFront = m_uFront.load(std::memory_order_acquire);
+        return uBack > uFront ? uBack - uFront : 0;
+    }
+    
+    // see BlockingQueue::setMetrics()
+    void setMetrics(QueueMetrics *_pMetrics) {
+        m_pMetrics = _pMetrics;
+    }
+    
+ private:
+    MetricHistogram *pushWait() const {
+        return (m_pMetrics != nullptr) ? &m_pMetrics->m_pushWait : nullptr;
+    }
+    
+    void recordDepth() {
+        if (m_pMetrics != nullptr) {
+            m_pMetrics->m_depth.record(size());
+        }
+    }
+    
+    // blocking pop; returns false on timeout or when closed and drained
+    bool waitPop(payload_type &_p, const std::chrono::milliseconds &_timeout) {
+        bool bItem = false;
+        auto ready = [&]{
+            bool bClosed = closed();    // check before items, so that the last items before close are not missed
+            bItem = tryPop(_p);
+            return bItem || bClosed;
+        };
+        
+        // an item published since the failed tryPop() is not a wait
+        if (ready() == true) {
+            return bItem;
+        }
+        
+        MetricTimer timer((m_pMetrics != nullptr) ? &m_pMetrics->m_popWait : nullptr);
+        m_notEmpty.wait(ready, _timeout);
+        return bItem;
+    }
+    
+    // non-blocking push (_p is only moved from on success)
+    template <typename T>
+    bool tryPush(T &&_p) {
+        size_t uPos = m_uBack.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = m_array[uPos & MASK];
+            size_t uSeq = cell.m_uSequence.load(std::memory_order_acquire);
+            intptr_t iDiff = (intptr_t)uSeq - (intptr_t)uPos;
+            
+            if (iDiff == 0) {
+                if (m_uBack.compare_exchange_weak(uPos, uPos + 1, std::memory_order_relaxed) == true) {
+                    cell.m_data = std::forward<T>(_p);
+                    cell.m_uSequence.store(uPos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (iDiff < 0) {
+                return false;   // full
+            }
+            else {
+                uPos = m_uBack.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    // non-blocking pop
+    bool tryPop(payload_type &_p) {
+        size_t uPos = m_uFront.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = m_array[uPos & MASK];
+            size_t uSeq = cell.m_uSequence.load(std::memory_order_acquire);
+            intptr_t iDiff = (intptr_t)uSeq - (intptr_t)(uPos + 1);
+            
+            if (iDiff == 0) {
+                if (m_uFront.compare_exchange_weak(uPos, uPos + 1, std::memory_order_relaxed) == true) {
+                    _p = std::move(cell.m_data);
+                    cell.m_uSequence.store(uPos + MASK + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (iDiff < 0) {
+                return false;   // empty
+            }
+            else {
+                uPos = m_uFront.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+ private:
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t>    m_uBack;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t>    m_uFront;
+    alignas(CACHE_LINE_SIZE) IdleWaiter             m_notEmpty;
+    alignas(CACHE_LINE_SIZE) IdleWaiter             m_notFull;
+    std::atomic<bool>                               m_bClosed;
+    QueueMetrics                                    *m_pMetrics;
+    alignas(CACHE_LINE_SIZE) std::array<Cell, N>    m_array;
 };
 
 
@@ -0,0 +1,258 @@
+#ifndef AIS_SCHEDULER_H
+#define AIS_SCHEDULER_H
+
+#include "affinity.h"
+#include "queue.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*
+    Work-stealing thread pool.
+    Each worker owns a deque of tasks: the owner pushes and pops at the back (LIFO, so that related work stays in cache),
+    idle workers steal from the front of the other deques (FIFO, oldest work first).
+    Idle workers spin and then sleep (see IdleWaiter), so an idle pool uses no CPU.
+    Workers can be pinned to a set of cpus (e.g. the cpus of one NUMA node, for a scheduler per socket).
+ */
+class TaskScheduler
+{
+ public:
+    using Task = std::function<void()>;
+
+ protected:
+    struct alignas(CACHE_LINE_SIZE) Worker
+    {
+        std::mutex          m_mutex;
+        std::deque<Task>    m_tasks;
+    };
+
+ public:
+    explicit TaskScheduler(size_t _uThreads = std::thread::hardware_concurrency(), const std::vector<int> &_cpus = {})
+        :m_cpus(_cpus),
+         m_uQueued(0),
+         m_uPending(0),
+         m_uNext(0),
+         m_bStop(false)
+    {
+        _uThreads = std::max(_uThreads, (size_t)1);
+        for (size_t i = 0; i < _uThreads; i++) {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+
+        for (size_t i = 0; i < _uThreads; i++) {
+            m_threads.emplace_back([this, i]{run(i);});
+        }
+    }
+
+    ~TaskScheduler() {
+        stop();
+    }
+
+    /*
+        Queue a task.
+        From a worker thread the task goes onto that worker's own deque; otherwise workers are picked round robin.
+     */
+    void spawn(Task _task) {
+        size_t uIndex = (workerIndex().first == this) ? workerIndex().second : (m_uNext++ % m_workers.size());
+        auto &worker = *m_workers[uIndex];
+
+        addPending();
+        {
+            std::lock_guard<std::mutex> lock(worker.m_mutex);
+            worker.m_tasks.push_back(std::move(_task));
+        }
+
+        m_uQueued++;
+        m_workIdle.notify();
+    }
+
+    // wait until at most _uMaxPending tasks are queued or running (e.g. for input back-pressure)
+    void wait(size_t _uMaxPending = 0) {
+        m_doneIdle.wait([&]{return m_uPending <= _uMaxPending;}, WAIT_FOREVER);
+    }
+
+    // finish queued tasks and stop all workers
+    void stop() {
+        if (m_threads.empty() == true) {
+            return;
+        }
+
+        wait();
+        m_bStop = true;
+        m_workIdle.notify();
+
+        for (auto &thread : m_threads) {
+            thread.join();
+        }
+
+        m_threads.clear();
+    }
+
+    size_t threadCount() const {
+        return m_workers.size();
+    }
+
+    size_t pending() const {
+        return m_uPending;
+    }
+
+ private:
+    friend class TaskStrand;
+
+    // account for work that is queued outside of the worker deques (see TaskStrand)
+    void addPending() {
+        m_uPending++;
+    }
+
+    void releasePending() {
+        m_uPending--;
+        m_doneIdle.notify();
+    }
+
+    // scheduler and worker index of calling thread
+    static std::pair<TaskScheduler*, size_t> &workerIndex() {
+        static thread_local std::pair<TaskScheduler*, size_t> index(nullptr, 0);
+        return index;
+    }
+
+    void run(size_t _uIndex) {
+        workerIndex() = std::make_pair(this, _uIndex);
+        setThreadAffinity(m_cpus);
+
+        Task task;
+        while (m_bStop == false) {
+            if ( (popTask(_uIndex, task) == true) ||
+                 (stealTask(_uIndex, task) == true) )
+            {
+                task();
+                task = nullptr;
+                releasePending();
+            }
+            else {
+                m_workIdle.wait([&]{return (m_uQueued > 0) || (m_bStop == true);}, WAIT_FOREVER);
+            }
+        }
+    }
+
+    // pop newest task from own deque
+    bool popTask(size_t _uIndex, Task &_task) {
+        auto &worker = *m_workers[_uIndex];
+        std::lock_guard<std::mutex> lock(worker.m_mutex);
+        if (worker.m_tasks.empty() == true) {
+            return false;
+        }
+
+        _task = std::move(worker.m_tasks.back());
+        worker.m_tasks.pop_back();
+        m_uQueued--;
+        return true;
+    }
+
+    // steal oldest task from another worker
+    bool stealTask(size_t _uIndex, Task &_task) {
+        for (size_t i = 1; i < m_workers.size(); i++) {
+            auto &worker = *m_workers[(_uIndex + i) % m_workers.size()];
+            std::unique_lock<std::mutex> lock(worker.m_mutex, std::try_to_lock);
+            if ( (lock.owns_lock() == true) &&
+                 (worker.m_tasks.empty() == false) )
+            {
+                _task = std::move(worker.m_tasks.front());
+                worker.m_tasks.pop_front();
+                m_uQueued--;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+ private:
+    std::vector<std::unique_ptr<Worker>>    m_workers;
+    std::vector<std::thread>                m_threads;
+    std::vector<int>                        m_cpus;         // worker affinity (all cpus if empty)
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t>    m_uQueued;      // tasks waiting in deques
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t>    m_uPending;     // tasks queued or running
+    std::atomic<size_t>                     m_uNext;
+    std::atomic<bool>                       m_bStop;
+    IdleWaiter                              m_workIdle;
+    IdleWaiter                              m_doneIdle;
+};
+
+
+/*
+    Runs tasks one at a time and in the order they were posted, on any worker of the scheduler.
+    Used for stages that keep state between chunks (e.g. multi-sentence reassembly) or sinks that are not thread-safe.
+    Strand state is shared with its queued drain task, so a strand may be destroyed once its own tasks have run.
+ */
+class TaskStrand
+{
+ protected:
+    static const int        MAX_TASKS_PER_RUN = 16;     // yield worker after this many tasks
+    
+    struct State
+    {
+        std::mutex                          m_mutex;
+        std::deque<TaskScheduler::Task>     m_tasks;
+        bool                                m_bRunning = false;
+    };
+
+ public:
+    explicit TaskStrand(TaskScheduler &_scheduler)
+        :m_scheduler(_scheduler),
+         m_pState(std::make_shared<State>())
+    {}
+
+    void post(TaskScheduler::Task _task) {
+        m_scheduler.addPending();
+
+        std::lock_guard<std::mutex> lock(m_pState->m_mutex);
+        m_pState->m_tasks.push_back(std::move(_task));
+
+        if (m_pState->m_bRunning == false) {
+            m_pState->m_bRunning = true;
+            spawnDrain(m_scheduler, m_pState);
+        }
+    }
+
+ private:
+    static void spawnDrain(TaskScheduler &_scheduler, const std::shared_ptr<State> &_pState) {
+        _scheduler.spawn([&_scheduler, _pState]{drain(_scheduler, _pState);});
+    }
+    
+    static void drain(TaskScheduler &_scheduler, const std::shared_ptr<State> &_pState) {
+        for (int i = 0; i < MAX_TASKS_PER_RUN; i++) {
+            TaskScheduler::Task task;
+            {
+                std::lock_guard<std::mutex> lock(_pState->m_mutex);
+                if (_pState->m_tasks.empty() == true) {
+                    _pState->m_bRunning = false;
+                    return;
+                }
+
+                task = std::move(_pState->m_tasks.front());
+                _pState->m_tasks.pop_front();
+            }
+
+            task();
+            task = nullptr;
+            _scheduler.releasePending();
+        }
+
+        // more work left, so reschedule to give other tasks a turn
+        spawnDrain(_scheduler, _pState);
+    }
+
+ private:
+    TaskScheduler               &m_scheduler;
+    std::shared_ptr<State>      m_pState;
+};
+
+
+
+#endif // #ifndef AIS_SCHEDULER_H
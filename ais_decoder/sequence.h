@@ -0,0 +1,84 @@
+#ifndef AIS_SEQUENCE_H
+#define AIS_SEQUENCE_H
+
+#include "queue.h"
+
+#include <atomic>
+#include <map>
+
+
+/*
+    Lets the threads of a parallel stage run a section in chunk sequence order.
+    Every sequence number (starting at 0) has to pass through the gate exactly once.
+ */
+class SequenceGate
+{
+ public:
+    SequenceGate()
+        :m_uNext(0)
+    {}
+
+    // block until it is the turn of the given sequence number
+    void enter(uint64_t _uSequence) {
+        m_waiter.wait([&]{return m_uNext == _uSequence;}, WAIT_FOREVER);
+    }
+
+    // pass turn on to the next sequence number
+    void leave() {
+        m_uNext++;
+        m_waiter.notify();
+    }
+
+ private:
+    std::atomic<uint64_t>   m_uNext;
+    IdleWaiter              m_waiter;
+};
+
+
+/*
+    Restores input order of chunks in front of a sink (single consumer only, not thread-safe).
+    Chunks are released in sequence order, starting at 0 and without gaps.
+ */
+template <typename payload_type>
+class ReorderBuffer
+{
+ public:
+    ReorderBuffer()
+        :m_uNext(0)
+    {}
+
+    void push(uint64_t _uSequence, payload_type &&_p) {
+        m_pending.emplace(_uSequence, std::move(_p));
+    }
+
+    // pop next chunk in sequence order; returns false if it has not arrived yet
+    bool pop(payload_type &_p) {
+        auto it = m_pending.begin();
+        if ( (it == m_pending.end()) ||
+             (it->first != m_uNext) )
+        {
+            return false;
+        }
+
+        _p = std::move(it->second);
+        m_pending.erase(it);
+        m_uNext++;
+        return true;
+    }
+
+    bool empty() const {
+        return m_pending.empty();
+    }
+
+    size_t size() const {
+        return m_pending.size();
+    }
+
+ private:
+    std::map<uint64_t, payload_type>    m_pending;
+    uint64_t                            m_uNext;
+};
+
+
+
+#endif // #ifndef AIS_SEQUENCE_H
@@ -0,0 +1,299 @@
+#ifndef AIS_SNAPSHOT_H
+#define AIS_SNAPSHOT_H
+
+#include "vessels.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+    Warm start snapshot of the vessel tables (VesselTable and VesselStaticCache).
+
+    File layout:
+    - header:       magic, version, record sizes, creation time, record counts
+    - vessels:      VesselState records (in table order, i.e. grouped by shard)
+    - static data:  VesselStatic records
+
+    Records are stored as in memory (like the store), the record sizes in the header reject snapshots of a
+    different layout. Snapshots are written to PATH.tmp, synced and renamed (and the directory synced), so an
+    interrupted write or a crash keeps the last one.
+ */
+const uint32_t AIS_SNAPSHOT_MAGIC       = 0x56534941;      // 'AISV'
+const uint32_t AIS_SNAPSHOT_VERSION     = 1;
+const size_t AIS_SNAPSHOT_LOAD_BATCH    = 4096;            // min records per load thread
+
+
+struct SnapshotHeader
+{
+    uint32_t    m_uMagic;
+    uint32_t    m_uVersion;
+    uint32_t    m_uVesselSize;          // sizeof(VesselState)
+    uint32_t    m_uStaticSize;          // sizeof(VesselStatic)
+    uint64_t    m_uCreated;             // unix time
+    uint64_t    m_uVessels;
+    uint64_t    m_uStatics;
+};
+
+
+/* fsync the directory of _strPath, so that a rename into it is durable */
+inline bool syncParentDirectory(const std::string &_strPath)
+{
+    size_t uSlash = _strPath.find_last_of('/');
+    std::string strDir = (uSlash == std::string::npos) ? "." : (uSlash == 0) ? "/" : _strPath.substr(0, uSlash);
+
+    int fd = open(strDir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool bOk = (fsync(fd) == 0);
+    close(fd);
+    return bOk;
+}
+
+
+/*
+    Write a snapshot of both tables. The vessel table is copied without locks and the static cache one shard at
+    a time, so updates go on while the snapshot is taken. Returns false if the file could not be written.
+ */
+inline bool writeVesselSnapshot(const std::string &_strPath, const VesselTable &_vessels, const VesselStaticCache &_statics)
+{
+    std::vector<VesselState> vessels = _vessels.snapshot();
+    std::vector<VesselStatic> statics = _statics.snapshot();
+
+    SnapshotHeader header;
+    header.m_uMagic = AIS_SNAPSHOT_MAGIC;
+    header.m_uVersion = AIS_SNAPSHOT_VERSION;
+    header.m_uVesselSize = sizeof(VesselState);
+    header.m_uStaticSize = sizeof(VesselStatic);
+    header.m_uCreated = (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    header.m_uVessels = vessels.size();
+    header.m_uStatics = statics.size();
+
+    std::string strTmpPath = _strPath + ".tmp";
+    FILE *pFile = fopen(strTmpPath.c_str(), "wb");
+    if (pFile == nullptr) {
+        return false;
+    }
+
+    // empty tables: no fwrite() with the (null) data of an empty vector
+    bool bOk = (fwrite(&header, sizeof(header), 1, pFile) == 1) &&
+               ( (vessels.empty() == true) || (fwrite(vessels.data(), sizeof(VesselState), vessels.size(), pFile) == vessels.size()) ) &&
+               ( (statics.empty() == true) || (fwrite(statics.data(), sizeof(VesselStatic), statics.size(), pFile) == statics.size()) ) &&
+               (fflush(pFile) == 0) &&
+               (fsync(fileno(pFile)) == 0);
+    bOk = (fclose(pFile) == 0) && bOk;
+
+    if ( (bOk == false) ||
+         (rename(strTmpPath.c_str(), _strPath.c_str()) != 0) )
+    {
+        remove(strTmpPath.c_str());
+        return false;
+    }
+
+    return syncParentDirectory(_strPath);
+}
+
+
+/*
+    Load a snapshot into the tables (usually empty, on startup): the file is mapped and its records are inserted
+    by _uThreads threads (0: hardware concurrency, fewer for small snapshots). Records older than what the tables
+    already hold do not overwrite it. Returns false if the file is missing or not a valid snapshot.
+ */
+inline bool loadVesselSnapshot(const std::string &_strPath, VesselTable &_vessels, VesselStaticCache &_statics,
+                               size_t _uThreads = 0, SnapshotHeader *_pHeader = nullptr)
+{
+    int fd = open(_strPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if ( (fstat(fd, &fileStat) != 0) ||
+         ((size_t)fileStat.st_size < sizeof(SnapshotHeader)) )
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t uSize = (size_t)fileStat.st_size;
+    void *pMap = mmap(nullptr, uSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED) {
+        return false;
+    }
+
+    madvise(pMap, uSize, MADV_WILLNEED);
+
+    SnapshotHeader header;
+    memcpy(&header, pMap, sizeof(header));
+    if ( (header.m_uMagic != AIS_SNAPSHOT_MAGIC) ||
+         (header.m_uVersion != AIS_SNAPSHOT_VERSION) ||
+         (header.m_uVesselSize != sizeof(VesselState)) ||
+         (header.m_uStaticSize != sizeof(VesselStatic)) ||
+         (header.m_uVessels > uSize / sizeof(VesselState)) ||
+         (header.m_uStatics > uSize / sizeof(VesselStatic)) ||
+         (sizeof(header) + header.m_uVessels * sizeof(VesselState) + header.m_uStatics * sizeof(VesselStatic) != uSize) )
+    {
+        munmap(pMap, uSize);
+        return false;
+    }
+
+    const VesselState *pVessels = (const VesselState*)((const char*)pMap + sizeof(header));
+    const VesselStatic *pStatics = (const VesselStatic*)(pVessels + header.m_uVessels);
+    size_t uVessels = (size_t)header.m_uVessels;
+    size_t uStatics = (size_t)header.m_uStatics;
+
+    size_t uThreads = (_uThreads > 0) ? _uThreads : std::max(std::thread::hardware_concurrency(), 1u);
+    uThreads = std::max(std::min(uThreads, (uVessels + uStatics) / AIS_SNAPSHOT_LOAD_BATCH), (size_t)1);
+
+    // every thread inserts a contiguous range of both record types (vessel ranges span few shards each)
+    auto loadRange = [&](size_t _uThread) {
+        size_t uFirst = uVessels * _uThread / uThreads;
+        size_t uLast = uVessels * (_uThread + 1) / uThreads;
+        _vessels.update(pVessels + uFirst, uLast - uFirst);
+
+        uFirst = uStatics * _uThread / uThreads;
+        uLast = uStatics * (_uThread + 1) / uThreads;
+        for (size_t i = uFirst; i < uLast; i++) {
+            _statics.update(pStatics[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < uThreads; i++) {
+        threads.emplace_back(loadRange, i);
+    }
+
+    loadRange(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    munmap(pMap, uSize);
+
+    if (_pHeader != nullptr) {
+        *_pHeader = header;
+    }
+
+    return true;
+}
+
+
+/*
+    Writes snapshots of the vessel tables periodically on a background thread, e.g.
+        SnapshotWriter writer;
+        writer.start("vessels.snap", vessels, statics, 60);
+        ...
+        writer.stop();      // writes a last snapshot
+ */
+class SnapshotWriter
+{
+ public:
+    SnapshotWriter()
+        :m_pVessels(nullptr),
+         m_pStatics(nullptr),
+         m_uIntervalSeconds(0),
+         m_bStop(false),
+         m_uSnapshots(0),
+         m_uFailures(0)
+    {}
+
+    ~SnapshotWriter() {
+        stop();
+    }
+
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    // write a snapshot every _uIntervalSeconds (tables must outlive the writer or stop())
+    void start(const std::string &_strPath, const VesselTable &_vessels, const VesselStaticCache &_statics, uint64_t _uIntervalSeconds) {
+        stop();
+
+        m_strPath = _strPath;
+        m_pVessels = &_vessels;
+        m_pStatics = &_statics;
+        m_uIntervalSeconds = std::max(_uIntervalSeconds, (uint64_t)1);
+        m_bStop = false;
+        m_thread = std::thread(&SnapshotWriter::run, this);
+    }
+
+    // stop the thread and write a last snapshot
+    void stop() {
+        if (m_thread.joinable() == false) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = true;
+        }
+
+        m_cv.notify_all();
+        m_thread.join();
+        write();
+    }
+
+    // snapshots written / failed so far
+    uint64_t snapshots() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_uSnapshots;
+    }
+
+    uint64_t failures() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_uFailures;
+    }
+
+ private:
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_cv.wait_for(lock, std::chrono::seconds(m_uIntervalSeconds), [this]{return m_bStop;}) == false) {
+            lock.unlock();
+            write();
+            lock.lock();
+        }
+    }
+
+    void write() {
+        bool bOk = writeVesselSnapshot(m_strPath, *m_pVessels, *m_pStatics);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (bOk == true) {
+            m_uSnapshots++;
+        }
+        else {
+            m_uFailures++;
+        }
+    }
+
+    std::string                 m_strPath;
+    const VesselTable           *m_pVessels;
+    const VesselStaticCache     *m_pStatics;
+    uint64_t                    m_uIntervalSeconds;
+
+    mutable std::mutex          m_mutex;
+    std::condition_variable     m_cv;
+    bool                        m_bStop;
+    uint64_t                    m_uSnapshots;
+    uint64_t                    m_uFailures;
+    std::thread                 m_thread;
+};
+
+
+
+#endif // #ifndef AIS_SNAPSHOT_H
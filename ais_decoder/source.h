@@ -0,0 +1,180 @@
+#ifndef AIS_SOURCE_H
+#define AIS_SOURCE_H
+
+#include "queue.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+
+
+/*
+    NMEA raw input for a pipeline.
+    m_read reads up to _uSize bytes, waiting at most _timeout for data (WAIT_FOREVER to block); it returns the number
+    of bytes read, 0 if no data arrived in time and -1 at the end of the stream.
+    m_cancel (optional) wakes up a blocked read from another thread; later reads return -1.
+ */
+struct NmeaSource
+{
+    using Read = std::function<int(char *_pData, size_t _uSize, const std::chrono::milliseconds &_timeout)>;
+    using Cancel = std::function<void()>;
+
+    Read        m_read;
+    Cancel      m_cancel;
+};
+
+
+/* File descriptor based input (file, pipe or stdin); blocked reads can be cancelled through a self-pipe. */
+class FileInput
+{
+ public:
+    FileInput()
+        :m_fd(-1),
+         m_wake{-1, -1},
+         m_bCancelled(false)
+    {}
+
+    ~FileInput() {
+        close();
+    }
+
+    FileInput(const FileInput &) = delete;
+    FileInput &operator=(const FileInput &) = delete;
+
+    // open file ("-" for stdin)
+    bool open(const std::string &_strPath) {
+        close();
+
+        m_fd = (_strPath == "-") ? STDIN_FILENO : ::open(_strPath.c_str(), O_RDONLY);
+        if (m_fd < 0) {
+            return false;
+        }
+
+        if (pipe(m_wake.data()) != 0) {
+            close();
+            return false;
+        }
+
+        m_bCancelled = false;
+        return true;
+    }
+
+    void close() {
+        if ( (m_fd >= 0) &&
+             (m_fd != STDIN_FILENO) )
+        {
+            ::close(m_fd);
+        }
+
+        for (auto &fd : m_wake) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+        m_fd = -1;
+    }
+
+    // see NmeaSource::m_read
+    int read(char *_pData, size_t _uSize, const std::chrono::milliseconds &_timeout) {
+        if ( (m_fd < 0) ||
+             (m_bCancelled == true) )
+        {
+            return -1;
+        }
+
+        std::array<struct pollfd, 2> pfd = {{{m_fd, POLLIN, 0}, {m_wake[0], POLLIN, 0}}};
+        int iTimeout = (_timeout == WAIT_FOREVER) ? -1 : (int)_timeout.count();
+        int ret = poll(pfd.data(), pfd.size(), iTimeout);
+        if ( (m_bCancelled == true) ||
+             (ret < 0) )
+        {
+            return -1;
+        }
+        else if (ret == 0) {
+            return 0;   // timeout
+        }
+
+        ssize_t n = ::read(m_fd, _pData, _uSize);
+        return (n > 0) ? (int)n : -1;
+    }
+
+    // see NmeaSource::m_cancel
+    void cancel() {
+        m_bCancelled = true;
+        if (m_wake[1] >= 0) {
+            char c = 0;
+            (void)write(m_wake[1], &c, 1);
+        }
+    }
+
+ private:
+    int                     m_fd;
+    std::array<int, 2>      m_wake;         // self-pipe for cancel
+    std::atomic<bool>       m_bCancelled;
+};
+
+
+/* Create a source reading from a file ("-" for stdin). Returns false if the file could not be opened. */
+inline bool openFileSource(NmeaSource &_source, const std::string &_strPath)
+{
+    auto pInput = std::make_shared<FileInput>();
+    if (pInput->open(_strPath) == false) {
+        return false;
+    }
+
+    _source.m_read = [pInput](char *_pData, size_t _uSize, const std::chrono::milliseconds &_timeout) {
+        return pInput->read(_pData, _uSize, _timeout);
+    };
+
+    _source.m_cancel = [pInput]{pInput->cancel();};
+    return true;
+}
+
+
+/* Create a source reading from memory (e.g. benchmarks and replays). */
+inline NmeaSource makeBufferSource(std::string _strData)
+{
+    struct BufferInput
+    {
+        std::string         m_strData;
+        size_t              m_uOffset;
+        std::atomic<bool>   m_bCancelled;
+    };
+
+    auto pInput = std::make_shared<BufferInput>();
+    pInput->m_strData = std::move(_strData);
+    pInput->m_uOffset = 0;
+    pInput->m_bCancelled = false;
+
+    NmeaSource source;
+    source.m_read = [pInput](char *_pData, size_t _uSize, const std::chrono::milliseconds &) {
+        size_t n = std::min(_uSize, pInput->m_strData.size() - pInput->m_uOffset);
+        if ( (n == 0) ||
+             (pInput->m_bCancelled == true) )
+        {
+            return -1;
+        }
+
+        memcpy(_pData, pInput->m_strData.data() + pInput->m_uOffset, n);
+        pInput->m_uOffset += n;
+        return (int)n;
+    };
+
+    source.m_cancel = [pInput]{pInput->m_bCancelled = true;};
+    return source;
+}
+
+
+
+#endif // #ifndef AIS_SOURCE_H
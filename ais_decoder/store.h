@@ -0,0 +1,445 @@
+#ifndef AIS_STORE_H
+#define AIS_STORE_H
+
+#include "decoder.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+/*
+    Binary output store for decoded payloads.
+
+    File layout:
+    - header:       magic, version
+    - row groups:   records (timestamp, mmsi, bits used, packed payload bytes)
+    - footer:       row group table (offsets and min/max timestamps) and sorted MMSI -> row group postings
+    - trailer:      footer offset, magic
+
+    The footer is a sparse index, so that MMSI and time range queries only have to read the matching row groups.
+ */
+const uint32_t AIS_STORE_MAGIC          = 0x42534941;      // 'AISB'
+const uint32_t AIS_STORE_VERSION        = 1;
+const uint32_t AIS_STORE_ROW_GROUP_SIZE = 1024 * 16;       // records per row group
+
+
+struct StoreRecordHeader
+{
+    uint64_t    m_uTimestamp;
+    uint32_t    m_uMmsi;
+    uint32_t    m_uBitsUsed;
+};
+
+
+struct StoreRowGroup
+{
+    uint64_t    m_uOffset;              // file offset of first record
+    uint64_t    m_uBytes;               // size of all records
+    uint64_t    m_uMinTimestamp;
+    uint64_t    m_uMaxTimestamp;
+    uint32_t    m_uRows;
+    uint32_t    m_uReserved;
+};
+
+
+struct StorePosting
+{
+    uint32_t    m_uMmsi;
+    uint32_t    m_uRowGroup;
+
+    bool operator<(const StorePosting &_other) const {
+        return (m_uMmsi < _other.m_uMmsi) ||
+               ((m_uMmsi == _other.m_uMmsi) && (m_uRowGroup < _other.m_uRowGroup));
+    }
+};
+
+
+struct StoreTrailer
+{
+    uint64_t    m_uFooterOffset;
+    uint32_t    m_uMagic;
+    uint32_t    m_uVersion;
+};
+
+
+/*
+    Writes decoded payloads to a store file and builds the footer index as row groups are completed.
+    Write errors (e.g. a full disk) are sticky: the failing call and close() return false, since the file is
+    incomplete from then on.
+ */
+class StoreWriter
+{
+ public:
+    StoreWriter()
+        :m_pFile(nullptr),
+         m_uOffset(0),
+         m_bFailed(false)
+    {}
+
+    ~StoreWriter() {
+        close();
+    }
+
+    bool open(const char *_pszFilename) {
+        close();
+
+        m_pFile = fopen(_pszFilename, "wb");
+        if (m_pFile == nullptr) {
+            return false;
+        }
+
+        uint32_t header[2] = {AIS_STORE_MAGIC, AIS_STORE_VERSION};
+        m_bFailed = (fwrite(header, sizeof(header), 1, m_pFile) != 1);
+        m_uOffset = sizeof(header);
+
+        m_rowGroups.clear();
+        m_postings.clear();
+        startRowGroup();
+        return m_bFailed == false;
+    }
+
+    bool isOpen() const {
+        return m_pFile != nullptr;
+    }
+
+    // false if a completed row group could not be written (or an earlier write failed)
+    bool write(const MsgPayload &_payload) {
+        StoreRecordHeader record;
+        record.m_uTimestamp = _payload.m_uTimestamp;
+        record.m_uMmsi = getMmsi(_payload);
+        record.m_uBitsUsed = _payload.m_bitsUsed;
+
+        size_t uPayloadBytes = std::min((size_t)(record.m_uBitsUsed + 7) / 8, _payload.m_payload.size());
+        size_t uOldSize = m_buffer.size();
+        m_buffer.resize(uOldSize + sizeof(record) + uPayloadBytes);
+        memcpy(m_buffer.data() + uOldSize, &record, sizeof(record));
+        memcpy(m_buffer.data() + uOldSize + sizeof(record), _payload.m_payload.data(), uPayloadBytes);
+
+        auto &group = m_rowGroups.back();
+        group.m_uMinTimestamp = std::min(group.m_uMinTimestamp, record.m_uTimestamp);
+        group.m_uMaxTimestamp = std::max(group.m_uMaxTimestamp, record.m_uTimestamp);
+        group.m_uRows++;
+        m_mmsis.push_back(record.m_uMmsi);
+
+        if (group.m_uRows >= AIS_STORE_ROW_GROUP_SIZE) {
+            flushRowGroup();
+            startRowGroup();
+        }
+
+        return m_bFailed == false;
+    }
+
+    template <typename PayloadChunk>
+    bool writeChunk(const PayloadChunk &_payloads) {
+        for (const auto &payload : _payloads) {
+            write(payload);
+        }
+
+        return m_bFailed == false;
+    }
+
+    // flush last row group and write footer; false if any write since open() failed
+    bool close() {
+        if (m_pFile == nullptr) {
+            return true;
+        }
+
+        flushRowGroup();
+        if (m_rowGroups.back().m_uRows == 0) {
+            m_rowGroups.pop_back();
+        }
+
+        std::sort(m_postings.begin(), m_postings.end());
+
+        StoreTrailer trailer;
+        trailer.m_uFooterOffset = m_uOffset;
+        trailer.m_uMagic = AIS_STORE_MAGIC;
+        trailer.m_uVersion = AIS_STORE_VERSION;
+
+        uint64_t uRowGroups = m_rowGroups.size();
+        uint64_t uPostings = m_postings.size();
+        bool bOk = (m_bFailed == false) &&
+                   (fwrite(&uRowGroups, sizeof(uRowGroups), 1, m_pFile) == 1) &&
+                   ( (m_rowGroups.empty() == true) || (fwrite(m_rowGroups.data(), sizeof(StoreRowGroup), m_rowGroups.size(), m_pFile) == m_rowGroups.size()) ) &&
+                   (fwrite(&uPostings, sizeof(uPostings), 1, m_pFile) == 1) &&
+                   ( (m_postings.empty() == true) || (fwrite(m_postings.data(), sizeof(StorePosting), m_postings.size(), m_pFile) == m_postings.size()) ) &&
+                   (fwrite(&trailer, sizeof(trailer), 1, m_pFile) == 1) &&
+                   (fflush(m_pFile) == 0);
+        bOk = (fclose(m_pFile) == 0) && bOk;
+        m_pFile = nullptr;
+        m_bFailed = false;
+        return bOk;
+    }
+
+ private:
+    void startRowGroup() {
+        StoreRowGroup group;
+        group.m_uOffset = m_uOffset;
+        group.m_uBytes = 0;
+        group.m_uMinTimestamp = UINT64_MAX;
+        group.m_uMaxTimestamp = 0;
+        group.m_uRows = 0;
+        group.m_uReserved = 0;
+        m_rowGroups.push_back(group);
+    }
+
+    bool flushRowGroup() {
+        auto &group = m_rowGroups.back();
+        if (group.m_uRows == 0) {
+            return m_bFailed == false;
+        }
+
+        if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_pFile) != m_buffer.size()) {
+            m_bFailed = true;
+        }
+
+        group.m_uBytes = m_buffer.size();
+        m_uOffset += m_buffer.size();
+        m_buffer.clear();
+
+        // one posting per unique MMSI in row group
+        uint32_t uRowGroup = (uint32_t)m_rowGroups.size() - 1;
+        std::sort(m_mmsis.begin(), m_mmsis.end());
+        auto itEnd = std::unique(m_mmsis.begin(), m_mmsis.end());
+        for (auto it = m_mmsis.begin(); it != itEnd; ++it) {
+            m_postings.push_back(StorePosting{*it, uRowGroup});
+        }
+
+        m_mmsis.clear();
+        return m_bFailed == false;
+    }
+
+ private:
+    FILE                        *m_pFile;
+    uint64_t                    m_uOffset;
+    bool                        m_bFailed;      // a write failed, the file is incomplete
+    std::vector<char>           m_buffer;       // records of current row group
+    std::vector<uint32_t>       m_mmsis;        // MMSIs of current row group
+    std::vector<StoreRowGroup>  m_rowGroups;
+    std::vector<StorePosting>   m_postings;
+};
+
+
+/*
+    Reads the footer index of a store file and answers MMSI and time range queries.
+    Only row groups that match the index are read from disk.
+ */
+class StoreReader
+{
+ public:
+    StoreReader()
+        :m_pFile(nullptr)
+    {}
+
+    ~StoreReader() {
+        close();
+    }
+
+    bool open(const char *_pszFilename) {
+        close();
+
+        m_pFile = fopen(_pszFilename, "rb");
+        if (m_pFile == nullptr) {
+            return false;
+        }
+
+        StoreTrailer trailer;
+        uint64_t uRowGroups = 0;
+        uint64_t uPostings = 0;
+
+        // the footer counts are checked against the file size, so a damaged footer cannot cause huge allocations
+        if ( (fseek(m_pFile, 0, SEEK_END) != 0) ||
+             (ftell(m_pFile) < (long)sizeof(trailer)) )
+        {
+            close();
+            return false;
+        }
+
+        uint64_t uFooterEnd = (uint64_t)ftell(m_pFile) - sizeof(trailer);
+        if ( (fseek(m_pFile, -(long)sizeof(trailer), SEEK_END) != 0) ||
+             (fread(&trailer, sizeof(trailer), 1, m_pFile) != 1) ||
+             (trailer.m_uMagic != AIS_STORE_MAGIC) ||
+             (trailer.m_uVersion != AIS_STORE_VERSION) ||
+             (uFooterEnd < 2 * sizeof(uint64_t)) ||
+             (trailer.m_uFooterOffset > uFooterEnd - 2 * sizeof(uint64_t)) ||
+             (fseek(m_pFile, (long)trailer.m_uFooterOffset, SEEK_SET) != 0) ||
+             (fread(&uRowGroups, sizeof(uRowGroups), 1, m_pFile) != 1) )
+        {
+            close();
+            return false;
+        }
+
+        uint64_t uRemaining = uFooterEnd - trailer.m_uFooterOffset - 2 * sizeof(uint64_t);
+        if (uRowGroups > uRemaining / sizeof(StoreRowGroup)) {
+            close();
+            return false;
+        }
+
+        m_rowGroups.resize(uRowGroups);
+        if ( (fread(m_rowGroups.data(), sizeof(StoreRowGroup), uRowGroups, m_pFile) != uRowGroups) ||
+             (fread(&uPostings, sizeof(uPostings), 1, m_pFile) != 1) ||
+             (uPostings > (uRemaining - uRowGroups * sizeof(StoreRowGroup)) / sizeof(StorePosting)) )
+        {
+            close();
+            return false;
+        }
+
+        m_postings.resize(uPostings);
+        if (fread(m_postings.data(), sizeof(StorePosting), uPostings, m_pFile) != uPostings) {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close() {
+        if (m_pFile != nullptr) {
+            fclose(m_pFile);
+            m_pFile = nullptr;
+        }
+
+        m_rowGroups.clear();
+        m_postings.clear();
+    }
+
+    const std::vector<StoreRowGroup> &rowGroups() const {
+        return m_rowGroups;
+    }
+
+    // row groups that contain the given MMSI
+    std::vector<uint32_t> findRowGroups(uint32_t _uMmsi) const {
+        std::vector<uint32_t> ret;
+        auto it = std::lower_bound(m_postings.begin(), m_postings.end(), StorePosting{_uMmsi, 0});
+        for (; (it != m_postings.end()) && (it->m_uMmsi == _uMmsi); ++it) {
+            ret.push_back(it->m_uRowGroup);
+        }
+
+        return ret;
+    }
+
+    // row groups that overlap the given time range (inclusive)
+    std::vector<uint32_t> findRowGroups(uint64_t _uStartTime, uint64_t _uEndTime) const {
+        std::vector<uint32_t> ret;
+        for (size_t i = 0; i < m_rowGroups.size(); i++) {
+            if ( (m_rowGroups[i].m_uMinTimestamp <= _uEndTime) &&
+                 (m_rowGroups[i].m_uMaxTimestamp >= _uStartTime) )
+            {
+                ret.push_back((uint32_t)i);
+            }
+        }
+
+        return ret;
+    }
+
+    /*
+        Read one row group and call _func(const MsgPayload &) for every record.
+        Returns the number of records read.
+     */
+    template <typename Func>
+    size_t readRowGroup(uint32_t _uRowGroup, Func &&_func) {
+        if ( (m_pFile == nullptr) ||
+             (_uRowGroup >= m_rowGroups.size()) )
+        {
+            return 0;
+        }
+
+        const auto &group = m_rowGroups[_uRowGroup];
+        m_buffer.resize(group.m_uBytes);
+        if ( (fseek(m_pFile, (long)group.m_uOffset, SEEK_SET) != 0) ||
+             (fread(m_buffer.data(), 1, m_buffer.size(), m_pFile) != m_buffer.size()) )
+        {
+            return 0;
+        }
+
+        const char *pData = m_buffer.data();
+        const char *pEnd = pData + m_buffer.size();
+        size_t count = 0;
+
+        while (pData + sizeof(StoreRecordHeader) <= pEnd) {
+            StoreRecordHeader record;
+            memcpy(&record, pData, sizeof(record));
+            pData += sizeof(record);
+
+            size_t uPayloadBytes = std::min((size_t)(record.m_uBitsUsed + 7) / 8, m_payload.m_payload.size());
+            if (pData + uPayloadBytes > pEnd) {
+                break;
+            }
+
+            m_payload.m_payload.fill(0);
+            memcpy(m_payload.m_payload.data(), pData, uPayloadBytes);
+            m_payload.m_uTimestamp = record.m_uTimestamp;
+            m_payload.m_bitsUsed = record.m_uBitsUsed;
+            pData += uPayloadBytes;
+
+            _func(m_payload);
+            count++;
+        }
+
+        return count;
+    }
+
+    /*
+        Find all payloads for the given MMSI inside the time range (inclusive).
+        Calls _func(const MsgPayload &) for every match and returns the number of matches.
+     */
+    template <typename Func>
+    size_t query(uint32_t _uMmsi, uint64_t _uStartTime, uint64_t _uEndTime, Func &&_func) {
+        size_t count = 0;
+        for (auto uRowGroup : findRowGroups(_uMmsi)) {
+            const auto &group = m_rowGroups[uRowGroup];
+            if ( (group.m_uMinTimestamp > _uEndTime) ||
+                 (group.m_uMaxTimestamp < _uStartTime) )
+            {
+                continue;
+            }
+
+            readRowGroup(uRowGroup, [&](const MsgPayload &_payload) {
+                if ( (_payload.m_uTimestamp >= _uStartTime) &&
+                     (_payload.m_uTimestamp <= _uEndTime) &&
+                     (getMmsi(_payload) == _uMmsi) )
+                {
+                    _func(_payload);
+                    count++;
+                }
+            });
+        }
+
+        return count;
+    }
+
+    /*
+        Find all payloads inside the time range (inclusive).
+        Calls _func(const MsgPayload &) for every match and returns the number of matches.
+     */
+    template <typename Func>
+    size_t query(uint64_t _uStartTime, uint64_t _uEndTime, Func &&_func) {
+        size_t count = 0;
+        for (auto uRowGroup : findRowGroups(_uStartTime, _uEndTime)) {
+            readRowGroup(uRowGroup, [&](const MsgPayload &_payload) {
+                if ( (_payload.m_uTimestamp >= _uStartTime) &&
+                     (_payload.m_uTimestamp <= _uEndTime) )
+                {
+                    _func(_payload);
+                    count++;
+                }
+            });
+        }
+
+        return count;
+    }
+
+ private:
+    FILE                        *m_pFile;
+    std::vector<StoreRowGroup>  m_rowGroups;
+    std::vector<StorePosting>   m_postings;
+    std::vector<char>           m_buffer;
+    MsgPayload                  m_payload;
+};
+
+
+
+#endif // #ifndef AIS_STORE_H
@@ -126,6 +126,13 @@ inline bool ascii_isspace(char _ch)
 }
 
 
+// quick check for ascii digits
+inline bool ascii_isdigit(char _ch)
+{
+    return (_ch >= '0') && (_ch <= '9');
+}
+
+
 inline char ascii_toupper(char _ch)
 {
     if (_ch <= 'z' && _ch >= 'a') return _ch - 32;
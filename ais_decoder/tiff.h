@@ -3,6 +3,13 @@
 
 #include <tiff.h>
 #include <tiffio.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
 #include <vector>
 
 
@@ -24,11 +31,9 @@ int writeTiffFileInt16(const char *_pszFilename, int _iWidth, int _iHeight, cons
     TIFFSetField(image, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
     TIFFSetField(image, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
 
-    auto scan_line = std::vector<uint32>(_iWidth);
-
+    // uncompressed scanlines are written as they are (no copy needed)
     for (int i = 0; i < _iHeight; i++) {
-        memcpy(scan_line.data(), &_pImageData[i * _iWidth], _iWidth * sizeof(uint16_t));
-        TIFFWriteScanline(image, scan_line.data(), i, 0);
+        TIFFWriteScanline(image, (void*)&_pImageData[(size_t)i * _iWidth], i, 0);
     }
 
     TIFFClose(image);
@@ -36,4 +41,425 @@ int writeTiffFileInt16(const char *_pszFilename, int _iWidth, int _iHeight, cons
 }
 
 
+
+/* GeoTIFF tags (see registerGeoTiffTags()) */
+const ttag_t TIFFTAG_GEO_PIXEL_SCALE        = 33550;    // ModelPixelScaleTag
+const ttag_t TIFFTAG_GEO_TIEPOINTS          = 33922;    // ModelTiepointTag
+const ttag_t TIFFTAG_GEO_KEY_DIRECTORY      = 34735;    // GeoKeyDirectoryTag
+
+const double WEB_MERCATOR_RADIUS            = 6378137.0;
+
+
+/* Georeferencing of a raster: bbox in CRS units and EPSG code (4326: degrees, 3857: web mercator meters; 0: none) */
+struct TiffGeoRef
+{
+    double      m_dMinX;
+    double      m_dMinY;
+    double      m_dMaxX;
+    double      m_dMaxY;
+    uint16_t    m_uEpsg;
+};
+
+
+/* Georeferencing of a lon/lat (WGS84) raster */
+inline TiffGeoRef tiffGeoRefLonLat(double _dMinLon, double _dMinLat, double _dMaxLon, double _dMaxLat)
+{
+    return TiffGeoRef{_dMinLon, _dMinLat, _dMaxLon, _dMaxLat, 4326};
+}
+
+
+/* Georeferencing of a web mercator raster (bbox in degrees) */
+inline TiffGeoRef tiffGeoRefWebMercator(double _dMinLon, double _dMinLat, double _dMaxLon, double _dMaxLat)
+{
+    auto x = [](double _dLon){return _dLon * M_PI / 180 * WEB_MERCATOR_RADIUS;};
+    auto y = [](double _dLat){return std::log(std::tan(M_PI / 4 + _dLat * M_PI / 360)) * WEB_MERCATOR_RADIUS;};
+    return TiffGeoRef{x(_dMinLon), y(_dMinLat), x(_dMaxLon), y(_dMaxLat), 3857};
+}
+
+
+/* Options of writeTiledTiff16() */
+struct TiffOptions
+{
+    TiffOptions()
+        :m_uCompression(COMPRESSION_ADOBE_DEFLATE),
+         m_uTileSize(256),
+         m_iDeflateLevel(6),
+         m_bPredictor(false),
+         m_iOverviews(-1),
+         m_uThreads(0),
+         m_geoRef{0, 0, 0, 0, 0}
+    {}
+
+    uint16_t    m_uCompression;             // COMPRESSION_ADOBE_DEFLATE, COMPRESSION_LZW or COMPRESSION_NONE
+    uint32_t    m_uTileSize;                // tile edge (multiple of 16)
+    int         m_iDeflateLevel;            // zlib level (1: fastest, 9: smallest)
+    bool        m_bPredictor;               // horizontal differencing before compression (smaller for smooth rasters)
+    int         m_iOverviews;               // reduced resolution levels (-1: halve until the image fits into a tile)
+    size_t      m_uThreads;                 // compression threads (0: one per hardware thread)
+    TiffGeoRef  m_geoRef;                   // GeoTIFF tags (none if m_uEpsg is 0)
+};
+
+
+/*
+    TIFF LZW encoder (codes of 9 to 12 bits, most significant bit first, clear code when the table is full);
+    same code sequence as the libtiff encoder.
+ */
+class TiffLzwEncoder
+{
+ public:
+    static void encode(const uint8_t *_pData, size_t _uSize, std::vector<uint8_t> &_out) {
+        TiffLzwEncoder encoder(_out);
+        encoder.run(_pData, _uSize);
+    }
+
+ private:
+    static const int        CODE_CLEAR  = 256;
+    static const int        CODE_EOI    = 257;
+    static const int        CODE_FIRST  = 258;
+    static const int        CODE_MAX    = 4095;
+    static const size_t     HASH_SIZE   = 8192;         // more than twice the table size (linear probing)
+
+    explicit TiffLzwEncoder(std::vector<uint8_t> &_out)
+        :m_out(_out),
+         m_keys(HASH_SIZE),
+         m_codes(HASH_SIZE),
+         m_uBits(0),
+         m_iBits(0),
+         m_iCodeBits(9),
+         m_iNext(CODE_FIRST)
+    {}
+
+    void run(const uint8_t *_pData, size_t _uSize) {
+        m_out.clear();
+        m_out.reserve(_uSize / 2 + 16);
+        reset();
+        put(CODE_CLEAR);
+
+        if (_uSize > 0) {
+            int iEntry = _pData[0];
+            for (size_t i = 1; i < _uSize; i++) {
+                int32_t key = (iEntry << 8) | _pData[i];
+                size_t h = ((size_t)key * 2654435761u) & (HASH_SIZE - 1);
+                while ( (m_keys[h] != -1) &&
+                        (m_keys[h] != key) )
+                {
+                    h = (h + 1) & (HASH_SIZE - 1);
+                }
+
+                if (m_keys[h] == key) {
+                    iEntry = m_codes[h];
+                    continue;
+                }
+
+                put(iEntry);
+                iEntry = _pData[i];
+                m_keys[h] = key;
+                m_codes[h] = (int16_t)m_iNext++;
+                if (m_iNext == CODE_MAX - 1) {
+                    put(CODE_CLEAR);
+                    reset();
+                }
+                else if (m_iNext > (1 << m_iCodeBits) - 1) {
+                    m_iCodeBits++;
+                }
+            }
+
+            // last entry (the decoder adds one more table entry for it)
+            put(iEntry);
+            if (m_iNext + 1 == CODE_MAX - 1) {
+                put(CODE_CLEAR);
+                m_iCodeBits = 9;
+            }
+            else if (m_iNext + 1 > (1 << m_iCodeBits) - 1) {
+                m_iCodeBits++;
+            }
+        }
+
+        put(CODE_EOI);
+        if (m_iBits > 0) {
+            m_out.push_back((uint8_t)(m_uBits << (8 - m_iBits)));
+        }
+    }
+
+    void reset() {
+        std::fill(m_keys.begin(), m_keys.end(), -1);
+        m_iNext = CODE_FIRST;
+        m_iCodeBits = 9;
+    }
+
+    void put(int _iCode) {
+        m_uBits = (m_uBits << m_iCodeBits) | (uint32_t)_iCode;
+        m_iBits += m_iCodeBits;
+        while (m_iBits >= 8) {
+            m_iBits -= 8;
+            m_out.push_back((uint8_t)(m_uBits >> m_iBits));
+        }
+    }
+
+    std::vector<uint8_t>    &m_out;
+    std::vector<int32_t>    m_keys;             // (prefix code << 8) | byte, -1 if empty
+    std::vector<int16_t>    m_codes;
+    uint32_t                m_uBits;            // pending output bits
+    int                     m_iBits;
+    int                     m_iCodeBits;
+    int                     m_iNext;
+};
+
+
+/* Register the GeoTIFF tags with libtiff (once, for all files opened afterwards) */
+inline void registerGeoTiffTags()
+{
+    static TIFFExtendProc parentExtender = nullptr;
+    static const bool bRegistered = []{
+        parentExtender = TIFFSetTagExtender([](TIFF *_pTiff) {
+            static const TIFFFieldInfo FIELDS[] = {
+                {TIFFTAG_GEO_PIXEL_SCALE, -1, -1, TIFF_DOUBLE, FIELD_CUSTOM, 1, 1, (char*)"ModelPixelScaleTag"},
+                {TIFFTAG_GEO_TIEPOINTS, -1, -1, TIFF_DOUBLE, FIELD_CUSTOM, 1, 1, (char*)"ModelTiepointTag"},
+                {TIFFTAG_GEO_KEY_DIRECTORY, -1, -1, TIFF_SHORT, FIELD_CUSTOM, 1, 1, (char*)"GeoKeyDirectoryTag"}
+            };
+
+            TIFFMergeFieldInfo(_pTiff, FIELDS, sizeof(FIELDS) / sizeof(FIELDS[0]));
+            if (parentExtender != nullptr) {
+                parentExtender(_pTiff);
+            }
+        });
+
+        return true;
+    }();
+
+    (void)bRegistered;
+}
+
+
+/* Set GeoTIFF tags: pixel scale, top left tiepoint and model/raster type and CRS keys; false if libtiff rejects one */
+inline bool setGeoTiffTags(TIFF *_pTiff, uint32_t _uWidth, uint32_t _uHeight, const TiffGeoRef &_geoRef)
+{
+    double pixelScale[3] = {(_geoRef.m_dMaxX - _geoRef.m_dMinX) / _uWidth, (_geoRef.m_dMaxY - _geoRef.m_dMinY) / _uHeight, 0};
+    double tiepoints[6] = {0, 0, 0, _geoRef.m_dMinX, _geoRef.m_dMaxY, 0};
+
+    bool bGeographic = (_geoRef.m_uEpsg == 4326);
+    uint16_t keys[16] = {
+        1, 1, 0, 3,                                         // version, revision, number of keys
+        1024, 0, 1, (uint16_t)(bGeographic ? 2 : 1),        // GTModelTypeGeoKey: geographic or projected
+        1025, 0, 1, 1,                                      // GTRasterTypeGeoKey: pixel is area
+        (uint16_t)(bGeographic ? 2048 : 3072), 0, 1, _geoRef.m_uEpsg    // GeographicTypeGeoKey or ProjectedCSTypeGeoKey
+    };
+
+    return (TIFFSetField(_pTiff, TIFFTAG_GEO_PIXEL_SCALE, 3, pixelScale) == 1) &&
+           (TIFFSetField(_pTiff, TIFFTAG_GEO_TIEPOINTS, 6, tiepoints) == 1) &&
+           (TIFFSetField(_pTiff, TIFFTAG_GEO_KEY_DIRECTORY, 16, keys) == 1);
+}
+
+
+/* Half resolution image (mean of 2x2 pixels; the last row/column of odd sizes is averaged with itself) */
+inline void tiffDownsample(const uint16_t *_pSrc, uint32_t _uWidth, uint32_t _uHeight,
+                           std::vector<uint16_t> &_dst, uint32_t &_uDstWidth, uint32_t &_uDstHeight)
+{
+    _uDstWidth = (_uWidth + 1) / 2;
+    _uDstHeight = (_uHeight + 1) / 2;
+    _dst.resize((size_t)_uDstWidth * _uDstHeight);
+
+    for (uint32_t y = 0; y < _uDstHeight; y++) {
+        const uint16_t *pRow0 = _pSrc + (size_t)std::min(2 * y, _uHeight - 1) * _uWidth;
+        const uint16_t *pRow1 = _pSrc + (size_t)std::min(2 * y + 1, _uHeight - 1) * _uWidth;
+        uint16_t *pOut = _dst.data() + (size_t)y * _uDstWidth;
+        for (uint32_t x = 0; x < _uDstWidth; x++) {
+            uint32_t x0 = 2 * x;
+            uint32_t x1 = std::min(2 * x + 1, _uWidth - 1);
+            pOut[x] = (uint16_t)((pRow0[x0] + pRow0[x1] + pRow1[x0] + pRow1[x1] + 2) / 4);
+        }
+    }
+}
+
+
+/*
+    Compress the tiles of an image (row major tile order) on _uThreads threads. Tiles at the right and bottom
+    edges are padded with zeros; all-zero tiles (common in sparse rasters) are compressed once and shared.
+    Returns false if a tile could not be compressed (zlib error).
+ */
+inline bool tiffCompressTiles(const uint16_t *_pImage, uint32_t _uWidth, uint32_t _uHeight, const TiffOptions &_options,
+                              size_t _uThreads, std::vector<std::vector<uint8_t>> &_tiles)
+{
+    const uint32_t uTileSize = _options.m_uTileSize;
+    const uint32_t uTilesX = (_uWidth + uTileSize - 1) / uTileSize;
+    const uint32_t uTilesY = (_uHeight + uTileSize - 1) / uTileSize;
+    _tiles.assign((size_t)uTilesX * uTilesY, std::vector<uint8_t>());
+
+    auto compress = [&_options](std::vector<uint16_t> &_tile, std::vector<uint8_t> &_out) -> bool {
+        const size_t uTileSize = _options.m_uTileSize;
+        if (_options.m_bPredictor == true) {
+            for (size_t y = 0; y < uTileSize; y++) {
+                uint16_t *pRow = _tile.data() + y * uTileSize;
+                for (size_t x = uTileSize - 1; x > 0; x--) {
+                    pRow[x] = (uint16_t)(pRow[x] - pRow[x - 1]);
+                }
+            }
+        }
+
+        const uint8_t *pData = (const uint8_t*)_tile.data();
+        size_t uBytes = _tile.size() * sizeof(uint16_t);
+        if (_options.m_uCompression == COMPRESSION_ADOBE_DEFLATE) {
+            uLongf uSize = compressBound((uLong)uBytes);
+            _out.resize(uSize);
+            if (compress2(_out.data(), &uSize, pData, (uLong)uBytes, _options.m_iDeflateLevel) != Z_OK) {
+                _out.clear();
+                return false;
+            }
+
+            _out.resize(uSize);
+        }
+        else if (_options.m_uCompression == COMPRESSION_LZW) {
+            TiffLzwEncoder::encode(pData, uBytes, _out);
+        }
+        else {
+            _out.assign(pData, pData + uBytes);
+        }
+
+        return true;
+    };
+
+    std::vector<uint16_t> zeroTile((size_t)uTileSize * uTileSize, 0);
+    std::vector<uint8_t> zeroCompressed;
+    if (compress(zeroTile, zeroCompressed) == false) {
+        return false;
+    }
+
+    std::atomic<size_t> uNext(0);
+    std::atomic<bool> bFailed(false);
+    auto worker = [&]() {
+        std::vector<uint16_t> tile((size_t)uTileSize * uTileSize);
+        for (size_t i = uNext++; (i < _tiles.size()) && (bFailed == false); i = uNext++) {
+            uint32_t uX0 = (uint32_t)(i % uTilesX) * uTileSize;
+            uint32_t uY0 = (uint32_t)(i / uTilesX) * uTileSize;
+            uint32_t uCols = std::min(uTileSize, _uWidth - uX0);
+            uint32_t uRows = std::min(uTileSize, _uHeight - uY0);
+
+            bool bZero = true;
+            std::fill(tile.begin(), tile.end(), 0);
+            for (uint32_t y = 0; y < uRows; y++) {
+                const uint16_t *pSrc = _pImage + (size_t)(uY0 + y) * _uWidth + uX0;
+                memcpy(tile.data() + (size_t)y * uTileSize, pSrc, uCols * sizeof(uint16_t));
+                bZero = bZero && std::all_of(pSrc, pSrc + uCols, [](uint16_t _uValue){return _uValue == 0;});
+            }
+
+            if (bZero == true) {
+                _tiles[i] = zeroCompressed;
+            }
+            else if (compress(tile, _tiles[i]) == false) {
+                bFailed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < _uThreads; i++) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    return bFailed == false;
+}
+
+
+/*
+    Write a 16-bit gray-scale image as tiled (optionally GeoTIFF) file: tiles are compressed in parallel (DEFLATE
+    or LZW, optionally with horizontal predictor) and written as they are, followed by reduced resolution images (overviews,
+    each half the size of the one before, as further directories) that GIS tools use for zoomed out views.
+    Files with more than 2GB of pixel data are written as BigTIFF. Returns 0 on success, -1 on errors (a rejected
+    tag, a compression or write error; the file is incomplete then).
+ */
+inline int writeTiledTiff16(const char *_pszFilename, uint32_t _uWidth, uint32_t _uHeight, const uint16_t *_pImageData,
+                            const TiffOptions &_options = TiffOptions())
+{
+    if (_options.m_geoRef.m_uEpsg != 0) {
+        registerGeoTiffTags();
+    }
+
+    bool bBigTiff = (uint64_t)_uWidth * _uHeight * sizeof(uint16_t) > ((uint64_t)1 << 31);
+    TIFF *pTiff = TIFFOpen(_pszFilename, bBigTiff ? "w8" : "w");
+    if (pTiff == nullptr) {
+        return -1;
+    }
+
+    size_t uThreads = (_options.m_uThreads > 0) ? _options.m_uThreads : std::max(std::thread::hardware_concurrency(), 1u);
+    int iMaxLevels = (_options.m_iOverviews >= 0) ? _options.m_iOverviews + 1 : 32;
+
+    std::vector<uint16_t> level;                // current overview (level 0 is the image itself)
+    std::vector<uint16_t> next;
+    const uint16_t *pLevel = _pImageData;
+    uint32_t uWidth = _uWidth;
+    uint32_t uHeight = _uHeight;
+    std::vector<std::vector<uint8_t>> tiles;
+    int iResult = 0;
+
+    for (int iLevel = 0; iLevel < iMaxLevels; iLevel++) {
+        // TIFFSetField() returns 1 on success (e.g. 0 for a compression scheme libtiff was built without)
+        bool bTags = (TIFFSetField(pTiff, TIFFTAG_SUBFILETYPE, (iLevel > 0) ? FILETYPE_REDUCEDIMAGE : 0) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_IMAGEWIDTH, uWidth) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_IMAGELENGTH, uHeight) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_BITSPERSAMPLE, 16) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_SAMPLESPERPIXEL, 1) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_TILEWIDTH, _options.m_uTileSize) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_TILELENGTH, _options.m_uTileSize) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT) == 1) &&
+                     (TIFFSetField(pTiff, TIFFTAG_COMPRESSION, _options.m_uCompression) == 1);
+        if ( (bTags == true) &&
+             (_options.m_uCompression != COMPRESSION_NONE) &&
+             (_options.m_bPredictor == true) )
+        {
+            bTags = (TIFFSetField(pTiff, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL) == 1);
+        }
+
+        if ( (bTags == true) &&
+             (iLevel == 0) &&
+             (_options.m_geoRef.m_uEpsg != 0) )
+        {
+            bTags = setGeoTiffTags(pTiff, uWidth, uHeight, _options.m_geoRef);
+        }
+
+        TiffOptions options = _options;
+        options.m_bPredictor = (_options.m_uCompression != COMPRESSION_NONE) && (_options.m_bPredictor == true);
+        if ( (bTags == false) ||
+             (tiffCompressTiles(pLevel, uWidth, uHeight, options, uThreads, tiles) == false) )
+        {
+            iResult = -1;
+            break;
+        }
+
+        for (size_t i = 0; i < tiles.size(); i++) {
+            if (TIFFWriteRawTile(pTiff, (uint32_t)i, tiles[i].data(), (tmsize_t)tiles[i].size()) < 0) {
+                iResult = -1;
+            }
+        }
+
+        bool bLast = (iLevel + 1 == iMaxLevels) ||
+                     ( (uWidth <= _options.m_uTileSize) && (uHeight <= _options.m_uTileSize) );
+        if (bLast == true) {
+            break;
+        }
+
+        if (TIFFWriteDirectory(pTiff) == 0) {
+            iResult = -1;
+        }
+
+        uint32_t uNextWidth, uNextHeight;
+        tiffDownsample(pLevel, uWidth, uHeight, next, uNextWidth, uNextHeight);
+        level.swap(next);
+        pLevel = level.data();
+        uWidth = uNextWidth;
+        uHeight = uNextHeight;
+    }
+
+    TIFFClose(pTiff);
+    return iResult;
+}
+
+
 #endif // #ifndef AIS_TIFF_H
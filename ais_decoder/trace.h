@@ -0,0 +1,96 @@
+#ifndef AIS_TRACE_H
+#define AIS_TRACE_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/*
+    Latency tracing (compile time): with AIS_TRACE_LATENCY=1 every chunk carries a timestamp per stage boundary
+    (see ChunkTrace), passed on to the chunks made from it downstream; the sink folds them into latency histograms
+    (see LatencyMetrics). Without it chunks have no trace and the stamps compile to nothing.
+ */
+#ifndef AIS_TRACE_LATENCY
+#define AIS_TRACE_LATENCY 0
+#endif
+
+
+/* Stage boundaries stamped on a chunk (in pipeline order) */
+const size_t TRACE_ARRIVAL              = 0;    // first sentence of the chunk read (processNmeaData)
+const size_t TRACE_INPUT                = 1;    // input chunk pushed
+const size_t TRACE_FRAGMENTS_START      = 2;    // fragment stage picked the chunk up
+const size_t TRACE_FRAGMENTS_END        = 3;
+const size_t TRACE_MESSAGES_START       = 4;    // message stage picked the chunk up
+const size_t TRACE_MESSAGES_END         = 5;
+const size_t TRACE_SINK                 = 6;    // handed to the sinks (in order)
+const size_t TRACE_POINTS               = 7;
+
+
+/*
+    Cheap timestamp: time stamp counter on x86 (invariant TSC, synchronised between cores on current cpus), virtual
+    counter on ARM64, steady clock nanoseconds elsewhere. See traceTicksPerNs().
+ */
+inline uint64_t traceTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t uTicks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(uTicks));
+    return uTicks;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+/* Ticks per nanosecond (calibrated against the steady clock on first use, which takes 20ms). */
+inline double traceTicksPerNs()
+{
+    static const double dTicksPerNs = []{
+        auto tsStart = std::chrono::steady_clock::now();
+        uint64_t uStart = traceTicks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t uEnd = traceTicks();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tsStart);
+        return (double)(uEnd - uStart) / std::max((double)elapsed.count(), 1.0);
+    }();
+
+    return dTicksPerNs;
+}
+
+
+/* Stage boundary timestamps of a chunk (ticks, 0 if not stamped) */
+struct ChunkTrace
+{
+    ChunkTrace()
+        :m_ticks{}
+    {}
+
+    void stamp(size_t _uPoint) {
+        m_ticks[_uPoint] = traceTicks();
+    }
+
+    std::array<uint64_t, TRACE_POINTS>  m_ticks;
+};
+
+
+/* Stamp a chunk / pass the trace on to the chunk made from it (no code without AIS_TRACE_LATENCY) */
+#if AIS_TRACE_LATENCY
+#define AIS_TRACE_STAMP(_chunk, _uPoint)    (_chunk).m_trace.stamp(_uPoint)
+#define AIS_TRACE_COPY(_to, _from)          (_to).m_trace = (_from).m_trace
+#else
+#define AIS_TRACE_STAMP(_chunk, _uPoint)
+#define AIS_TRACE_COPY(_to, _from)
+#endif
+
+
+
+#endif // #ifndef AIS_TRACE_H
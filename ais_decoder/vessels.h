@@ -0,0 +1,607 @@
+#ifndef AIS_VESSELS_H
+#define AIS_VESSELS_H
+
+#include "processing.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+
+const size_t VESSEL_SHARDS              = 64;           // independent tables (one writer lock each)
+const size_t VESSEL_SHARD_CAPACITY      = 1024;         // initial slots per shard (power of two)
+
+/* Not available values (as in the position reports) */
+const int32_t VESSEL_LON_NA             = 181 * 600000;
+const int32_t VESSEL_LAT_NA             = 91 * 600000;
+const uint16_t VESSEL_SOG_NA            = 1023;
+const uint16_t VESSEL_COG_NA            = 3600;
+const uint16_t VESSEL_HEADING_NA        = 511;
+const uint8_t VESSEL_NAV_STATUS_NA      = 15;
+
+
+/* Latest position report of a vessel */
+struct VesselState
+{
+    uint32_t    m_uMmsi;
+    int32_t     m_iLon;                 // 1/10000 minute (VESSEL_LON_NA if not available)
+    int32_t     m_iLat;
+    uint16_t    m_uSog;                 // 1/10 knot
+    uint16_t    m_uCog;                 // 1/10 degree
+    uint16_t    m_uHeading;             // degree
+    uint8_t     m_uNavStatus;           // (VESSEL_NAV_STATUS_NA for class B)
+    uint8_t     m_uMsgType;             // 1, 2, 3, 18 or 19
+    uint64_t    m_uTimestamp;           // unix time (tag block)
+
+    double lon() const {return m_iLon / 600000.0;}
+    double lat() const {return m_iLat / 600000.0;}
+};
+
+
+/* Static and voyage data of a vessel (merged from types 5 and 24) */
+struct VesselStatic
+{
+    uint32_t    m_uMmsi;
+    uint32_t    m_uImo;                 // 0 if not available
+    uint64_t    m_uTimestamp;           // unix time of the latest report (tag block)
+    char        m_callsign[8];          // empty if not available
+    char        m_name[21];
+    char        m_destination[21];
+    uint8_t     m_uShipType;            // 0 if not available
+    uint8_t     m_uToPort;              // meter from reference point (all 0 if not available)
+    uint16_t    m_uToBow;
+    uint16_t    m_uToStern;
+    uint8_t     m_uToStarboard;
+};
+
+
+/* Shard of an MMSI (VesselTable, VesselStaticCache) and its hash */
+inline uint32_t vesselHash(uint32_t _uMmsi)
+{
+    uint32_t h = _uMmsi * 0x9e3779b1u;
+    return h ^ (h >> 15);
+}
+
+
+inline size_t vesselShard(uint32_t _uMmsi)
+{
+    return vesselHash(_uMmsi) % VESSEL_SHARDS;
+}
+
+
+/* Vessel state of a position report (types 1, 2, 3, 18 and 19); false for other types or short payloads */
+inline bool getVesselState(const MsgPayload &_payload, VesselState &_state)
+{
+    size_t uBitIndex = 0;
+    unsigned int uType = getUnsignedValue(_payload, uBitIndex, 6);
+    bool bClassA = (uType >= 1) && (uType <= 3);
+    if ( ( (bClassA == false) && (uType != 18) && (uType != 19) ) ||
+         (_payload.m_bitsUsed < (bClassA ? 137 : 133)) )
+    {
+        return false;
+    }
+
+    _state.m_uMsgType = (uint8_t)uType;
+    _state.m_uTimestamp = _payload.m_uTimestamp;
+    _state.m_uMmsi = getMmsi(_payload);
+
+    uBitIndex = 38;
+    if (bClassA == true) {
+        _state.m_uNavStatus = (uint8_t)getUnsignedValue(_payload, uBitIndex, 4);
+        uBitIndex += 8;                                     // rate of turn
+    }
+    else {
+        _state.m_uNavStatus = VESSEL_NAV_STATUS_NA;
+        uBitIndex += 8;                                     // reserved
+    }
+
+    _state.m_uSog = (uint16_t)getUnsignedValue(_payload, uBitIndex, 10);
+    uBitIndex += 1;                                         // position accuracy
+    _state.m_iLon = getSignedValue(_payload, uBitIndex, 28);
+    _state.m_iLat = getSignedValue(_payload, uBitIndex, 27);
+    _state.m_uCog = (uint16_t)getUnsignedValue(_payload, uBitIndex, 12);
+    _state.m_uHeading = (uint16_t)getUnsignedValue(_payload, uBitIndex, 9);
+    return true;
+}
+
+
+/* 6 bit text of up to _uChars characters (without trailing '@' and spaces) */
+inline void getVesselText(const MsgPayload &_payload, size_t _uBitIndex, size_t _uChars, char *_pszText)
+{
+    size_t n = 0;
+    for (; n < _uChars; n++) {
+        unsigned int ch = getUnsignedValue(_payload, _uBitIndex, 6);
+        if (ch == 0) {
+            break;
+        }
+
+        _pszText[n] = ASCII_CHARS[ch];
+    }
+
+    while ( (n > 0) && (_pszText[n - 1] == ' ') ) {
+        n--;
+    }
+
+    _pszText[n] = 0;
+}
+
+
+/*
+    Static data of a type 5 or 24 message (fields not in the message are left empty); false for other types.
+    Type 5 is accepted up to the draught, as many transmitters cut the destination short.
+ */
+inline bool getVesselStatic(const MsgPayload &_payload, VesselStatic &_static)
+{
+    size_t uBitIndex = 0;
+    unsigned int uType = getUnsignedValue(_payload, uBitIndex, 6);
+    if ( ( (uType != 5) || (_payload.m_bitsUsed < 302) ) &&
+         ( (uType != 24) || (_payload.m_bitsUsed < 160) ) )
+    {
+        return false;
+    }
+
+    _static = VesselStatic{};
+    _static.m_uMmsi = getMmsi(_payload);
+    _static.m_uTimestamp = _payload.m_uTimestamp;
+
+    size_t uDimensions = 0;
+    if (uType == 5) {
+        uBitIndex = 40;
+        _static.m_uImo = getUnsignedValue(_payload, uBitIndex, 30);
+        getVesselText(_payload, 70, 7, _static.m_callsign);
+        getVesselText(_payload, 112, 20, _static.m_name);
+        uBitIndex = 232;
+        _static.m_uShipType = (uint8_t)getUnsignedValue(_payload, uBitIndex, 8);
+        getVesselText(_payload, 302, std::min((_payload.m_bitsUsed - 302) / 6, 20u), _static.m_destination);
+        uDimensions = 240;
+    }
+    else {
+        uBitIndex = 38;
+        unsigned int uPart = getUnsignedValue(_payload, uBitIndex, 2);
+        if (uPart == 0) {
+            getVesselText(_payload, 40, 20, _static.m_name);
+        }
+        else if ( (uPart == 1) && (_payload.m_bitsUsed >= 162) ) {
+            uBitIndex = 40;
+            _static.m_uShipType = (uint8_t)getUnsignedValue(_payload, uBitIndex, 8);
+            getVesselText(_payload, 90, 7, _static.m_callsign);
+            uDimensions = 132;
+        }
+        else {
+            return false;
+        }
+    }
+
+    if (uDimensions > 0) {
+        _static.m_uToBow = (uint16_t)getUnsignedValue(_payload, uDimensions, 9);
+        _static.m_uToStern = (uint16_t)getUnsignedValue(_payload, uDimensions, 9);
+        _static.m_uToPort = (uint8_t)getUnsignedValue(_payload, uDimensions, 6);
+        _static.m_uToStarboard = (uint8_t)getUnsignedValue(_payload, uDimensions, 6);
+    }
+
+    return true;
+}
+
+
+/*
+    Latest state per MMSI, updated by any number of threads and read without locks.
+
+    The table is split into VESSEL_SHARDS open addressing hash tables (linear probing). Writers lock the shard
+    they update; update(Payloads) sorts the position reports of a chunk by shard first, so a chunk takes one
+    lock per shard it touches instead of one per message. Readers never lock: every slot is a seqlock (sequence
+    number odd while written, state stored as atomic words), so get() and forEach() retry a slot that changed
+    while being read and always return a consistent state of a vessel.
+    A shard grows (twice the slots) at half load: the new slot array is filled and published, readers still on
+    the old one see the state as of the switch. Old arrays are kept until the table is destroyed (they sum up to
+    less than the current size), so readers never see freed memory.
+    Updates older than the stored state (by tag block timestamp) are ignored, so chunks decoded out of order or
+    late duplicates from other stations do not move a vessel back.
+ */
+class VesselTable
+{
+ public:
+    VesselTable()
+        :m_uUpdates(0)
+    {
+        for (auto &shard : m_shards) {
+            shard.m_arrays.push_back(std::make_unique<SlotArray>(VESSEL_SHARD_CAPACITY));
+            shard.m_pSlots.store(shard.m_arrays.back().get(), std::memory_order_release);
+            shard.m_uSize = 0;
+        }
+    }
+
+    VesselTable(const VesselTable &) = delete;
+    VesselTable &operator=(const VesselTable &) = delete;
+
+    // update from all position reports of a chunk (thread safe)
+    void update(const Payloads &_payloads) {
+        std::array<VesselState, AIS_CHUNK_SIZE> states;
+        std::array<uint16_t, AIS_CHUNK_SIZE> order;
+        std::array<uint8_t, AIS_CHUNK_SIZE> shards;
+        size_t n = 0;
+        for (const MsgPayload &payload : _payloads) {
+            if ( (n < states.size()) &&
+                 (getVesselState(payload, states[n]) == true) )
+            {
+                shards[n] = (uint8_t)shardIndex(states[n].m_uMmsi);
+                order[n] = (uint16_t)n;
+                n++;
+            }
+        }
+
+        // stable: updates of a vessel keep their order within the chunk
+        std::stable_sort(order.begin(), order.begin() + n, [&shards](uint16_t _a, uint16_t _b){return shards[_a] < shards[_b];});
+
+        for (size_t i = 0; i < n; ) {
+            Shard &shard = m_shards[shards[order[i]]];
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            do {
+                write(shard, states[order[i]]);
+                i++;
+            } while ( (i < n) && (&m_shards[shards[order[i]]] == &shard) );
+        }
+
+        m_uUpdates.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // update one vessel (thread safe)
+    void update(const VesselState &_state) {
+        update(&_state, 1);
+    }
+
+    // update from states, locking once per run of states of the same shard (e.g. snapshot() output; thread safe)
+    void update(const VesselState *_pStates, size_t _uCount) {
+        for (size_t i = 0; i < _uCount; ) {
+            Shard &shard = m_shards[shardIndex(_pStates[i].m_uMmsi)];
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            do {
+                write(shard, _pStates[i]);
+                i++;
+            } while ( (i < _uCount) && (&m_shards[shardIndex(_pStates[i].m_uMmsi)] == &shard) );
+        }
+
+        m_uUpdates.fetch_add(_uCount, std::memory_order_relaxed);
+    }
+
+    // latest state of a vessel (lock-free); false if unknown
+    bool get(uint32_t _uMmsi, VesselState &_state) const {
+        const SlotArray &slots = *m_shards[shardIndex(_uMmsi)].m_pSlots.load(std::memory_order_acquire);
+        for (size_t i = slotIndex(_uMmsi, slots.m_uMask); ; i = (i + 1) & slots.m_uMask) {
+            uint32_t uKey = slots.m_slots[i].m_uMmsi.load(std::memory_order_acquire);
+            if (uKey == _uMmsi) {
+                read(slots.m_slots[i], _state);
+                return true;
+            }
+            else if (uKey == 0) {
+                return false;
+            }
+        }
+    }
+
+    // call _func(const VesselState &) for every vessel (lock-free; each state is consistent, the set is not a point in time)
+    template <typename Func>
+    void forEach(Func _func) const {
+        VesselState state;
+        for (const auto &shard : m_shards) {
+            const SlotArray &slots = *shard.m_pSlots.load(std::memory_order_acquire);
+            for (size_t i = 0; i <= slots.m_uMask; i++) {
+                if (slots.m_slots[i].m_uMmsi.load(std::memory_order_acquire) != 0) {
+                    read(slots.m_slots[i], state);
+                    _func(state);
+                }
+            }
+        }
+    }
+
+    // copy of all vessel states (grouped by shard)
+    std::vector<VesselState> snapshot() const {
+        std::vector<VesselState> states;
+        states.reserve(size());
+        forEach([&states](const VesselState &_state){states.push_back(_state);});
+        return states;
+    }
+
+    // number of vessels
+    size_t size() const {
+        size_t uSize = 0;
+        for (const auto &shard : m_shards) {
+            uSize += shard.m_pSlots.load(std::memory_order_acquire)->m_uUsed.load(std::memory_order_relaxed);
+        }
+
+        return uSize;
+    }
+
+    // position reports applied (or ignored as older than the stored state)
+    uint64_t updates() const {
+        return m_uUpdates.load(std::memory_order_relaxed);
+    }
+
+ private:
+    /* Seqlock protected vessel state (32 bytes, two per cache line) */
+    struct Slot
+    {
+        std::atomic<uint32_t>   m_uSequence;            // odd while written
+        std::atomic<uint32_t>   m_uMmsi;                // 0: empty (set once, after the first state)
+        std::atomic<uint64_t>   m_words[3];             // lon/lat, sog/cog/heading/status/type, timestamp
+    };
+
+    struct SlotArray
+    {
+        explicit SlotArray(size_t _uCapacity)
+            :m_slots(new Slot[_uCapacity]),
+             m_uMask(_uCapacity - 1),
+             m_uUsed(0)
+        {
+            for (size_t i = 0; i < _uCapacity; i++) {
+                m_slots[i].m_uSequence.store(0, std::memory_order_relaxed);
+                m_slots[i].m_uMmsi.store(0, std::memory_order_relaxed);
+                for (auto &word : m_slots[i].m_words) {
+                    word.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        std::unique_ptr<Slot[]>     m_slots;
+        size_t                      m_uMask;
+        std::atomic<size_t>         m_uUsed;
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex                                  m_mutex;            // writers
+        std::atomic<SlotArray*>                     m_pSlots;           // current slot array (readers)
+        std::vector<std::unique_ptr<SlotArray>>     m_arrays;           // current and retired arrays
+        size_t                                      m_uSize;
+    };
+
+    static size_t shardIndex(uint32_t _uMmsi) {
+        return vesselShard(_uMmsi);
+    }
+
+    static size_t slotIndex(uint32_t _uMmsi, size_t _uMask) {
+        return (vesselHash(_uMmsi) / VESSEL_SHARDS) & _uMask;
+    }
+
+    static void pack(const VesselState &_state, std::atomic<uint64_t> (&_words)[3]) {
+        _words[0].store(((uint64_t)(uint32_t)_state.m_iLon << 32) | (uint32_t)_state.m_iLat, std::memory_order_relaxed);
+        _words[1].store(((uint64_t)_state.m_uSog << 48) | ((uint64_t)_state.m_uCog << 32) | ((uint64_t)_state.m_uHeading << 16) |
+                        ((uint64_t)_state.m_uNavStatus << 8) | _state.m_uMsgType, std::memory_order_relaxed);
+        _words[2].store(_state.m_uTimestamp, std::memory_order_relaxed);
+    }
+
+    static void read(const Slot &_slot, VesselState &_state) {
+        uint64_t words[3];
+        uint32_t uSequence;
+        do {
+            do {
+                uSequence = _slot.m_uSequence.load(std::memory_order_acquire);
+            } while ((uSequence & 1) != 0);
+
+            for (size_t i = 0; i < 3; i++) {
+                words[i] = _slot.m_words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while (_slot.m_uSequence.load(std::memory_order_relaxed) != uSequence);
+
+        _state.m_uMmsi = _slot.m_uMmsi.load(std::memory_order_relaxed);
+        _state.m_iLon = (int32_t)(uint32_t)(words[0] >> 32);
+        _state.m_iLat = (int32_t)(uint32_t)words[0];
+        _state.m_uSog = (uint16_t)(words[1] >> 48);
+        _state.m_uCog = (uint16_t)(words[1] >> 32);
+        _state.m_uHeading = (uint16_t)(words[1] >> 16);
+        _state.m_uNavStatus = (uint8_t)(words[1] >> 8);
+        _state.m_uMsgType = (uint8_t)words[1];
+        _state.m_uTimestamp = words[2];
+    }
+
+    // store state in its slot (shard locked by the caller)
+    void write(Shard &_shard, const VesselState &_state) {
+        if (_state.m_uMmsi == 0) {
+            return;
+        }
+
+        SlotArray *pSlots = _shard.m_pSlots.load(std::memory_order_relaxed);
+        if (2 * (_shard.m_uSize + 1) > pSlots->m_uMask + 1) {
+            pSlots = grow(_shard);
+        }
+
+        size_t i = slotIndex(_state.m_uMmsi, pSlots->m_uMask);
+        while (true) {
+            Slot &slot = pSlots->m_slots[i];
+            uint32_t uKey = slot.m_uMmsi.load(std::memory_order_relaxed);
+            if (uKey == _state.m_uMmsi) {
+                if (_state.m_uTimestamp >= slot.m_words[2].load(std::memory_order_relaxed)) {
+                    uint32_t uSequence = slot.m_uSequence.load(std::memory_order_relaxed);
+                    slot.m_uSequence.store(uSequence + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                    pack(_state, slot.m_words);
+                    slot.m_uSequence.store(uSequence + 2, std::memory_order_release);
+                }
+
+                return;
+            }
+            else if (uKey == 0) {
+                // new vessel: state first, then the key makes the slot visible
+                pack(_state, slot.m_words);
+                slot.m_uMmsi.store(_state.m_uMmsi, std::memory_order_release);
+                _shard.m_uSize++;
+                pSlots->m_uUsed.store(_shard.m_uSize, std::memory_order_relaxed);
+                return;
+            }
+
+            i = (i + 1) & pSlots->m_uMask;
+        }
+    }
+
+    // copy all slots into an array of twice the size and publish it (shard locked by the caller)
+    SlotArray *grow(Shard &_shard) {
+        const SlotArray &old = *_shard.m_pSlots.load(std::memory_order_relaxed);
+        auto pNew = std::make_unique<SlotArray>(2 * (old.m_uMask + 1));
+        for (size_t j = 0; j <= old.m_uMask; j++) {
+            uint32_t uMmsi = old.m_slots[j].m_uMmsi.load(std::memory_order_relaxed);
+            if (uMmsi == 0) {
+                continue;
+            }
+
+            size_t i = slotIndex(uMmsi, pNew->m_uMask);
+            while (pNew->m_slots[i].m_uMmsi.load(std::memory_order_relaxed) != 0) {
+                i = (i + 1) & pNew->m_uMask;
+            }
+
+            for (size_t w = 0; w < 3; w++) {
+                pNew->m_slots[i].m_words[w].store(old.m_slots[j].m_words[w].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+
+            pNew->m_slots[i].m_uMmsi.store(uMmsi, std::memory_order_relaxed);
+        }
+
+        pNew->m_uUsed.store(_shard.m_uSize, std::memory_order_relaxed);
+        _shard.m_pSlots.store(pNew.get(), std::memory_order_release);
+        _shard.m_arrays.push_back(std::move(pNew));
+        return _shard.m_arrays.back().get();
+    }
+
+    std::array<Shard, VESSEL_SHARDS>    m_shards;
+    std::atomic<uint64_t>               m_uUpdates;
+};
+
+
+/*
+    Static data per MMSI (name, callsign, IMO, ship type, dimensions, destination), updated from type 5 and 24
+    messages by any number of threads. Static reports are rare compared to positions, so every shard is a hash map
+    behind a mutex. Reports are merged: fields a message does not carry (e.g. the name in type 24 part B) keep
+    their value, and fields of a report older than the stored one only fill in what is still empty.
+ */
+class VesselStaticCache
+{
+ public:
+    VesselStaticCache() = default;
+
+    VesselStaticCache(const VesselStaticCache &) = delete;
+    VesselStaticCache &operator=(const VesselStaticCache &) = delete;
+
+    // update from all static reports of a chunk (thread safe)
+    void update(const Payloads &_payloads) {
+        VesselStatic staticData;
+        for (const MsgPayload &payload : _payloads) {
+            if (getVesselStatic(payload, staticData) == true) {
+                update(staticData);
+            }
+        }
+    }
+
+    // merge static data of one vessel (thread safe)
+    void update(const VesselStatic &_static) {
+        if (_static.m_uMmsi == 0) {
+            return;
+        }
+
+        Shard &shard = m_shards[vesselShard(_static.m_uMmsi)];
+        std::lock_guard<std::mutex> lock(shard.m_mutex);
+        auto it = shard.m_map.find(_static.m_uMmsi);
+        if (it == shard.m_map.end()) {
+            shard.m_map.emplace(_static.m_uMmsi, _static);
+        }
+        else {
+            merge(it->second, _static);
+        }
+    }
+
+    // static data of a vessel; false if unknown
+    bool get(uint32_t _uMmsi, VesselStatic &_static) const {
+        const Shard &shard = m_shards[vesselShard(_uMmsi)];
+        std::lock_guard<std::mutex> lock(shard.m_mutex);
+        auto it = shard.m_map.find(_uMmsi);
+        if (it == shard.m_map.end()) {
+            return false;
+        }
+
+        _static = it->second;
+        return true;
+    }
+
+    // call _func(const VesselStatic &) for every vessel (one shard locked at a time)
+    template <typename Func>
+    void forEach(Func _func) const {
+        for (const auto &shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            for (const auto &entry : shard.m_map) {
+                _func(entry.second);
+            }
+        }
+    }
+
+    // copy of all static data
+    std::vector<VesselStatic> snapshot() const {
+        std::vector<VesselStatic> statics;
+        statics.reserve(size());
+        forEach([&statics](const VesselStatic &_static){statics.push_back(_static);});
+        return statics;
+    }
+
+    // number of vessels
+    size_t size() const {
+        size_t uSize = 0;
+        for (const auto &shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            uSize += shard.m_map.size();
+        }
+
+        return uSize;
+    }
+
+ private:
+    struct alignas(64) Shard
+    {
+        mutable std::mutex                          m_mutex;
+        std::unordered_map<uint32_t, VesselStatic>  m_map;
+    };
+
+    static void merge(VesselStatic &_to, const VesselStatic &_from) {
+        bool bNewer = _from.m_uTimestamp >= _to.m_uTimestamp;
+        if ( (_from.m_uImo != 0) && ( (bNewer == true) || (_to.m_uImo == 0) ) ) {
+            _to.m_uImo = _from.m_uImo;
+        }
+
+        if ( (_from.m_callsign[0] != 0) && ( (bNewer == true) || (_to.m_callsign[0] == 0) ) ) {
+            memcpy(_to.m_callsign, _from.m_callsign, sizeof(_to.m_callsign));
+        }
+
+        if ( (_from.m_name[0] != 0) && ( (bNewer == true) || (_to.m_name[0] == 0) ) ) {
+            memcpy(_to.m_name, _from.m_name, sizeof(_to.m_name));
+        }
+
+        if ( (_from.m_destination[0] != 0) && ( (bNewer == true) || (_to.m_destination[0] == 0) ) ) {
+            memcpy(_to.m_destination, _from.m_destination, sizeof(_to.m_destination));
+        }
+
+        if ( (_from.m_uShipType != 0) && ( (bNewer == true) || (_to.m_uShipType == 0) ) ) {
+            _to.m_uShipType = _from.m_uShipType;
+        }
+
+        bool bFromDimensions = (_from.m_uToBow | _from.m_uToStern | _from.m_uToPort | _from.m_uToStarboard) != 0;
+        bool bToDimensions = (_to.m_uToBow | _to.m_uToStern | _to.m_uToPort | _to.m_uToStarboard) != 0;
+        if ( (bFromDimensions == true) && ( (bNewer == true) || (bToDimensions == false) ) ) {
+            _to.m_uToBow = _from.m_uToBow;
+            _to.m_uToStern = _from.m_uToStern;
+            _to.m_uToPort = _from.m_uToPort;
+            _to.m_uToStarboard = _from.m_uToStarboard;
+        }
+
+        _to.m_uTimestamp = std::max(_to.m_uTimestamp, _from.m_uTimestamp);
+    }
+
+    std::array<Shard, VESSEL_SHARDS>    m_shards;
+};
+
+
+
+#endif // #ifndef AIS_VESSELS_H
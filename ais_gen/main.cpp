@@ -0,0 +1,157 @@
+#include "ais_decoder/generator.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+const size_t GEN_OUTPUT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+
+/* parse byte count with optional k, M or G suffix */
+uint64_t parseSize(const char *_psz)
+{
+    char *pEnd = nullptr;
+    uint64_t uSize = strtoull(_psz, &pEnd, 10);
+    switch (*pEnd) {
+        case 'k': case 'K': return uSize << 10;
+        case 'm': case 'M': return uSize << 20;
+        case 'g': case 'G': return uSize << 30;
+        default: return uSize;
+    }
+}
+
+
+/* write all of _uSize bytes */
+bool writeAll(int _fd, const char *_pData, size_t _uSize)
+{
+    while (_uSize > 0) {
+        ssize_t n = write(_fd, _pData, _uSize);
+        if (n <= 0) {
+            return false;
+        }
+
+        _pData += n;
+        _uSize -= n;
+    }
+
+    return true;
+}
+
+
+/*
+    Synthetic NMEA feed generator (see NmeaGenerator), e.g. for benchmarks and load tests.
+    Usage: ais_gen [--output PATH|-] [--messages N] [--size BYTES[k|M|G]] [--seed N] [--vessels N] [--stations N]
+                   [--multi-ratio R] [--interleave N] [--corrupt-rate R] [--duplicate-rate R] [--rate MSGS_PER_S]
+                   [--start UNIX_TIME]
+    Generation stops after N messages or once the output has reached the given size (default 1M messages).
+    Output goes to stdout by default; a summary is printed to stderr.
+ */
+int main(int argc, char* argv[])
+{
+    GeneratorConfig config;
+    std::string outputPath = "-";
+    uint64_t uMaxMessages = 0;
+    uint64_t uMaxBytes = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--output") == 0) {
+            outputPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--messages") == 0) {
+            uMaxMessages = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--size") == 0) {
+            uMaxBytes = parseSize(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            config.m_uSeed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--vessels") == 0) {
+            config.m_uVessels = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--stations") == 0) {
+            config.m_uStations = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--multi-ratio") == 0) {
+            config.m_dMultiFragmentRatio = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--interleave") == 0) {
+            config.m_uInterleave = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--corrupt-rate") == 0) {
+            config.m_dCorruptRate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--duplicate-rate") == 0) {
+            config.m_dDuplicateRate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--rate") == 0) {
+            config.m_uMessageRate = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--start") == 0) {
+            config.m_uStartTime = strtoull(argv[++i], nullptr, 10);
+        }
+    }
+
+    if ( (uMaxMessages == 0) &&
+         (uMaxBytes == 0) )
+    {
+        uMaxMessages = 1000000;
+    }
+
+    int fd = (outputPath == "-") ? STDOUT_FILENO : open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open '%s'\n", outputPath.c_str());
+        return -1;
+    }
+
+    auto tsStart = std::chrono::steady_clock::now();
+
+    NmeaGenerator generator(config);
+    std::vector<char> buffer(GEN_OUTPUT_BUFFER_SIZE);
+    size_t uUsed = 0;
+    bool bOk = true;
+    while ( (bOk == true) &&
+            ( (uMaxMessages == 0) || (generator.stats().m_uMessages < uMaxMessages) ) &&
+            ( (uMaxBytes == 0) || (generator.stats().m_uBytes < uMaxBytes) ) )
+    {
+        if (uUsed + GEN_MAX_STEP > buffer.size()) {
+            bOk = writeAll(fd, buffer.data(), uUsed);
+            uUsed = 0;
+        }
+
+        uUsed += generator.step(buffer.data() + uUsed);
+    }
+
+    if (uUsed + GEN_MAX_STEP > buffer.size()) {
+        bOk = bOk && writeAll(fd, buffer.data(), uUsed);
+        uUsed = 0;
+    }
+
+    uUsed += generator.flush(buffer.data() + uUsed);
+    bOk = bOk && writeAll(fd, buffer.data(), uUsed);
+
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+
+    if (bOk == false) {
+        fprintf(stderr, "failed to write '%s'\n", outputPath.c_str());
+        return -1;
+    }
+
+    const GeneratorStats &stats = generator.stats();
+    double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tsStart).count();
+    fprintf(stderr, "messages=%llu duplicates=%llu sentences=%llu corrupted=%llu bytes=%llu (%.1f MB/s)\n",
+            (unsigned long long)stats.m_uMessages, (unsigned long long)stats.m_uDuplicates,
+            (unsigned long long)stats.m_uSentences, (unsigned long long)stats.m_uCorrupted,
+            (unsigned long long)stats.m_uBytes, stats.m_uBytes / dSeconds / 1e6);
+
+    return 0;
+}
@@ -1,15 +1,26 @@
 
+#include "ais_decoder/affinity.h"
 #include "ais_decoder/strutils.h"
 #include "ais_decoder/decoder.h"
+#include "ais_decoder/heatmap.h"
+#include "ais_decoder/metrics.h"
+#include "ais_decoder/perf.h"
+#include "ais_decoder/pipeline.h"
 #include "ais_decoder/processing.h"
 #include "ais_decoder/queue.h"
+#include "ais_decoder/scheduler.h"
+#include "ais_decoder/snapshot.h"
+#include "ais_decoder/source.h"
+#include "ais_decoder/store.h"
 #include "ais_decoder/tiff.h"
+#include "ais_decoder/vessels.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <array>
 #include <cstring>
 #include <chrono>
+#include <ctime>
 #include <string>
 #include <atomic>
 #include <thread>
@@ -21,233 +32,385 @@
 
 
 
-template <typename payload_type>
-using Queue = BlockingQueue<payload_type, 1024>;
+/*
+    Queue type per stage is selected at compile time (BlockingQueue, SpscQueue or MpmcQueue),
+    e.g. cmake -DAIS_MESSAGE_QUEUE=SpscQueue.
+ */
+#ifndef AIS_FRAGMENT_QUEUE
+#define AIS_FRAGMENT_QUEUE BlockingQueue
+#endif
 
-Queue<std::unique_ptr<Fragments>> fragmentQueue;
-Queue<std::unique_ptr<Messages>> messageQueue;
-Queue<std::unique_ptr<Payloads>> payloadQueue;
-String<1024*64> nmeaData;
-std::atomic<bool> fileFinished = false;
-std::atomic<uint32> msgCount = 0;
+#ifndef AIS_MESSAGE_QUEUE
+#define AIS_MESSAGE_QUEUE BlockingQueue
+#endif
 
-const int OUTPUT_WIDTH = 1024 * 4;
-const int OUTPUT_HEIGHT = 1024 * 4;
-std::vector<uint16_t> image(OUTPUT_WIDTH * OUTPUT_HEIGHT, 0);
-int pixelMax = 0;
+#ifndef AIS_PAYLOAD_QUEUE
+#define AIS_PAYLOAD_QUEUE BlockingQueue
+#endif
 
+using ReaderPipeline = BasicPipeline<AIS_FRAGMENT_QUEUE<std::unique_ptr<Fragments>, 1024>,
+                                     AIS_MESSAGE_QUEUE<std::unique_ptr<Messages>, 1024>,
+                                     AIS_PAYLOAD_QUEUE<std::unique_ptr<Payloads>, 1024>>;
 
+std::atomic<uint32> msgCount = 0;
 
-using Clock = std::chrono::high_resolution_clock;
-FILE *fin = nullptr;
+StoreWriter store;
 
 
-bool readFromFile()
-{
-    if (fin == nullptr)
-    {
-        fin = fopen("data/Smithland.txt", "rb");
-    }
-    
-    if ( (fin != nullptr) &&
-         (feof(fin) == 1) )
-    {
-        fclose(fin);
-        fin = nullptr;
-        return false;   // finished reading file
-    }
-    
-    if ( (fin != nullptr) &&
-         (feof(fin) == 0) )
-    {
-        int n = fread(nmeaData.data() + nmeaData.size(), 1, nmeaData.maxSize() - nmeaData.size(), fin);
-        nmeaData.setSize(nmeaData.size() + n);
-    }
-    
-    size_t bytesUsed = processNmeaData(fragmentQueue, nmeaData);
-    if (bytesUsed > 0) {
-        // keep dropped data for next read
-        size_t droppedSize = nmeaData.size() - bytesUsed;
-        memcpy(nmeaData.data(), nmeaData.data() + bytesUsed, droppedSize);
-        nmeaData.setSize(droppedSize);
-    }
-    
-    return true;    // still busy on file
-}
 
+using Clock = std::chrono::high_resolution_clock;
 
-void readFragments() {
-    bool hasData = true;
-    while (hasData == true) {
-        auto bBusy = readFromFile();
 
-        // check if we are done with file
-        if (bBusy == false) {
-            fileFinished = true;
-            hasData = false;
-        }
+void processPayloads(const Payloads &_payloads) {
+    if (store.isOpen() == true) {
+        store.writeChunk(_payloads);
     }
-}
-
-
-void procFragmentsQueue() {
-    bool hasData = true;
-    while (hasData == true) {
-        processFragments(messageQueue, fragmentQueue);
+    
+    for (const MsgPayload &p : _payloads) {
+        size_t uBitIndex = 0;
         
-        // check if we are done with file and no more data in input queue
-        if ( (fileFinished == true) &&
-             (fragmentQueue.empty() == true) )
+        int msgType = getUnsignedValue(p, uBitIndex, 6);
+        if (msgType == 5)
         {
-            hasData = false;
+            getUnsignedValue(p, uBitIndex, 2);                 // repeatIndicator
+            auto mmsi = getUnsignedValue(p, uBitIndex, 30);
+            getUnsignedValue(p, uBitIndex, 2);                 // AIS version
+            auto imo = getUnsignedValue(p, uBitIndex, 30);
+            auto callsign = getString(p, uBitIndex, 42);
+            auto name = getString(p, uBitIndex, 120);
+            auto type = getUnsignedValue(p, uBitIndex, 8);
+            
+            //printf("mmsi=%lu, callsign=%s, name=%s\n", mmsi, callsign.c_str(), name.c_str());
         }
-    }
-}
-
-
-void procMessagesQueue() {
-    bool hasData = true;
-    while (hasData == true) {
-        processMessages(payloadQueue, messageQueue);
-        
-        // check if we are done with file and no more data in input queue
-        if ( (fileFinished == true) &&
-             (messageQueue.empty() == true) )
+        else if ( (msgType == 1) ||
+                  (msgType == 2) ||
+                  (msgType == 3) )
         {
-            hasData = false;
+            getUnsignedValue(p, uBitIndex, 2);                 // repeatIndicator
+            auto mmsi = getUnsignedValue(p, uBitIndex, 30);
+            auto navstatus = getUnsignedValue(p, uBitIndex, 4);
+            auto rot = getSignedValue(p, uBitIndex, 8);
+            auto sog = getUnsignedValue(p, uBitIndex, 10);
+            auto posAccuracy = getBoolValue(p, uBitIndex);
+            auto posLon = getSignedValue(p, uBitIndex, 28);
+            auto posLat = getSignedValue(p, uBitIndex, 27);
+            auto cog = (int)getUnsignedValue(p, uBitIndex, 12);
+            auto heading = (int)getUnsignedValue(p, uBitIndex, 9);
+            
+            getUnsignedValue(p, uBitIndex, 6);     // timestamp
+            getUnsignedValue(p, uBitIndex, 2);     // maneuver indicator
+            getUnsignedValue(p, uBitIndex, 3);     // spare
+            getBoolValue(p, uBitIndex);          // RAIM
+            getUnsignedValue(p, uBitIndex, 19);     // radio status
         }
-    }
-}
-
 
-void procPayloadsQueue() {
-    bool hasData = true;
-    while (hasData == true) {
-        auto pPayloads = payloadQueue.pop();
-        if (pPayloads != nullptr) {
-            for (MsgPayload &p : *pPayloads) {
-                size_t uBitIndex = 0;
-                
-                int msgType = getUnsignedValue(p, uBitIndex, 6);
-                if (msgType == 5)
-                {
-                    getUnsignedValue(p, uBitIndex, 2);                 // repeatIndicator
-                    auto mmsi = getUnsignedValue(p, uBitIndex, 30);
-                    getUnsignedValue(p, uBitIndex, 2);                 // AIS version
-                    auto imo = getUnsignedValue(p, uBitIndex, 30);
-                    auto callsign = getString(p, uBitIndex, 42);
-                    auto name = getString(p, uBitIndex, 120);
-                    auto type = getUnsignedValue(p, uBitIndex, 8);
-                    
-                    //printf("mmsi=%lu, callsign=%s, name=%s\n", mmsi, callsign.c_str(), name.c_str());
-                }
-                else if ( (msgType == 1) ||
-                          (msgType == 2) ||
-                          (msgType == 3) )
-                {
-                    getUnsignedValue(p, uBitIndex, 2);                 // repeatIndicator
-                    auto mmsi = getUnsignedValue(p, uBitIndex, 30);
-                    auto navstatus = getUnsignedValue(p, uBitIndex, 4);
-                    auto rot = getSignedValue(p, uBitIndex, 8);
-                    auto sog = getUnsignedValue(p, uBitIndex, 10);
-                    auto posAccuracy = getBoolValue(p, uBitIndex);
-                    auto posLon = getSignedValue(p, uBitIndex, 28);
-                    auto posLat = getSignedValue(p, uBitIndex, 27);
-                    auto cog = (int)getUnsignedValue(p, uBitIndex, 12);
-                    auto heading = (int)getUnsignedValue(p, uBitIndex, 9);
-                    
-                    getUnsignedValue(p, uBitIndex, 6);     // timestamp
-                    getUnsignedValue(p, uBitIndex, 2);     // maneuver indicator
-                    getUnsignedValue(p, uBitIndex, 3);     // spare
-                    getBoolValue(p, uBitIndex);          // RAIM
-                    getUnsignedValue(p, uBitIndex, 19);     // radio status
-                    
-                    float dLat = -(posLat/600000.0f - 37.2) * 150;
-                    float dLon = (posLon/600000.0f + 88.2) * 150;
-                    
-                    int y = (int)((dLat / 90.0 + 0.5) * OUTPUT_HEIGHT);
-                    int x = (int)((dLon / 180.0 + 0.5) * OUTPUT_WIDTH);
-                    if ((y < OUTPUT_HEIGHT) &&
-                        (y >= 0) &&
-                        (x < OUTPUT_WIDTH) &&
-                        (x >= 0) )
-                    {
-                        size_t offset = y * OUTPUT_WIDTH + x;
-                        image[offset] += 1000;
-                        pixelMax = std::max((int)image[offset], pixelMax);
-                    }
-                }
-
-                msgCount++;
-            }
-        }
-                
-        // check if we are done with file and no more data in input queue
-        if ( (fileFinished == true) &&
-             (payloadQueue.empty() == true) )
-        {
-            hasData = false;
-        }
+        msgCount++;
     }
 }
 
 
-void statusReport() {
+void statusReport(ReaderPipeline &_pipeline, const std::string &_strMetricsPath) {
     double msgRate = 0;
     auto tsOld = Clock::now();
     
     bool hasData = true;
     while (hasData == true) {
+        hasData = (_pipeline.wait(1000ms) == false);
+        
         auto ts = Clock::now();
         auto td = std::chrono::duration_cast<std::chrono::nanoseconds>(ts - tsOld).count() * 1e-09;
         msgRate = msgCount / td;
         tsOld = ts;
         msgCount = 0;
     
-        printf("frgq=%d, msgq=%d, pldq=%d, rate=%.2f\n",
-               (int)fragmentQueue.size(),
-               (int)messageQueue.size(),
-               (int)payloadQueue.size(),
+        auto pool = MemoryPool<Payloads>::stats();
+        printf("frgq=%d, msgq=%d, pldq=%d, tasks=%d, chunk=%d, pool=%d/%d(%d,+%d), drop=%d, rate=%.2f\n",
+               (int)_pipeline.fragmentQueueSize(),
+               (int)_pipeline.messageQueueSize(),
+               (int)_pipeline.payloadQueueSize(),
+               (int)_pipeline.chunksInFlight(),
+               (int)_pipeline.chunkTarget(),
+               (int)pool.m_uInUse,
+               (int)pool.m_uAllocated,
+               (int)pool.m_uHighWater,
+               (int)pool.m_uOverflow,
+               (int)_pipeline.dropCount(),
                (float)msgRate);
-               
-        // check if we are done with file and no more data in input queue
-        if ( (fileFinished == true) &&
-             (payloadQueue.empty() == true) )
-        {
-            hasData = false;
-            printf("done.\n");
-            
-            for (size_t i = 0; i < image.size(); i++) {
-                image[i] = image[i] / (double)pixelMax * ((2 << 16) - 1);
-            }
-            
-            writeTiffFileInt16("test.tiff", OUTPUT_WIDTH, OUTPUT_HEIGHT, (uint16_t*)image.data());
+        
+        std::string strPerf = _pipeline.perfSummary();
+        if (strPerf.empty() == false) {
+            printf("perf: %s\n", strPerf.c_str());
         }
-        else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        
+#if AIS_TRACE_LATENCY
+        auto &latency = _pipeline.latency();
+        printf("latency(us): p50=%.1f, p99=%.1f, p999=%.1f\n",
+               latency.endToEnd(0.5) * 1e-3,
+               latency.endToEnd(0.99) * 1e-3,
+               latency.endToEnd(0.999) * 1e-3);
+#endif
+        
+        if (_strMetricsPath.empty() == false) {
+            _pipeline.metrics().writeFile(_strMetricsPath);
         }
     }
+    
+    printf("done.\n");
 }
 
 
 
     
 
-int main() {
-    
-    auto thread1 = std::thread(readFragments);
-    auto thread2 = std::thread(procFragmentsQueue);
-    auto thread3 = std::thread(procMessagesQueue);
-    auto thread4 = std::thread(procPayloadsQueue);
-    auto thread5 = std::thread(statusReport);
+/* write heatmap as GeoTIFF (counts scaled to _uMaxCount, see HeatmapGrid::image16) */
+void writeHeatmap(const char *_pszPath, const HeatmapGrid &_grid, uint32_t _uMaxCount, const HeatmapConfig &_config) {
+    std::vector<uint16_t> image;
+    _grid.image16(image, _uMaxCount);
     
-    thread1.join();
-    thread2.join();
-    thread3.join();
-    thread4.join();
-    thread5.join();
+    TiffOptions tiffOptions;
+    tiffOptions.m_geoRef = (_config.m_uProjection == HEATMAP_WEB_MERCATOR) ?
+                            tiffGeoRefWebMercator(_config.m_dMinLon, _config.m_dMinLat, _config.m_dMaxLon, _config.m_dMaxLat) :
+                            tiffGeoRefLonLat(_config.m_dMinLon, _config.m_dMinLat, _config.m_dMaxLon, _config.m_dMaxLat);
+    if (writeTiledTiff16(_pszPath, (uint32_t)_config.m_uWidth, (uint32_t)_config.m_uHeight, image.data(), tiffOptions) != 0) {
+        printf("failed to write '%s'\n", _pszPath);
+    }
 }
 
 
+/*
+    Usage: ais_reader [--input PATH|-] [--tasks] [--fragment-threads N] [--message-threads N]
+                      [--latency-target-us N] [--flush-deadline-us N]
+                      [--numa-node N] [--pin-input CPUS] [--pin-fragments CPUS] [--pin-messages CPUS] [--pin-sink CPUS]
+                      [--pool-chunks N] [--huge-pages] [--metrics-file PATH] [--metrics-port N] [--perf]
+                      [--heatmap-bbox MINLON,MINLAT,MAXLON,MAXLAT] [--heatmap-size WxH] [--heatmap-mercator]
+                      [--heatmap-bin-seconds N] [--snapshot PATH] [--snapshot-interval SECONDS] [--store PATH]
+    A latency target enables adaptive input chunk sizes.
+    --pool-chunks preallocates N chunks per chunk type (optionally on huge pages) and bounds memory use to them.
+    CPUS is a cpu list (e.g. 0-3,8); --numa-node pins all threads (and task workers) to the cpus of a node.
+    Partial input chunks are pushed once they are older than the flush deadline (default 5ms).
+    Pipeline metrics (Prometheus text) are written to PATH every second and/or served on http://127.0.0.1:N/metrics.
+    --perf counts cycles, instructions, LLC and branch misses per stage (perf_event_open) and reports them per item.
+    Position reports are counted into a heatmap on the message workers; the default bbox covers the area around
+    the sample data (4096x4096, equirectangular). It is written to test.tiff as tiled, DEFLATE compressed GeoTIFF
+    with overviews. With --heatmap-bin-seconds (e.g. 3600) positions are also binned by tag block time and every
+    bin is written as a frame (test_<bin start, UTC>.tiff, all frames on one scale); positions without tag block
+    time are only in test.tiff.
+    The latest position, speed, course and navigation status per MMSI is kept in a VesselTable (also a stage),
+    static data (types 5 and 24) in a VesselStaticCache. With --snapshot both are loaded from PATH on startup
+    (if it exists) and written back to it in the background every 60 seconds (--snapshot-interval) and at exit.
+    --store writes all decoded payloads to a binary store file with an MMSI/time index (see store.h).
+ */
+int main(int argc, char **argv) {
+    std::string inputPath = "data/Smithland.txt";   // "-" reads from stdin
+    bool bTasks = false;
+    std::vector<int> schedulerCpus;
+    size_t uPoolChunks = 0;
+    bool bHugePages = false;
+    std::string metricsPath;
+    int iMetricsPort = 0;
+    std::string snapshotPath;
+    std::string storePath;
+    uint64_t uSnapshotInterval = 60;
+    PipelineBuilder<ReaderPipeline> builder;
+    
+    HeatmapConfig heatmapConfig;
+    heatmapConfig.m_dMinLon = -88.8;
+    heatmapConfig.m_dMinLat = 36.9;
+    heatmapConfig.m_dMaxLon = -87.6;
+    heatmapConfig.m_dMaxLat = 37.5;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tasks") == 0) {
+            bTasks = true;
+        }
+        else if ( (strcmp(argv[i], "--fragment-threads") == 0) && (i + 1 < argc) ) {
+            builder.fragmentThreads(atoi(argv[++i]));
+        }
+        else if ( (strcmp(argv[i], "--message-threads") == 0) && (i + 1 < argc) ) {
+            builder.messageThreads(atoi(argv[++i]));
+        }
+        else if ( (strcmp(argv[i], "--latency-target-us") == 0) && (i + 1 < argc) ) {
+            builder.latencyTarget(std::chrono::microseconds(atoi(argv[++i])));
+        }
+        else if ( (strcmp(argv[i], "--flush-deadline-us") == 0) && (i + 1 < argc) ) {
+            builder.flushDeadline(std::chrono::microseconds(std::max(atoi(argv[++i]), 0)));
+        }
+        else if ( (strcmp(argv[i], "--input") == 0) && (i + 1 < argc) ) {
+            inputPath = argv[++i];
+        }
+        else if ( (strcmp(argv[i], "--numa-node") == 0) && (i + 1 < argc) ) {
+            int iNode = atoi(argv[++i]);
+            schedulerCpus = numaNodeCpus(iNode);
+            builder.numaNode(iNode);
+        }
+        else if ( (strcmp(argv[i], "--pool-chunks") == 0) && (i + 1 < argc) ) {
+            uPoolChunks = (size_t)std::max(atoi(argv[++i]), 0);
+        }
+        else if (strcmp(argv[i], "--huge-pages") == 0) {
+            bHugePages = true;
+        }
+        else if (strcmp(argv[i], "--perf") == 0) {
+            builder.perfCounters(true);
+            
+            PerfCounters probe;
+            probe.open();
+            for (size_t uEvent = 0; uEvent < PERF_EVENTS; uEvent++) {
+                if (probe.supported(uEvent) == false) {
+                    printf("perf event '%s' not available\n", perfEventName(uEvent));
+                }
+            }
+        }
+        else if ( (strcmp(argv[i], "--heatmap-bbox") == 0) && (i + 1 < argc) ) {
+            if (sscanf(argv[++i], "%lf,%lf,%lf,%lf", &heatmapConfig.m_dMinLon, &heatmapConfig.m_dMinLat,
+                       &heatmapConfig.m_dMaxLon, &heatmapConfig.m_dMaxLat) != 4)
+            {
+                printf("invalid heatmap bbox '%s'\n", argv[i]);
+                return -1;
+            }
+        }
+        else if ( (strcmp(argv[i], "--heatmap-size") == 0) && (i + 1 < argc) ) {
+            if (sscanf(argv[++i], "%zux%zu", &heatmapConfig.m_uWidth, &heatmapConfig.m_uHeight) != 2) {
+                printf("invalid heatmap size '%s'\n", argv[i]);
+                return -1;
+            }
+        }
+        else if ( (strcmp(argv[i], "--heatmap-bin-seconds") == 0) && (i + 1 < argc) ) {
+            heatmapConfig.m_uBinSeconds = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--heatmap-mercator") == 0) {
+            heatmapConfig.m_uProjection = HEATMAP_WEB_MERCATOR;
+        }
+        else if ( (strcmp(argv[i], "--store") == 0) && (i + 1 < argc) ) {
+            storePath = argv[++i];
+        }
+        else if ( (strcmp(argv[i], "--snapshot") == 0) && (i + 1 < argc) ) {
+            snapshotPath = argv[++i];
+        }
+        else if ( (strcmp(argv[i], "--snapshot-interval") == 0) && (i + 1 < argc) ) {
+            uSnapshotInterval = strtoull(argv[++i], nullptr, 10);
+        }
+        else if ( (strcmp(argv[i], "--metrics-file") == 0) && (i + 1 < argc) ) {
+            metricsPath = argv[++i];
+        }
+        else if ( (strcmp(argv[i], "--metrics-port") == 0) && (i + 1 < argc) ) {
+            iMetricsPort = atoi(argv[++i]);
+        }
+        else if ( (strcmp(argv[i], "--pin-input") == 0) && (i + 1 < argc) ) {
+            builder.inputCpus(parseCpuList(argv[++i]));
+        }
+        else if ( (strcmp(argv[i], "--pin-fragments") == 0) && (i + 1 < argc) ) {
+            builder.fragmentCpus(parseCpuList(argv[++i]));
+        }
+        else if ( (strcmp(argv[i], "--pin-messages") == 0) && (i + 1 < argc) ) {
+            builder.messageCpus(parseCpuList(argv[++i]));
+        }
+        else if ( (strcmp(argv[i], "--pin-sink") == 0) && (i + 1 < argc) ) {
+            builder.sinkCpus(parseCpuList(argv[++i]));
+        }
+    }
+    
+    NmeaSource source;
+    if (openFileSource(source, inputPath) == false) {
+        printf("failed to open '%s'\n", inputPath.c_str());
+        return -1;
+    }
+    
+    if ( (uPoolChunks > 0) &&
+         ( (MemoryPool<Fragments>::reserve(uPoolChunks, bHugePages) == false) ||
+           (MemoryPool<Messages>::reserve(uPoolChunks, bHugePages) == false) ||
+           (MemoryPool<Payloads>::reserve(uPoolChunks, bHugePages) == false) ) )
+    {
+        printf("failed to reserve chunk pools\n");
+        return -1;
+    }
+    
+    std::unique_ptr<TaskScheduler> pScheduler;
+    if (bTasks == true) {
+        size_t uThreads = schedulerCpus.empty() ? std::thread::hardware_concurrency() : schedulerCpus.size();
+        pScheduler = std::make_unique<TaskScheduler>(uThreads, schedulerCpus);
+        builder.scheduler(*pScheduler);
+    }
+    
+    HeatmapStage heatmap(heatmapConfig);
+    VesselTable vessels;
+    VesselStaticCache statics;
+    if (snapshotPath.empty() == false) {
+        auto tsStart = Clock::now();
+        SnapshotHeader header;
+        if (loadVesselSnapshot(snapshotPath, vessels, statics, 0, &header) == true) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - tsStart);
+            printf("snapshot: %llu vessels, %llu static loaded in %.1fms\n", (unsigned long long)header.m_uVessels,
+                   (unsigned long long)header.m_uStatics, elapsed.count() / 1000.0);
+        }
+    }
+    
+    auto pPipeline = builder.source(source)
+                            .stage([&heatmap](Payloads &_payloads){heatmap.add(_payloads);})
+                            .stage([&vessels, &statics](Payloads &_payloads){vessels.update(_payloads); statics.update(_payloads);})
+                            .sink(processPayloads)
+                            .build();
+    
+    if ( (storePath.empty() == false) &&
+         (store.open(storePath.c_str()) == false) )
+    {
+        printf("failed to open store '%s'\n", storePath.c_str());
+        return -1;
+    }
+    
+    MetricsServer metricsServer;
+    if ( (iMetricsPort > 0) &&
+         (metricsServer.start((uint16_t)iMetricsPort, [&]{return pPipeline->metrics().text();}) == false) )
+    {
+        printf("failed to serve metrics on port %d\n", iMetricsPort);
+    }
+    
+    SnapshotWriter snapshotWriter;
+    if (snapshotPath.empty() == false) {
+        snapshotWriter.start(snapshotPath, vessels, statics, uSnapshotInterval);
+    }
+    
+    pPipeline->start();
+    
+    statusReport(*pPipeline, metricsPath);
+    pPipeline->drain();
+    int iResult = 0;
+    if (store.close() == false) {
+        printf("failed to write store '%s'\n", storePath.c_str());
+        iResult = -1;
+    }
+    
+    metricsServer.stop();
+    snapshotWriter.stop();
+    
+    if (metricsPath.empty() == false) {
+        pPipeline->metrics().writeFile(metricsPath);
+    }
+    
+    printf("vessels: %zu (%llu updates), static: %zu\n", vessels.size(), (unsigned long long)vessels.updates(), statics.size());
+    if (snapshotPath.empty() == false) {
+        printf("snapshot: %llu written, %llu failed\n", (unsigned long long)snapshotWriter.snapshots(), (unsigned long long)snapshotWriter.failures());
+    }
+    
+    if (heatmapConfig.m_uBinSeconds > 0) {
+        HeatmapCube cube = heatmap.mergedCube();
+        uint32_t uMaxCount = cube.maxCount();
+        size_t uFrames = 0;
+        cube.forEachFrame([&](uint64_t _uBinStart, const HeatmapGrid &_frame) {
+            time_t binTime = (time_t)_uBinStart;
+            struct tm binTm;
+            char filename[64];
+            strftime(filename, sizeof(filename), "test_%Y%m%dT%H%M%SZ.tiff", gmtime_r(&binTime, &binTm));
+            writeHeatmap(filename, _frame, uMaxCount, heatmapConfig);
+            uFrames++;
+        });
+        
+        printf("heatmap: %zu frames, %zu tiles, %llu positions without timestamp\n", uFrames, cube.tiles(), (unsigned long long)heatmap.untimed());
+    }
+    
+    writeHeatmap("test.tiff", heatmap.merged(), 0, heatmapConfig);
+    
+    return iResult;
+}
+
 
 